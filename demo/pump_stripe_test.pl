@@ -0,0 +1,93 @@
+#!/usr/bin/perl
+#
+# pump_stripe_test.pl [stripe-number] [mbytes...]
+#
+# ストライプデバイスと、そのメンバーのうち最初のPUMPの単体とで転送性能を比較する.
+#
+use POSIX;
+use File::Spec;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+$stripe_num      = (@ARGV > 0) ? shift(@ARGV) : 0;
+$stripe_sys_file = File::Spec->join("/","sys","class","pump_stripe","pump_stripe$stripe_num");
+$stripe_dev_file = File::Spec->join("/","dev","pump_stripe$stripe_num");
+
+sub set_attribute {
+    my $sys_file   = $_[0];
+    my $attr_name  = $_[1];
+    my $attr_value = $_[2];
+    my $attr_file  = File::Spec->join($sys_file, $attr_name);
+    open(my $fh, ">", $attr_file) or die "$! : $attr_file";
+    printf $fh "%d\n", $attr_value;
+    close($fh);
+}
+
+sub get_attribute {
+    my $sys_file   = $_[0];
+    my $attr_name  = $_[1];
+    my $attr_value;
+    my $attr_file  = File::Spec->join($sys_file, $attr_name);
+    my $line;
+    open(my $fh, "<", $attr_file) or die "$! : $attr_file";
+    while($line = <$fh>) {
+        chomp $line;
+        $attr_value = $line;
+        last;
+    }
+    close($fh);
+    return $attr_value;
+}
+
+sub make_random_file {
+    my $file_name = $_[0];
+    my $bytes     = $_[1];
+    my $command   = "head --bytes=$bytes /dev/urandom > $file_name";
+    print "$command\n";
+    system($command);
+}
+
+sub run {
+    my $dev_file   = $_[0];
+    my $direction  = $_[1];
+    my $bin_file   = $_[2];
+    my $block_size = $_[3];
+    my @command;
+    if ($direction == 1) {
+        @command = ("dd", "if=$bin_file", "of=$dev_file", "bs=$block_size", "status=none");
+    } else {
+        @command = ("dd", "if=$dev_file", "of=/dev/null", "bs=$block_size", "status=none");
+    }
+    my $start = [gettimeofday];
+    system(@command);
+    return tv_interval($start);
+}
+
+sub test {
+    my $bytes       = $_[0];
+    my $mbytes      = ceil($bytes/(1024*1024));
+    my $block_size  = sprintf("%dM", $mbytes);
+    my $bin_file    = sprintf("test_%dm_in.bin" , $mbytes);
+    my $direction   = get_attribute($stripe_sys_file, "direction"  );
+    my $engine_nums = get_attribute($stripe_sys_file, "engine_nums");
+    my @engines     = split(/\s+/, get_attribute($stripe_sys_file, "engines"));
+    my $single_sys  = File::Spec->join("/","sys","class","pump",$engines[0]);
+    my $single_dev  = File::Spec->join("/","dev",$engines[0]);
+    if (($direction == 1) && ((-s $bin_file) != $bytes)) {
+        make_random_file($bin_file, $bytes);
+    }
+    set_attribute($single_sys     , "limit_size", $bytes);
+    set_attribute($stripe_sys_file, "limit_size", $bytes);
+    my $single_time = run($single_dev     , $direction, $bin_file, $block_size);
+    my $stripe_time = run($stripe_dev_file, $direction, $bin_file, $block_size);
+    printf("%s x1 %dMB = %g[MB/sec]\n", $engines[0], $mbytes, ($bytes/$single_time)/(1000.0*1000.0));
+    printf("pump_stripe%d x%d %dMB = %g[MB/sec]\n", $stripe_num, $engine_nums, $mbytes, ($bytes/$stripe_time)/(1000.0*1000.0));
+}
+
+@mbytes = (1,2,5,10,20,50,100);
+
+if (@ARGV > 0) {
+    @mbytes = @ARGV;
+}
+for ($i = 0; $i<@mbytes; $i++) {
+    test($mbytes[$i]*1024*1024);
+}
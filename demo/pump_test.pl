@@ -51,12 +51,20 @@ sub print_perf {
     my $pump_run_time       = get_attribute($sys_file, "usec_pump_run"      ) / (1000.0*1000.0);
     my $buffer_release_time = get_attribute($sys_file, "usec_buffer_release") / (1000.0*1000.0);
     my $total_time          = $buffer_setup_time+$buffer_release_time+$pump_run_time;
+    my $irq_per_sec         = get_attribute($sys_file, "irq_per_sec"        );
+    my $completions_per_irq = get_attribute($sys_file, "completions_per_irq");
+    my $xfer_bytes          = get_attribute($sys_file, "xfer_bytes"         );
+    my $mb_per_sec          = get_attribute($sys_file, "mb_per_sec"         );
     printf("%s buffer_setup_time   = %g[sec]\n"   , $dev_name, $buffer_setup_time  );
     printf("%s buffer_release_time = %g[sec]\n"   , $dev_name, $buffer_release_time);
     printf("%s pump_run_time       = %g[sec]\n"   , $dev_name, $pump_run_time      );
     printf("%s total_time          = %g[sec]\n"   , $dev_name, $total_time         );
     printf("%s total_perf          = %g[MB/sec]\n", $dev_name, ($bytes/$total_time   )/(1000.0*1000.0));
     printf("%s pump_run_perf       = %g[MB/sec]\n", $dev_name, ($bytes/$pump_run_time)/(1000.0*1000.0));
+    printf("%s irq_per_sec         = %d\n"        , $dev_name, $irq_per_sec        );
+    printf("%s completions_per_irq = %s\n"        , $dev_name, $completions_per_irq);
+    printf("%s xfer_bytes          = %s\n"        , $dev_name, $xfer_bytes         );
+    printf("%s mb_per_sec(1s 10s 60s) = %s\n"     , $dev_name, $mb_per_sec         );
 }
 
 sub test {
@@ -0,0 +1,370 @@
+/*
+ * pump_buf.c
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+#include "pump_buf.h"
+
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/fcntl.h>
+#include <linux/version.h>
+
+/******************************************************************************
+ * Exported DMA Buffer
+ ******************************************************************************
+ * PUMPのデバイスで確保した DMA バッファを dma-buf として他のデバイスやユーザー
+ * 空間に渡す. バッファは dma_alloc_coherent で確保するので、アタッチした各
+ * デバイスへは dma_get_sgtable で作った sg_table をマップして渡す.
+ ******************************************************************************/
+struct pump_buf_export {
+    struct device*  dev;
+    void*           vaddr;
+    dma_addr_t      dma_addr;
+    size_t          size;
+};
+
+static struct sg_table* pump_buf_map_dma_buf(struct dma_buf_attachment* attach, enum dma_data_direction direction)
+{
+    struct pump_buf_export* export = attach->dmabuf->priv;
+    struct sg_table*        sg_table;
+    int                     result;
+
+    sg_table = kzalloc(sizeof(*sg_table), GFP_KERNEL);
+    if (sg_table == NULL)
+        return ERR_PTR(-ENOMEM);
+
+    result = dma_get_sgtable(export->dev, sg_table, export->vaddr, export->dma_addr, export->size);
+    if (result < 0)
+        goto failed;
+
+    sg_table->nents = dma_map_sg(attach->dev, sg_table->sgl, sg_table->orig_nents, direction);
+    if (sg_table->nents == 0) {
+        sg_free_table(sg_table);
+        result = -ENOMEM;
+        goto failed;
+    }
+    return sg_table;
+
+ failed:
+    kfree(sg_table);
+    return ERR_PTR(result);
+}
+
+static void pump_buf_unmap_dma_buf(struct dma_buf_attachment* attach, struct sg_table* sg_table, enum dma_data_direction direction)
+{
+    dma_unmap_sg(attach->dev, sg_table->sgl, sg_table->orig_nents, direction);
+    sg_free_table(sg_table);
+    kfree(sg_table);
+}
+
+static void pump_buf_release_dma_buf(struct dma_buf* dma_buf)
+{
+    struct pump_buf_export* export = dma_buf->priv;
+    dma_free_coherent(export->dev, export->size, export->vaddr, export->dma_addr);
+    put_device(export->dev);
+    kfree(export);
+}
+
+static void* pump_buf_kmap(struct dma_buf* dma_buf, unsigned long page_num)
+{
+    struct pump_buf_export* export = dma_buf->priv;
+    return export->vaddr + page_num * PAGE_SIZE;
+}
+
+static void pump_buf_kunmap(struct dma_buf* dma_buf, unsigned long page_num, void* addr)
+{
+}
+
+static int pump_buf_mmap(struct dma_buf* dma_buf, struct vm_area_struct* vma)
+{
+    struct pump_buf_export* export = dma_buf->priv;
+    return dma_mmap_coherent(export->dev, vma, export->vaddr, export->dma_addr, export->size);
+}
+
+static void* pump_buf_vmap(struct dma_buf* dma_buf)
+{
+    struct pump_buf_export* export = dma_buf->priv;
+    return export->vaddr;
+}
+
+static const struct dma_buf_ops pump_buf_dma_buf_ops = {
+    .map_dma_buf    = pump_buf_map_dma_buf,
+    .unmap_dma_buf  = pump_buf_unmap_dma_buf,
+    .release        = pump_buf_release_dma_buf,
+    .kmap_atomic    = pump_buf_kmap,
+    .kunmap_atomic  = pump_buf_kunmap,
+    .kmap           = pump_buf_kmap,
+    .kunmap         = pump_buf_kunmap,
+    .mmap           = pump_buf_mmap,
+    .vmap           = pump_buf_vmap,
+};
+
+/**
+ * pump_buf_export() - Allocate a DMA buffer and export it as a dma-buf.
+ * @dev:	Device that allocates the buffer.
+ * @size:	Size of the buffer in bytes.
+ * @fd:		Returns the dma-buf file descriptor.
+ * returns:	Success or error status.
+ */
+int  pump_buf_export(struct device* dev, size_t size, int* fd)
+{
+    struct pump_buf_export* export;
+    struct dma_buf*         dma_buf;
+    int                     result;
+
+    if (size == 0)
+        return -EINVAL;
+
+    export = kzalloc(sizeof(*export), GFP_KERNEL);
+    if (export == NULL)
+        return -ENOMEM;
+
+    export->dev   = dev;
+    export->size  = PAGE_ALIGN(size);
+    export->vaddr = dma_alloc_coherent(dev, export->size, &export->dma_addr, GFP_KERNEL);
+    if (IS_ERR_OR_NULL(export->vaddr)) {
+        result = -ENOMEM;
+        goto failed_free;
+    }
+
+#if     (LINUX_VERSION_CODE >= 0x040100)
+    {
+        DEFINE_DMA_BUF_EXPORT_INFO(export_info);
+        export_info.ops   = &pump_buf_dma_buf_ops;
+        export_info.size  = export->size;
+        export_info.flags = O_RDWR;
+        export_info.priv  = export;
+        dma_buf = dma_buf_export(&export_info);
+    }
+#elif   (LINUX_VERSION_CODE >= 0x031100)
+    dma_buf = dma_buf_export(export, &pump_buf_dma_buf_ops, export->size, O_RDWR, NULL);
+#else
+    dma_buf = dma_buf_export(export, &pump_buf_dma_buf_ops, export->size, O_RDWR);
+#endif
+    if (IS_ERR_OR_NULL(dma_buf)) {
+        result = (dma_buf == NULL) ? -ENOMEM : PTR_ERR(dma_buf);
+        goto failed_dma_free;
+    }
+    get_device(dev);
+
+    *fd = dma_buf_fd(dma_buf, O_CLOEXEC);
+    if (*fd < 0) {
+        result = *fd;
+        dma_buf_put(dma_buf);
+        return result;
+    }
+    return 0;
+
+ failed_dma_free:
+    dma_free_coherent(dev, export->size, export->vaddr, export->dma_addr);
+ failed_free:
+    kfree(export);
+    return result;
+}
+
+/******************************************************************************
+ * Imported DMA Buffer
+ ******************************************************************************/
+/**
+ * pump_buf_import() - Attach and map a dma-buf for the device.
+ * @dev:	Device that transfers to/from the buffer.
+ * @fd:		dma-buf file descriptor.
+ * @direction:	DMA direction of the device.
+ * returns:	Registered buffer or ERR_PTR.
+ */
+struct pump_buf* pump_buf_import(struct device* dev, int fd, enum dma_data_direction direction)
+{
+    struct pump_buf* buf;
+    int              result;
+
+    buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+    if (buf == NULL)
+        return ERR_PTR(-ENOMEM);
+
+    INIT_LIST_HEAD(&buf->list);
+    buf->dev       = dev;
+    buf->direction = direction;
+
+    buf->dma_buf = dma_buf_get(fd);
+    if (IS_ERR_OR_NULL(buf->dma_buf)) {
+        result = (buf->dma_buf == NULL) ? -EBADF : PTR_ERR(buf->dma_buf);
+        goto failed_free;
+    }
+    buf->size = buf->dma_buf->size;
+
+    buf->attach = dma_buf_attach(buf->dma_buf, dev);
+    if (IS_ERR_OR_NULL(buf->attach)) {
+        result = (buf->attach == NULL) ? -ENOMEM : PTR_ERR(buf->attach);
+        goto failed_put;
+    }
+
+    buf->sg_table = dma_buf_map_attachment(buf->attach, direction);
+    if (IS_ERR_OR_NULL(buf->sg_table)) {
+        result = (buf->sg_table == NULL) ? -ENOMEM : PTR_ERR(buf->sg_table);
+        goto failed_detach;
+    }
+    return buf;
+
+ failed_detach:
+    dma_buf_detach(buf->dma_buf, buf->attach);
+ failed_put:
+    dma_buf_put(buf->dma_buf);
+ failed_free:
+    kfree(buf);
+    return ERR_PTR(result);
+}
+
+/**
+ * pump_buf_release() - Unmap, detach and put the registered buffer.
+ */
+void pump_buf_release(struct pump_buf* buf)
+{
+    if (IS_ERR_OR_NULL(buf))
+        return;
+    dma_buf_unmap_attachment(buf->attach, buf->sg_table, buf->direction);
+    dma_buf_detach(buf->dma_buf, buf->attach);
+    dma_buf_put(buf->dma_buf);
+    kfree(buf);
+}
+
+/**
+ * pump_buf_clip_sg() - Make a scatterlist that covers a range of the buffer.
+ * @buf:	Registered buffer.
+ * @offset:	Offset of the range in bytes.
+ * @length:	Length of the range in bytes.
+ * @sg_table:	Returns the scatterlist. Only the dma address and the dma
+ *		length of each entry are valid.
+ * returns:	Success or error status.
+ */
+int  pump_buf_clip_sg(struct pump_buf* buf, u64 offset, u64 length, struct sg_table* sg_table)
+{
+    struct scatterlist* src_sg;
+    struct scatterlist* dst_sg;
+    unsigned int        sg_nums = 0;
+    u64                 pos;
+    int                 i;
+
+    if ((length == 0) || (offset >= buf->size) || (length > buf->size - offset))
+        return -EINVAL;
+    /*
+     * count the entries that overlap the range.
+     */
+    pos = 0;
+    for_each_sg(buf->sg_table->sgl, src_sg, buf->sg_table->nents, i) {
+        u64 len = sg_dma_len(src_sg);
+        if ((pos + len > offset) && (pos < offset + length))
+            sg_nums++;
+        pos += len;
+    }
+    if (sg_nums == 0)
+        return -EINVAL;
+
+    sg_table->sgl = kmalloc(sg_nums * sizeof(struct scatterlist), GFP_KERNEL);
+    if (sg_table->sgl == NULL)
+        return -ENOMEM;
+    sg_init_table(sg_table->sgl, sg_nums);
+    sg_table->nents      = sg_nums;
+    sg_table->orig_nents = sg_nums;
+    /*
+     * copy the dma address and length of each overlapping entry.
+     */
+    pos    = 0;
+    dst_sg = sg_table->sgl;
+    for_each_sg(buf->sg_table->sgl, src_sg, buf->sg_table->nents, i) {
+        u64 len   = sg_dma_len(src_sg);
+        u64 start = max(pos, offset);
+        u64 end   = min(pos + len, offset + length);
+        if (start < end) {
+            sg_dma_address(dst_sg) = sg_dma_address(src_sg) + (dma_addr_t)(start - pos);
+            sg_dma_len(dst_sg)     = (unsigned int)(end - start);
+            dst_sg = sg_next(dst_sg);
+        }
+        pos += len;
+    }
+    return 0;
+}
+
+/**
+ * pump_buf_free_clip_sg() - Free the scatterlist made by pump_buf_clip_sg().
+ */
+void pump_buf_free_clip_sg(struct sg_table* sg_table)
+{
+    kfree(sg_table->sgl);
+    sg_table->sgl        = NULL;
+    sg_table->nents      = 0;
+    sg_table->orig_nents = 0;
+}
+
+/**
+ * pump_buf_sync_range() - Sync only [offset, offset+length) of the buffer.
+ *
+ * Walks the mapped entries like pump_buf_clip_sg() does, so a small
+ * transfer out of a large buffer does not maintain the cache of the
+ * whole buffer.
+ */
+static void pump_buf_sync_range(struct pump_buf* buf, u64 offset, u64 length, bool for_device)
+{
+    struct scatterlist* sg;
+    u64                 pos = 0;
+    int                 i;
+
+    for_each_sg(buf->sg_table->sgl, sg, buf->sg_table->nents, i) {
+        u64 len   = sg_dma_len(sg);
+        u64 start = max(pos, offset);
+        u64 end   = min(pos + len, offset + length);
+        if (start < end) {
+            if (for_device)
+                dma_sync_single_range_for_device(buf->dev, sg_dma_address(sg), (unsigned long)(start - pos),
+                                                 (size_t)(end - start), buf->direction);
+            else
+                dma_sync_single_range_for_cpu   (buf->dev, sg_dma_address(sg), (unsigned long)(start - pos),
+                                                 (size_t)(end - start), buf->direction);
+        }
+        pos += len;
+        if (pos >= offset + length)
+            break;
+    }
+}
+
+/**
+ * pump_buf_sync_for_device() - Hand a range of the buffer to the device before a transfer.
+ */
+void pump_buf_sync_for_device(struct pump_buf* buf, u64 offset, u64 length)
+{
+    pump_buf_sync_range(buf, offset, length, 1);
+}
+
+/**
+ * pump_buf_sync_for_cpu() - Hand a range of the buffer back to the CPU after a transfer.
+ */
+void pump_buf_sync_for_cpu(struct pump_buf* buf, u64 offset, u64 length)
+{
+    pump_buf_sync_range(buf, offset, length, 0);
+}
@@ -0,0 +1,65 @@
+/*
+ * pump_buf.h
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+#ifndef _PUMP_BUF_H_
+#define _PUMP_BUF_H_
+
+#include <linux/types.h>
+#include <linux/device.h>
+#include <linux/scatterlist.h>
+#include <linux/list.h>
+#include <linux/dma-mapping.h>
+#include <linux/dma-buf.h>
+
+/**
+ * struct pump_buf - Registered (dma-buf imported) buffer
+ *
+ */
+struct pump_buf {
+    struct list_head            list;
+    u32                         handle;
+    struct device*              dev;
+    struct dma_buf*             dma_buf;
+    struct dma_buf_attachment*  attach;
+    struct sg_table*            sg_table;
+    enum dma_data_direction     direction;
+    size_t                      size;
+    unsigned int                prog_users;
+};
+
+int              pump_buf_export(struct device* dev, size_t size, int* fd);
+struct pump_buf* pump_buf_import(struct device* dev, int fd, enum dma_data_direction direction);
+void             pump_buf_release(struct pump_buf* buf);
+int              pump_buf_clip_sg(struct pump_buf* buf, u64 offset, u64 length, struct sg_table* sg_table);
+void             pump_buf_free_clip_sg(struct sg_table* sg_table);
+void             pump_buf_sync_for_device(struct pump_buf* buf, u64 offset, u64 length);
+void             pump_buf_sync_for_cpu(struct pump_buf* buf, u64 offset, u64 length);
+#endif
@@ -29,18 +29,25 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * 
  */
+#include <linux/capability.h>
 #include <linux/cdev.h>
 #include <linux/clk.h>
 #include <linux/dma-mapping.h>
+#include <linux/eventfd.h>
 #include <linux/fs.h>
+#include <linux/file.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/ioport.h>
 #include <linux/kernel.h>
+#include <linux/kref.h>
+#include <linux/log2.h>
 #include <linux/module.h>
+#include <linux/mmu_notifier.h>
 #include <linux/mutex.h>
 #include <linux/of.h>
+#include <linux/of_platform.h>
 #include <linux/sched.h>
 #include <linux/device.h>
 #include <linux/platform_device.h>
@@ -54,10 +61,22 @@
 #include <linux/list.h>
 #include <linux/spinlock.h>
 #include <linux/version.h>
+#include <linux/workqueue.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/seqlock.h>
+#include <linux/cache.h>
+#include <linux/genalloc.h>
 #include <asm/page.h>
 #include <asm/byteorder.h>
 
 #include "pump_proc.h"
+#include "pump_buf.h"
+#include "pump_ioctl.h"
+#include "pump_evlog.h"
+#include "pump_stat.h"
 
 #define DRIVER_NAME        "pump"
 #define DEVICE_NAME_FORMAT "pump%d"
@@ -68,14 +87,47 @@
 #define PUMP_TIMEOUT_DEF   (10*60*1000)
 #define PUMP_TIMEOUT_MAX   (10*60*1000)
 
+#define PUMP_MIN_MB_PER_SEC_DEF     (1)
+#define PUMP_MIN_MB_PER_SEC_MAX     (100*1000)
+#define PUMP_DEADLINE_MIN_USEC_DEF  (20*1000)
+
+#define PUMP_BATCH_DELAY_USEC_MAX   (100*1000)
+
+#define PUMP_BOUNCE_NUMS            (2)
+#define PUMP_BOUNCE_SIZE            (64*1024)
+#define PUMP_BOUNCE_THRESHOLD_DEF   (16*1024)
+
+#define PUMP_ALIGN_SIZE             (L1_CACHE_BYTES)
+
+#define PUMP_RELEASE_PENDING_MAX    (8)
+
+#define PUMP_TABLE_PARALLEL_MAX     (64*1024)
+
+#define PUMP_PIN_LIMIT_DEF          (64*1024*1024)
+
+#define PUMP_CHAIN_CACHE_DEF        (8)
+#define PUMP_CHAIN_CACHE_MAX        (256)
+
+#define PUMP_BATCH_MSG_MAX          (64)
+#define PUMP_BATCH_THRESHOLD_DEF    (16*1024)
+#define PUMP_BATCH_DELAY_USEC_DEF   (1000)
+#define PUMP_BATCH_HIST_NUMS        (8)
+#define PUMP_BATCH_HIST_BYTES       (256)
+
 #if     (LINUX_VERSION_CODE >= 0x030B00)
 #define USE_DEV_GROUPS      1
 #else
 #define USE_DEV_GROUPS      0
 #endif
 
+#ifdef  CONFIG_MMU_NOTIFIER
+#define USE_CHAIN_CACHE     1
+#else
+#define USE_CHAIN_CACHE     0
+#endif
+
 #if     (PUMP_DEBUG == 1)
-#define PUMP_DEBUG_CHECK(this,debug) (this->debug)
+#define PUMP_DEBUG_CHECK(this,debug) (static_key_false(&pump_debug_key) && (this->debug))
 #else
 #define PUMP_DEBUG_CHECK(this,debug) (0)
 #endif
@@ -95,6 +147,8 @@
 
 static struct class*  pump_sys_class     = NULL;
 static dev_t          pump_device_number = 0;
+static struct dentry* pump_debugfs_root  = NULL;
+static DEFINE_MUTEX(pump_session_lock);
 
 /**
  * struct pump_driver_data - Device driver structure
@@ -107,6 +161,8 @@ struct pump_driver_data {
     struct resource*        core_regs_res;
     struct resource*        proc_regs_res;
     struct resource*        irq_res;
+    struct kref             kref;
+    bool                    removed;
     bool                    is_open;
     int                     direction;
     void __iomem*           core_regs_addr;
@@ -121,17 +177,216 @@ struct pump_driver_data {
     wait_queue_head_t       wait_queue;
     unsigned long           limit_size;
     unsigned long           timeout_msec;
+    unsigned long           min_mb_per_sec;
+    unsigned long           deadline_min_usec;
+    struct hrtimer          deadline_timer;
+    bool                    deadline_expired;
+    struct list_head*       xfer_list;
+    unsigned long           timeout_count;
+    unsigned long           bounce_threshold;
+    bool                    align_bounce;
+    struct pump_proc_bounce* align_buf;
+    char __user*            align_buff;
+    size_t                  align_size;
+    size_t                  align_head;
+    size_t                  align_tail;
+    unsigned long           align_xfer_count;
+    unsigned long           align_bounce_bytes;
+    bool                    release_async;
+    spinlock_t              release_lock;
+    struct list_head        release_list;
+    struct work_struct      release_work;
+    atomic_t                release_pending;
+    unsigned long           release_deferred_count;
+    bool                    stop_failed;
+    struct list_head        quarantine_list;
+    struct list_head        quarantine_bounce_list;
+    unsigned long           pin_limit;
+    bool                    pin_rlimit;
+    atomic_long_t           pinned_pages;
+    unsigned long           pinned_peak;
+    atomic_long_t           desc_bytes;
+    unsigned long           desc_peak;
+    unsigned long           pin_window_count;
+    unsigned long           pin_pages;
+    unsigned long           pin_desc_bytes;
+    struct mm_struct*       pin_mm;
+    unsigned long           pin_mm_pages;
+    bool                    bypass_enable;
+    struct file*            bypass_file;
+    spinlock_t              bypass_lock;
+    struct eventfd_ctx*     bypass_eventfd;
+    void*                   bypass_desc_ptr;
+    dma_addr_t              bypass_desc_addr;
+    size_t                  bypass_desc_size;
+    unsigned long           bypass_irq_count;
+    unsigned int            chain_cache_max;
+    spinlock_t              chain_lock;
+    struct list_head        chain_list;
+    struct list_head        chain_mm_list;
+    struct work_struct      chain_work;
+    unsigned int            chain_nums;
+    unsigned long           chain_bytes;
+    unsigned long           chain_hit_count;
+    unsigned long           chain_miss_count;
+    struct pump_chain_entry* chain_entry;
+    struct pump_chain_entry* chain_new;
+    bool                    batch_enable;
+    unsigned long           batch_threshold;
+    unsigned long           batch_delay_usec;
+    struct pump_proc_bounce* batch_buf;
+    size_t                  batch_size;
+    unsigned int            batch_msg_nums;
+    u32                     batch_msg_size[PUMP_BATCH_MSG_MAX];
+    struct scatterlist      batch_sg[PUMP_BATCH_MSG_MAX];
+    bool                    batch_first;
+    bool                    batch_last;
+    struct pump_file_data*  batch_file;
+    struct hrtimer          batch_timer;
+    struct work_struct      batch_work;
+    unsigned long           batch_msg_count;
+    unsigned long           batch_flush_size_count;
+    unsigned long           batch_flush_timer_count;
+    unsigned long           batch_flush_sync_count;
+    unsigned long           batch_msg_hist[PUMP_BATCH_HIST_NUMS];
+    unsigned long           batch_byte_hist[PUMP_BATCH_HIST_NUMS];
     unsigned long           usec_buffer_setup;
     unsigned long           usec_buffer_release;
     unsigned long           usec_pump_run;
+    unsigned long           usec_table_build;
+    seqcount_t              usec_seq;
+    u64                     xfer_start_time;
+    struct workqueue_struct* complete_wq;
+    bool                    complete_highpri;
+    int                     irq_affinity_cpu;
+    struct pump_evlog       evlog;
+    struct pump_evlog_entry event;
+    ktime_t                 event_mark;
+    struct pump_stat        stat;
 #if (PUMP_DEBUG == 1)
     bool                    debug_phase;
     bool                    debug_op_table;
     bool                    debug_sg_table;
     bool                    debug_interrupt;
+    bool                    debug_key_held;
 #endif   
 };
 
+/**
+ * struct pump_file_data - Per open file structure
+ */
+struct pump_file_data {
+    struct pump_driver_data* driver_data;
+    struct mutex            buf_lock;
+    struct list_head        buf_list;
+    u32                     buf_handle;
+    struct list_head        prog_list;
+    u32                     prog_handle;
+    struct file*            session_file;
+    int                     batch_error;
+};
+
+static inline struct pump_driver_data* pump_file_driver_data(struct file* file)
+{
+    return ((struct pump_file_data*)file->private_data)->driver_data;
+}
+
+/**
+ * struct pump_prog - Operation codes compiled from a user program
+ *
+ * @buf lists each registered buffer the program uses once.
+ */
+struct pump_prog {
+    struct list_head        list;
+    u32                     handle;
+    struct list_head        table_list;
+    size_t                  xfer_size;
+    unsigned int            buf_nums;
+    struct pump_buf*        buf[0];
+};
+
+/**
+ * pump_find_prog() - Look up a program of the file.
+ */
+static struct pump_prog* pump_find_prog(struct pump_file_data* file_data, u32 handle)
+{
+    struct pump_prog* prog;
+    list_for_each_entry(prog, &file_data->prog_list, list) {
+        if (prog->handle == handle)
+            return prog;
+    }
+    return NULL;
+}
+
+/**
+ * pump_prog_free() - Free the operation codes and let go of the buffers.
+ *
+ * Called with file_data->buf_lock held, or when the file is released.
+ */
+static void pump_clear_buf_list(struct pump_driver_data* this, struct list_head* buf_list);
+static void pump_prog_free(struct pump_driver_data* this, struct pump_prog* prog)
+{
+    unsigned int i;
+    pump_clear_buf_list(this, &prog->table_list);
+    for (i = 0; i < prog->buf_nums; i++)
+        prog->buf[i]->prog_users--;
+    kfree(prog);
+}
+
+/**
+ * struct pump_chain_mm - Address space that has entries in the chain cache
+ *
+ * The mmu notifier holds a reference to @mm (mm_count) until it is
+ * unregistered with the last entry.
+ */
+struct pump_chain_mm {
+    struct list_head         list;
+    struct pump_driver_data* driver_data;
+    struct mm_struct*        mm;
+    struct mmu_notifier      notifier;
+    unsigned int             entry_nums;
+};
+
+/**
+ * struct pump_chain_entry - Pinned pages, sg_table and operation codes of
+ *                           one read()/write() buffer kept for the next call
+ *
+ * Keyed by (@chain_mm, @addr, @size, @xfer_first, @xfer_last); the
+ * direction is that of the device.  @stale is set by the mmu notifier when
+ * the mapping changes and the entry is never used again.
+ */
+struct pump_chain_entry {
+    struct list_head         list;
+    struct pump_chain_mm*    chain_mm;
+    unsigned long            addr;
+    size_t                   size;
+    bool                     xfer_first;
+    bool                     xfer_last;
+    bool                     in_use;
+    bool                     stale;
+    struct list_head         table_list;
+    struct sg_table          sg_table;
+    unsigned int             sg_nums;
+    struct page**            page_list;
+    unsigned int             page_nums;
+    unsigned long            pin_pages;
+    unsigned long            desc_bytes;
+};
+
+/**
+ * pump_usec_add() - Add the time since @start_time to one of the usec_* counters.
+ *
+ * The writers are serialized by this->sem; the seqcount lets the readers
+ * take a consistent snapshot without it.
+ */
+static inline void pump_usec_add(struct pump_driver_data* this, unsigned long* usec, u64 start_time)
+{
+    unsigned long value = jiffies_to_usecs((unsigned long)(get_jiffies_64() - start_time));
+    write_seqcount_begin(&this->usec_seq);
+    *usec += value;
+    write_seqcount_end(&this->usec_seq);
+}
+
 #define DEF_ATTR_SHOW(__attr_name, __format, __value) \
 static ssize_t pump_show_ ## __attr_name(struct device *dev, struct device_attribute *attr, char *buf) \
 { \
@@ -144,6 +399,16 @@ static ssize_t pump_show_ ## __attr_name(struct device *dev, struct device_attri
     return status; \
 }
 
+/**
+ * 統計は転送中でも読めるように this->sem を取らずに表示する.
+ */
+#define DEF_ATTR_SHOW_NOLOCK(__attr_name, __format, __value) \
+static ssize_t pump_show_ ## __attr_name(struct device *dev, struct device_attribute *attr, char *buf) \
+{ \
+    struct pump_driver_data* this = dev_get_drvdata(dev); \
+    return sprintf(buf, __format, (__value)); \
+}
+
 #define DEF_ATTR_SET(__attr_name, __min, __max, __pre_action, __post_action) \
 static ssize_t pump_set_ ## __attr_name(struct device *dev, struct device_attribute *attr, const char *buf, size_t size) \
 { \
@@ -162,25 +427,304 @@ static ssize_t pump_set_ ## __attr_name(struct device *dev, struct device_attrib
     return status;                                                           \
 }
 
+#define DEF_PROC_ATTR_SET(__attr_name, __min, __max) \
+static ssize_t pump_set_ ## __attr_name(struct device *dev, struct device_attribute *attr, const char *buf, size_t size) \
+{ \
+    ssize_t       status; \
+    unsigned long value;  \
+    struct pump_driver_data* this = dev_get_drvdata(dev);              \
+    if (0 != mutex_lock_interruptible(&this->sem)){return -ERESTARTSYS;}     \
+    if (0 != (status = kstrtoul(buf, 10, &value))) {           goto failed;} \
+    if ((value < __min) || (__max < value)) {status = -EINVAL; goto failed;} \
+    this->pump_proc_data.__attr_name = value;                                \
+    status = size;                                                           \
+  failed:                                                                    \
+    mutex_unlock(&this->sem);                                                \
+    return status;                                                           \
+}
+
 DEF_ATTR_SHOW(direction           , "%d\n" , this->direction);
 DEF_ATTR_SHOW(dma_direction       , "%s\n" , (this->direction) ? "DMA_TO_DEVICE" : "DMA_FROM_DEVICE");
 DEF_ATTR_SHOW(limit_size          , "%lu\n", this->limit_size);
 DEF_ATTR_SHOW(timeout_msec        , "%lu\n", this->timeout_msec);
-DEF_ATTR_SHOW(usec_buffer_setup   , "%lu\n", this->usec_buffer_setup);
-DEF_ATTR_SHOW(usec_buffer_release , "%lu\n", this->usec_buffer_release);
-DEF_ATTR_SHOW(usec_pump_run       , "%lu\n", this->usec_pump_run);
+DEF_ATTR_SHOW_NOLOCK(usec_buffer_setup   , "%lu\n", ACCESS_ONCE(this->usec_buffer_setup  ));
+DEF_ATTR_SHOW_NOLOCK(usec_buffer_release , "%lu\n", ACCESS_ONCE(this->usec_buffer_release));
+DEF_ATTR_SHOW_NOLOCK(usec_pump_run       , "%lu\n", ACCESS_ONCE(this->usec_pump_run      ));
 DEF_ATTR_SET( limit_size          , 0, 0xFFFFFFFF      , 0, 0);
 DEF_ATTR_SET( timeout_msec        , 0, PUMP_TIMEOUT_MAX, 0, 0);
+DEF_ATTR_SHOW(bounce_threshold    , "%lu\n", this->bounce_threshold);
+DEF_ATTR_SET( bounce_threshold    , 0, PUMP_BOUNCE_SIZE, 0, 0);
+DEF_ATTR_SHOW(align_bounce        , "%d\n" , this->align_bounce);
+DEF_ATTR_SET( align_bounce        , 0, 1, 0, 0);
+DEF_ATTR_SHOW_NOLOCK(align_xfer_count   , "%lu\n", ACCESS_ONCE(this->align_xfer_count  ));
+DEF_ATTR_SHOW_NOLOCK(align_bounce_bytes , "%lu\n", ACCESS_ONCE(this->align_bounce_bytes));
+DEF_ATTR_SHOW(release_async       , "%d\n" , this->release_async);
+DEF_ATTR_SET( release_async       , 0, 1, 0, 0);
+DEF_ATTR_SHOW_NOLOCK(release_pending    , "%d\n" , atomic_read(&this->release_pending));
+DEF_ATTR_SHOW_NOLOCK(release_deferred_count, "%lu\n", ACCESS_ONCE(this->release_deferred_count));
+DEF_ATTR_SHOW(min_mb_per_sec      , "%lu\n", this->min_mb_per_sec);
+DEF_ATTR_SET( min_mb_per_sec      , 0, PUMP_MIN_MB_PER_SEC_MAX, 0, 0);
+DEF_ATTR_SHOW(deadline_min_usec   , "%lu\n", this->deadline_min_usec);
+DEF_ATTR_SET( deadline_min_usec   , 0, PUMP_TIMEOUT_MAX*1000UL, 0, 0);
+DEF_ATTR_SHOW_NOLOCK(timeout_count      , "%lu\n", ACCESS_ONCE(this->timeout_count));
+DEF_ATTR_SHOW_NOLOCK(usec_table_build   , "%lu\n", ACCESS_ONCE(this->usec_table_build));
+DEF_ATTR_SHOW(pin_limit           , "%lu\n", this->pin_limit);
+DEF_ATTR_SET( pin_limit           , 0, ULONG_MAX, 0, 0);
+DEF_ATTR_SHOW(pin_rlimit          , "%d\n" , this->pin_rlimit);
+DEF_ATTR_SET( pin_rlimit          , 0, 1, 0, 0);
+DEF_ATTR_SHOW_NOLOCK(pinned_bytes       , "%lu\n", atomic_long_read(&this->pinned_pages) << PAGE_SHIFT);
+DEF_ATTR_SHOW_NOLOCK(pinned_peak        , "%lu\n", ACCESS_ONCE(this->pinned_peak) << PAGE_SHIFT);
+DEF_ATTR_SHOW_NOLOCK(desc_bytes         , "%lu\n", atomic_long_read(&this->desc_bytes));
+DEF_ATTR_SHOW_NOLOCK(desc_peak          , "%lu\n", ACCESS_ONCE(this->desc_peak));
+DEF_ATTR_SHOW_NOLOCK(pin_window_count   , "%lu\n", ACCESS_ONCE(this->pin_window_count));
+DEF_ATTR_SHOW(bypass_enable       , "%d\n" , this->bypass_enable);
+DEF_ATTR_SET( bypass_enable       , 0, 1, 0, 0);
+DEF_ATTR_SHOW(bypass_active       , "%d\n" , (this->bypass_file != NULL));
+DEF_ATTR_SHOW_NOLOCK(bypass_irq_count   , "%lu\n", ACCESS_ONCE(this->bypass_irq_count));
+
+/**
+ * chain_cache_max : チェインキャッシュに残すエントリの数. 0 で使わない.
+ */
+static void pump_chain_shrink(struct pump_driver_data* this, bool all);
+static int  pump_update_chain_cache(struct pump_driver_data* this)
+{
+    pump_chain_shrink(this, 0);
+    return 0;
+}
+DEF_ATTR_SHOW(chain_cache_max     , "%u\n" , this->chain_cache_max);
+DEF_ATTR_SET( chain_cache_max     , 0, PUMP_CHAIN_CACHE_MAX, 0, pump_update_chain_cache(this));
+DEF_ATTR_SHOW(chain_cache_nums    , "%u\n" , this->chain_nums);
+DEF_ATTR_SHOW(chain_cache_bytes   , "%lu\n", this->chain_bytes);
+DEF_ATTR_SHOW_NOLOCK(chain_hit_count    , "%lu\n", ACCESS_ONCE(this->chain_hit_count));
+DEF_ATTR_SHOW_NOLOCK(chain_miss_count   , "%lu\n", ACCESS_ONCE(this->chain_miss_count));
+
+/**
+ * chain_hit_rate : チェインキャッシュのヒット率(%).
+ */
+static ssize_t pump_show_chain_hit_rate(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pump_driver_data* this   = dev_get_drvdata(dev);
+    unsigned long            hits   = ACCESS_ONCE(this->chain_hit_count);
+    unsigned long            misses = ACCESS_ONCE(this->chain_miss_count);
+    unsigned long            total  = hits + misses;
+    return sprintf(buf, "%lu\n", (total > 0) ? (hits * 100) / total : 0);
+}
+
+/**
+ * batch_enable : 小さな書き込みをまとめて転送する. 0 にすると溜まっている分を
+ *                転送する.
+ */
+static void pump_batch_flush(struct pump_driver_data* this, unsigned long* flush_count);
+static int  pump_update_batch(struct pump_driver_data* this)
+{
+    if (!this->batch_enable)
+        pump_batch_flush(this, &this->batch_flush_sync_count);
+    return 0;
+}
+DEF_ATTR_SHOW(batch_enable        , "%d\n" , this->batch_enable);
+DEF_ATTR_SET( batch_enable        , 0, 1, 0, pump_update_batch(this));
+DEF_ATTR_SHOW(batch_threshold     , "%lu\n", this->batch_threshold);
+DEF_ATTR_SET( batch_threshold     , 1, PUMP_BOUNCE_SIZE, 0, 0);
+DEF_ATTR_SHOW(batch_delay_usec    , "%lu\n", this->batch_delay_usec);
+DEF_ATTR_SET( batch_delay_usec    , 0, PUMP_BATCH_DELAY_USEC_MAX , 0, 0);
+DEF_ATTR_SHOW_NOLOCK(batch_msg_count         , "%lu\n", ACCESS_ONCE(this->batch_msg_count));
+DEF_ATTR_SHOW_NOLOCK(batch_flush_size_count  , "%lu\n", ACCESS_ONCE(this->batch_flush_size_count));
+DEF_ATTR_SHOW_NOLOCK(batch_flush_timer_count , "%lu\n", ACCESS_ONCE(this->batch_flush_timer_count));
+DEF_ATTR_SHOW_NOLOCK(batch_flush_sync_count  , "%lu\n", ACCESS_ONCE(this->batch_flush_sync_count));
+
+/**
+ * batch_msg_hist  : 一度に転送したメッセージ数の分布. 各行は区間の下限と回数.
+ * batch_byte_hist : 一度に転送したバイト数の分布. 各行は区間の下限と回数.
+ */
+static ssize_t pump_show_batch_msg_hist(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    ssize_t status = 0;
+    int     i;
+    struct pump_driver_data* this = dev_get_drvdata(dev);
+    for (i = 0; i < PUMP_BATCH_HIST_NUMS; i++) {
+        status += sprintf(buf + status, "%lu %lu\n", 1UL << i, ACCESS_ONCE(this->batch_msg_hist[i]));
+    }
+    return status;
+}
+
+static ssize_t pump_show_batch_byte_hist(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    ssize_t status = 0;
+    int     i;
+    struct pump_driver_data* this = dev_get_drvdata(dev);
+    for (i = 0; i < PUMP_BATCH_HIST_NUMS; i++) {
+        status += sprintf(buf + status, "%lu %lu\n", (i == 0) ? 0 : PUMP_BATCH_HIST_BYTES << (i - 1), ACCESS_ONCE(this->batch_byte_hist[i]));
+    }
+    return status;
+}
+
+static unsigned long pump_get_irq_per_sec(struct pump_driver_data* this)
+{
+    unsigned long irq_per_sec;
+    pump_proc_irq_rate(&this->pump_proc_data, &irq_per_sec, NULL);
+    return irq_per_sec;
+}
+
+DEF_ATTR_SHOW_NOLOCK(irq_count      , "%lu\n", ACCESS_ONCE(this->pump_proc_data.irq_count     ));
+DEF_ATTR_SHOW_NOLOCK(irq_per_sec    , "%lu\n", pump_get_irq_per_sec(this));
+DEF_ATTR_SHOW_NOLOCK(complete_count , "%lu\n", ACCESS_ONCE(this->pump_proc_data.complete_count));
+DEF_ATTR_SHOW_NOLOCK(irq_none_count , "%lu\n", pump_proc_irq_none_count(&this->pump_proc_data));
+DEF_ATTR_SHOW(table_cached        , "%d\n" , this->pump_proc_data.table_cached     );
+DEF_PROC_ATTR_SET(table_cached      , 0, 1);
+DEF_ATTR_SHOW(table_ocm           , "%d\n" , this->pump_proc_data.table_ocm        );
+DEF_PROC_ATTR_SET(table_ocm         , 0, 1);
+DEF_ATTR_SHOW_NOLOCK(ocm_table_count    , "%lu\n", ACCESS_ONCE(this->pump_proc_data.ocm_table_count   ));
+DEF_ATTR_SHOW_NOLOCK(ocm_fallback_count , "%lu\n", ACCESS_ONCE(this->pump_proc_data.ocm_fallback_count));
+DEF_ATTR_SHOW(table_parallel      , "%u\n" , this->pump_proc_data.table_parallel   );
+DEF_PROC_ATTR_SET(table_parallel    , 0, PUMP_TABLE_PARALLEL_MAX);
+
+/**
+ * ocm_pool_usage : オンチップメモリのプールの使用中バイト数と全体のバイト数.
+ */
+static ssize_t pump_show_ocm_pool_usage(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pump_driver_data* this = dev_get_drvdata(dev);
+    struct gen_pool*         pool = this->pump_proc_data.ocm_pool;
+    size_t                   size = (pool != NULL) ? gen_pool_size(pool) : 0;
+    size_t                   used = (pool != NULL) ? size - gen_pool_avail(pool) : 0;
+    return sprintf(buf, "%zu %zu\n", used, size);
+}
+
+/**
+ * complete_highpri : 1=終了処理をデバイス専用の高優先度ワークキューで実行する.
+ */
+static int  pump_update_complete_wq(struct pump_driver_data* this)
+{
+    this->pump_proc_data.done_wq = (this->complete_highpri) ? this->complete_wq : NULL;
+    return 0;
+}
+
+DEF_ATTR_SHOW(irq_affinity_cpu    , "%d\n" , this->irq_affinity_cpu           );
+DEF_ATTR_SHOW(complete_cpu        , "%d\n" , this->pump_proc_data.done_cpu    );
+DEF_ATTR_SHOW(complete_highpri    , "%d\n" , this->complete_highpri           );
+DEF_ATTR_SET( complete_highpri    , 0, 1, 0, pump_update_complete_wq(this));
+
+/**
+ * irq_affinity_cpu : 割り込みのアフィニティヒント(-1=指定無し).
+ * 割り込み線を共有している他のPUMPにも影響する. ヒントは割り込み線を使う
+ * 最後のPUMPが外れる時に pump_proc_free_irq() が消す.
+ */
+static ssize_t pump_set_irq_affinity_cpu(struct device *dev, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t status;
+    int     value;
+    struct pump_driver_data* this = dev_get_drvdata(dev);
+    if (0 != mutex_lock_interruptible(&this->sem)){return -ERESTARTSYS;}
+    if (0 != (status = kstrtoint(buf, 10, &value))) {                     goto failed;}
+    if ((value < -1) || (value >= (int)nr_cpu_ids)) {status = -EINVAL;    goto failed;}
+    if ((value >= 0) && !cpu_online(value))         {status = -EINVAL;    goto failed;}
+    status = irq_set_affinity_hint(this->irq, (value >= 0) ? cpumask_of(value) : NULL);
+    if (status != 0)
+        goto failed;
+    this->irq_affinity_cpu = value;
+    status = size;
+  failed:
+    mutex_unlock(&this->sem);
+    return status;
+}
+
+/**
+ * complete_cpu : 終了処理を実行するCPU(-1=指定無し, -2=転送を開始したCPU).
+ */
+static ssize_t pump_set_complete_cpu(struct device *dev, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t status;
+    int     value;
+    struct pump_driver_data* this = dev_get_drvdata(dev);
+    if (0 != mutex_lock_interruptible(&this->sem)){return -ERESTARTSYS;}
+    if (0 != (status = kstrtoint(buf, 10, &value))) {                     goto failed;}
+    if ((value < PUMP_PROC_DONE_CPU_SUBMIT) || (value >= (int)nr_cpu_ids)) {status = -EINVAL; goto failed;}
+    if ((value >= 0) && !cpu_online(value))         {status = -EINVAL;    goto failed;}
+    this->pump_proc_data.done_cpu = value;
+    status = size;
+  failed:
+    mutex_unlock(&this->sem);
+    return status;
+}
+
+static ssize_t pump_show_complete_count_per_cpu(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    ssize_t status = 0;
+    int     cpu;
+    struct pump_driver_data* this = dev_get_drvdata(dev);
+    for_each_possible_cpu(cpu) {
+        status += sprintf(buf + status, "cpu%d %lu\n", cpu, pump_proc_complete_cpu_count(&this->pump_proc_data, cpu));
+    }
+    return status;
+}
+
+/**
+ * completions_per_irq は 1/100 単位の固定小数点で表示する.
+ */
+static ssize_t pump_show_completions_per_irq(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    unsigned long ratio;
+    unsigned long irq_count;
+    unsigned long complete_count;
+    unsigned long irq_flags;
+    struct pump_driver_data* this = dev_get_drvdata(dev);
+    spin_lock_irqsave(&this->pump_proc_data.irq_lock, irq_flags);
+    irq_count      = this->pump_proc_data.irq_count;
+    complete_count = this->pump_proc_data.complete_count;
+    spin_unlock_irqrestore(&this->pump_proc_data.irq_lock, irq_flags);
+    if (irq_count == 0)
+        ratio = 0;
+    else
+        ratio = (complete_count * 100) / irq_count;
+    return sprintf(buf, "%lu.%02lu\n", ratio / 100, ratio % 100);
+}
+
+DEF_ATTR_SHOW_NOLOCK(xfer_bytes     , "%llu\n", (unsigned long long)pump_stat_xfer_bytes (&this->stat));
+DEF_ATTR_SHOW_NOLOCK(xfer_count     , "%llu\n", (unsigned long long)pump_stat_xfer_count (&this->stat));
+DEF_ATTR_SHOW_NOLOCK(xfer_errors    , "%llu\n", (unsigned long long)pump_stat_xfer_errors(&this->stat));
+
+static ssize_t pump_show_mb_per_sec(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pump_driver_data* this = dev_get_drvdata(dev);
+    return pump_stat_show_mb_per_sec(&this->stat, buf);
+}
+
+static ssize_t pump_show_ops_per_sec(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pump_driver_data* this = dev_get_drvdata(dev);
+    return pump_stat_show_ops_per_sec(&this->stat, buf);
+}
 
 #if (PUMP_DEBUG == 1)
+/**
+ * pump_update_debug() - Follow the debug_* attributes.
+ *
+ * Copies them to pump_proc_data.debug and holds one reference on
+ * pump_debug_key while any of them is set.
+ */
+static int  pump_update_debug(struct pump_driver_data* this)
+{
+    bool debug = (this->debug_phase    || this->debug_op_table ||
+                  this->debug_sg_table || this->debug_interrupt);
+
+    this->pump_proc_data.debug = ((this->debug_phase    ) ? PUMP_PROC_DEBUG_PHASE : 0) |
+                                 ((this->debug_interrupt) ? PUMP_PROC_DEBUG_IRQ   : 0);
+    if (debug && !this->debug_key_held)
+        static_key_slow_inc(&pump_debug_key);
+    if (!debug && this->debug_key_held)
+        static_key_slow_dec(&pump_debug_key);
+    this->debug_key_held = debug;
+    return 0;
+}
+
 DEF_ATTR_SHOW(debug_phase         , "%d\n", this->debug_phase    );
 DEF_ATTR_SHOW(debug_op_table      , "%d\n", this->debug_op_table );
 DEF_ATTR_SHOW(debug_sg_table      , "%d\n", this->debug_sg_table );
 DEF_ATTR_SHOW(debug_interrupt     , "%d\n", this->debug_interrupt);
-DEF_ATTR_SET( debug_phase         , 0, 1, 0, 0);
-DEF_ATTR_SET( debug_op_table      , 0, 1, 0, 0);
-DEF_ATTR_SET( debug_sg_table      , 0, 1, 0, 0);
-DEF_ATTR_SET( debug_interrupt     , 0, 1, 0, 0);
+DEF_ATTR_SET( debug_phase         , 0, 1, 0, pump_update_debug(this));
+DEF_ATTR_SET( debug_op_table      , 0, 1, 0, pump_update_debug(this));
+DEF_ATTR_SET( debug_sg_table      , 0, 1, 0, pump_update_debug(this));
+DEF_ATTR_SET( debug_interrupt     , 0, 1, 0, pump_update_debug(this));
 #endif
 
 static struct device_attribute pump_device_attrs[] = {
@@ -191,6 +735,62 @@ static struct device_attribute pump_device_attrs[] = {
   __ATTR(usec_buffer_setup   , 0644, pump_show_usec_buffer_setup   , NULL),
   __ATTR(usec_buffer_release , 0644, pump_show_usec_buffer_release , NULL),
   __ATTR(usec_pump_run       , 0644, pump_show_usec_pump_run       , NULL),
+  __ATTR(irq_count           , 0644, pump_show_irq_count           , NULL),
+  __ATTR(irq_per_sec         , 0644, pump_show_irq_per_sec         , NULL),
+  __ATTR(complete_count      , 0644, pump_show_complete_count      , NULL),
+  __ATTR(completions_per_irq , 0644, pump_show_completions_per_irq , NULL),
+  __ATTR(irq_none_count      , 0644, pump_show_irq_none_count      , NULL),
+  __ATTR(irq_affinity_cpu    , 0644, pump_show_irq_affinity_cpu    , pump_set_irq_affinity_cpu ),
+  __ATTR(complete_cpu        , 0644, pump_show_complete_cpu        , pump_set_complete_cpu     ),
+  __ATTR(complete_highpri    , 0644, pump_show_complete_highpri    , pump_set_complete_highpri ),
+  __ATTR(complete_count_per_cpu, 0644, pump_show_complete_count_per_cpu, NULL),
+  __ATTR(xfer_bytes          , 0644, pump_show_xfer_bytes          , NULL),
+  __ATTR(xfer_count          , 0644, pump_show_xfer_count          , NULL),
+  __ATTR(xfer_errors         , 0644, pump_show_xfer_errors         , NULL),
+  __ATTR(mb_per_sec          , 0644, pump_show_mb_per_sec          , NULL),
+  __ATTR(ops_per_sec         , 0644, pump_show_ops_per_sec         , NULL),
+  __ATTR(bounce_threshold    , 0644, pump_show_bounce_threshold    , pump_set_bounce_threshold ),
+  __ATTR(align_bounce        , 0644, pump_show_align_bounce        , pump_set_align_bounce     ),
+  __ATTR(align_xfer_count    , 0644, pump_show_align_xfer_count    , NULL),
+  __ATTR(align_bounce_bytes  , 0644, pump_show_align_bounce_bytes  , NULL),
+  __ATTR(release_async       , 0644, pump_show_release_async       , pump_set_release_async    ),
+  __ATTR(release_pending     , 0644, pump_show_release_pending     , NULL),
+  __ATTR(release_deferred_count, 0644, pump_show_release_deferred_count, NULL),
+  __ATTR(min_mb_per_sec      , 0644, pump_show_min_mb_per_sec      , pump_set_min_mb_per_sec   ),
+  __ATTR(deadline_min_usec   , 0644, pump_show_deadline_min_usec   , pump_set_deadline_min_usec),
+  __ATTR(timeout_count       , 0644, pump_show_timeout_count       , NULL),
+  __ATTR(table_cached        , 0644, pump_show_table_cached        , pump_set_table_cached     ),
+  __ATTR(usec_table_build    , 0644, pump_show_usec_table_build    , NULL),
+  __ATTR(table_ocm           , 0644, pump_show_table_ocm           , pump_set_table_ocm        ),
+  __ATTR(ocm_table_count     , 0644, pump_show_ocm_table_count     , NULL),
+  __ATTR(ocm_fallback_count  , 0644, pump_show_ocm_fallback_count  , NULL),
+  __ATTR(ocm_pool_usage      , 0644, pump_show_ocm_pool_usage      , NULL),
+  __ATTR(table_parallel      , 0644, pump_show_table_parallel      , pump_set_table_parallel   ),
+  __ATTR(pin_limit           , 0644, pump_show_pin_limit           , pump_set_pin_limit        ),
+  __ATTR(pin_rlimit          , 0644, pump_show_pin_rlimit          , pump_set_pin_rlimit       ),
+  __ATTR(pinned_bytes        , 0644, pump_show_pinned_bytes        , NULL),
+  __ATTR(pinned_peak         , 0644, pump_show_pinned_peak         , NULL),
+  __ATTR(desc_bytes          , 0644, pump_show_desc_bytes          , NULL),
+  __ATTR(desc_peak           , 0644, pump_show_desc_peak           , NULL),
+  __ATTR(pin_window_count    , 0644, pump_show_pin_window_count    , NULL),
+  __ATTR(bypass_enable       , 0644, pump_show_bypass_enable       , pump_set_bypass_enable    ),
+  __ATTR(bypass_active       , 0644, pump_show_bypass_active       , NULL),
+  __ATTR(bypass_irq_count    , 0644, pump_show_bypass_irq_count    , NULL),
+  __ATTR(chain_cache_max     , 0644, pump_show_chain_cache_max     , pump_set_chain_cache_max  ),
+  __ATTR(chain_cache_nums    , 0644, pump_show_chain_cache_nums    , NULL),
+  __ATTR(chain_cache_bytes   , 0644, pump_show_chain_cache_bytes   , NULL),
+  __ATTR(chain_hit_count     , 0644, pump_show_chain_hit_count     , NULL),
+  __ATTR(chain_miss_count    , 0644, pump_show_chain_miss_count    , NULL),
+  __ATTR(chain_hit_rate      , 0644, pump_show_chain_hit_rate      , NULL),
+  __ATTR(batch_enable        , 0644, pump_show_batch_enable        , pump_set_batch_enable     ),
+  __ATTR(batch_threshold     , 0644, pump_show_batch_threshold     , pump_set_batch_threshold  ),
+  __ATTR(batch_delay_usec    , 0644, pump_show_batch_delay_usec    , pump_set_batch_delay_usec ),
+  __ATTR(batch_msg_count     , 0644, pump_show_batch_msg_count     , NULL),
+  __ATTR(batch_flush_size_count , 0644, pump_show_batch_flush_size_count , NULL),
+  __ATTR(batch_flush_timer_count, 0644, pump_show_batch_flush_timer_count, NULL),
+  __ATTR(batch_flush_sync_count , 0644, pump_show_batch_flush_sync_count , NULL),
+  __ATTR(batch_msg_hist      , 0644, pump_show_batch_msg_hist      , NULL),
+  __ATTR(batch_byte_hist     , 0644, pump_show_batch_byte_hist     , NULL),
 #if (PUMP_DEBUG == 1)
   __ATTR(debug_phase         , 0644, pump_show_debug_phase         , pump_set_debug_phase    ),
   __ATTR(debug_sg_table      , 0644, pump_show_debug_sg_table      , pump_set_debug_sg_table ),
@@ -210,11 +810,67 @@ static struct attribute *pump_attrs[] = {
   &(pump_device_attrs[ 4].attr),
   &(pump_device_attrs[ 5].attr),
   &(pump_device_attrs[ 6].attr),
-#if (PUMP_DEBUG == 1)
   &(pump_device_attrs[ 7].attr),
   &(pump_device_attrs[ 8].attr),
   &(pump_device_attrs[ 9].attr),
   &(pump_device_attrs[10].attr),
+  &(pump_device_attrs[11].attr),
+  &(pump_device_attrs[12].attr),
+  &(pump_device_attrs[13].attr),
+  &(pump_device_attrs[14].attr),
+  &(pump_device_attrs[15].attr),
+  &(pump_device_attrs[16].attr),
+  &(pump_device_attrs[17].attr),
+  &(pump_device_attrs[18].attr),
+  &(pump_device_attrs[19].attr),
+  &(pump_device_attrs[20].attr),
+  &(pump_device_attrs[21].attr),
+  &(pump_device_attrs[22].attr),
+  &(pump_device_attrs[23].attr),
+  &(pump_device_attrs[24].attr),
+  &(pump_device_attrs[25].attr),
+  &(pump_device_attrs[26].attr),
+  &(pump_device_attrs[27].attr),
+  &(pump_device_attrs[28].attr),
+  &(pump_device_attrs[29].attr),
+  &(pump_device_attrs[30].attr),
+  &(pump_device_attrs[31].attr),
+  &(pump_device_attrs[32].attr),
+  &(pump_device_attrs[33].attr),
+  &(pump_device_attrs[34].attr),
+  &(pump_device_attrs[35].attr),
+  &(pump_device_attrs[36].attr),
+  &(pump_device_attrs[37].attr),
+  &(pump_device_attrs[38].attr),
+  &(pump_device_attrs[39].attr),
+  &(pump_device_attrs[40].attr),
+  &(pump_device_attrs[41].attr),
+  &(pump_device_attrs[42].attr),
+  &(pump_device_attrs[43].attr),
+  &(pump_device_attrs[44].attr),
+  &(pump_device_attrs[45].attr),
+  &(pump_device_attrs[46].attr),
+  &(pump_device_attrs[47].attr),
+  &(pump_device_attrs[48].attr),
+  &(pump_device_attrs[49].attr),
+  &(pump_device_attrs[50].attr),
+  &(pump_device_attrs[51].attr),
+  &(pump_device_attrs[52].attr),
+  &(pump_device_attrs[53].attr),
+  &(pump_device_attrs[54].attr),
+  &(pump_device_attrs[55].attr),
+  &(pump_device_attrs[56].attr),
+  &(pump_device_attrs[57].attr),
+  &(pump_device_attrs[58].attr),
+  &(pump_device_attrs[59].attr),
+  &(pump_device_attrs[60].attr),
+  &(pump_device_attrs[61].attr),
+  &(pump_device_attrs[62].attr),
+#if (PUMP_DEBUG == 1)
+  &(pump_device_attrs[63].attr),
+  &(pump_device_attrs[64].attr),
+  &(pump_device_attrs[65].attr),
+  &(pump_device_attrs[66].attr),
 #endif
   NULL
 };
@@ -231,6 +887,131 @@ static const struct attribute_group* pump_attr_groups[] = {
 #define SET_SYS_CLASS_ATTRIBUTES(sys_class) {(sys_class)->dev_attrs  = pump_device_attrs;}
 #endif
 
+/**
+ * pump_event_begin() - Start recording a transfer into the event log entry.
+ */
+static void pump_event_begin(struct pump_driver_data* this, size_t xfer_size)
+{
+    memset(&this->event, 0, sizeof(this->event));
+    this->event_mark      = ktime_get();
+    this->event.timestamp = ktime_to_ns(this->event_mark);
+    this->event.direction = this->direction;
+    this->event.bytes     = xfer_size;
+}
+
+/**
+ * pump_event_commit() - Close the release phase, append the entry and
+ *                       account the transfer.
+ */
+static void pump_event_commit(struct pump_driver_data* this)
+{
+    this->event.usec_release = pump_evlog_lap(&this->event_mark);
+    write_seqcount_begin(&this->usec_seq);
+    this->usec_table_build += this->event.usec_build;
+    write_seqcount_end(&this->usec_seq);
+    pump_evlog_commit(&this->evlog, &this->event);
+    pump_stat_account(&this->stat, this->event.bytes, this->event.result);
+}
+
+/**
+ * pump_pin_charge() - Account pages pinned and descriptor memory allocated
+ *                     for the current transfer.
+ *
+ * The amounts are carried to pump_release_job_run(), so pages waiting for
+ * a deferred release stay counted until they are really put back.
+ */
+static void pump_pin_charge(struct pump_driver_data* this, unsigned long pages, unsigned long desc)
+{
+    unsigned long pinned = atomic_long_add_return(pages, &this->pinned_pages);
+    unsigned long bytes  = atomic_long_add_return(desc , &this->desc_bytes  );
+    this->pin_pages      += pages;
+    this->pin_desc_bytes += desc;
+    if (pinned > this->pinned_peak)
+        this->pinned_peak = pinned;
+    if (bytes  > this->desc_peak)
+        this->desc_peak   = bytes;
+}
+
+/**
+ * pump_pin_window() - Bytes of @size from @buff that may be pinned now.
+ *
+ * Bounded by pin_limit of the device and, unless the caller has
+ * CAP_IPC_LOCK, by what is left of its RLIMIT_MEMLOCK.
+ */
+static size_t pump_pin_window(struct pump_driver_data* this, char __user* buff, size_t size)
+{
+    unsigned long offset = ((unsigned long)buff) & ~PAGE_MASK;
+    unsigned long pages  = PAGE_ALIGN(offset + size) >> PAGE_SHIFT;
+    unsigned long avail  = ULONG_MAX;
+
+    if (this->pin_limit != 0) {
+        unsigned long limit  = DIV_ROUND_UP(this->pin_limit, PAGE_SIZE);
+        unsigned long pinned = atomic_long_read(&this->pinned_pages);
+        avail = (pinned < limit) ? limit - pinned : 0;
+    }
+    if ((this->pin_rlimit) && (!capable(CAP_IPC_LOCK))) {
+        unsigned long limit  = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+        unsigned long pinned = ACCESS_ONCE(current->mm->pinned_vm);
+        avail = min(avail, (pinned < limit) ? limit - pinned : 0);
+    }
+    if (pages <= avail)
+        return size;
+    if (avail == 0)
+        return 0;
+    return (avail << PAGE_SHIFT) - offset;
+}
+
+/**
+ * pump_pin_mm_charge() - Charge @pages to pinned_vm of the caller.
+ *
+ * Nothing is charged with pin_rlimit=0, and pin_mm stays NULL so nothing
+ * is uncharged either.
+ */
+static int  pump_pin_mm_charge(struct pump_driver_data* this, unsigned long pages)
+{
+    struct mm_struct* mm     = current->mm;
+    int               result = 0;
+
+    if (!this->pin_rlimit)
+        return 0;
+    down_write(&mm->mmap_sem);
+    if ((!capable(CAP_IPC_LOCK)) &&
+        (mm->pinned_vm + pages > (rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT))) {
+        result = -ENOMEM;
+    } else {
+        mm->pinned_vm     += pages;
+        this->pin_mm       = mm;
+        this->pin_mm_pages = pages;
+    }
+    up_write(&mm->mmap_sem);
+    return result;
+}
+
+static void pump_pin_mm_uncharge(struct pump_driver_data* this)
+{
+    if (this->pin_mm == NULL)
+        return;
+    down_write(&this->pin_mm->mmap_sem);
+    this->pin_mm->pinned_vm -= this->pin_mm_pages;
+    up_write(&this->pin_mm->mmap_sem);
+    this->pin_mm       = NULL;
+    this->pin_mm_pages = 0;
+}
+
+/**
+ * pump_pin_mm_put() - Uncharge pages released after the transfer and drop
+ *                     the reference (mm_count) the release job held on @mm.
+ */
+static void pump_pin_mm_put(struct mm_struct* mm, unsigned long pages)
+{
+    if (mm == NULL)
+        return;
+    down_write(&mm->mmap_sem);
+    mm->pinned_vm -= pages;
+    up_write(&mm->mmap_sem);
+    mmdrop(mm);
+}
+
 /**
  * pump_alloc_pages_from_user_buffer()
  */
@@ -248,12 +1029,17 @@ static int  pump_alloc_pages_from_user_buffer(struct pump_driver_data* this, cha
     if (PUMP_DEBUG_CHECK(this,debug_phase))
         dev_info(this->dev, "pump_alloc_pages_from_user_buffer(buff=%pK,count=%d)\n", buff, count);
 
+    result = pump_pin_mm_charge(this, n_pages);
+    if (result)
+        goto failed;
+
     this->page_list = kzalloc(n_pages * sizeof(struct page*), GFP_KERNEL);
     if (IS_ERR_OR_NULL(this->page_list)) {
         result = PTR_ERR(this->page_list);
         this->page_list = NULL;
         goto failed;
     }
+    pump_pin_charge(this, 0, n_pages * sizeof(struct page*));
     
     down_read(&current->mm->mmap_sem);
     result = get_user_pages(
@@ -270,11 +1056,13 @@ static int  pump_alloc_pages_from_user_buffer(struct pump_driver_data* this, cha
     
     if (result != n_pages) {
         this->page_nums = (result > 0) ? result : 0;
+        pump_pin_charge(this, this->page_nums, 0);
         result = (result < 0) ? result : -EINVAL;
         goto failed;
     }
     else {
         this->page_nums = result;
+        pump_pin_charge(this, this->page_nums, 0);
     }
     
     if (PUMP_DEBUG_CHECK(this,debug_phase))
@@ -290,19 +1078,19 @@ static int  pump_alloc_pages_from_user_buffer(struct pump_driver_data* this, cha
 /**
  * pump_free_sg_table()
  */
-static void pump_free_sg_table(struct pump_driver_data* this)
+static void pump_free_sg_table(struct pump_driver_data* this, struct sg_table* sg_table)
 {
     if (PUMP_DEBUG_CHECK(this,debug_phase))
         dev_info(this->dev, "pump_free_sg_table()\n");
 
 #ifdef ARCH_HAS_SG_CHAIN
-    sg_free_table(&this->sg_table);
+    sg_free_table(sg_table);
 #else
-    if (this->sg_table.sgl != NULL) {
-        kfree(this->sg_table.sgl);
-        this->sg_table.sgl        = NULL;
-        this->sg_table.nents      = 0;
-        this->sg_table.orig_nents = 0;
+    if (sg_table->sgl != NULL) {
+        kfree(sg_table->sgl);
+        sg_table->sgl        = NULL;
+        sg_table->nents      = 0;
+        sg_table->orig_nents = 0;
     }
 #endif
 }
@@ -402,11 +1190,12 @@ static int  pump_alloc_sg_table_from_pages(struct pump_driver_data* this, char _
 	}
     }
 #endif
+    pump_pin_charge(this, 0, this->sg_table.orig_nents * sizeof(struct scatterlist));
 
     this->sg_nums = dma_map_sg(this->dev, this->sg_table.sgl, this->sg_table.nents, dma_direction);
 
     if (0 == this->sg_nums) {
-        pump_free_sg_table(this);
+        pump_free_sg_table(this, &this->sg_table);
         result = -ENOMEM;
         goto failed;
     }
@@ -422,57 +1211,403 @@ static int  pump_alloc_sg_table_from_pages(struct pump_driver_data* this, char _
     return result;
 }
 
+/**
+ * pump_iov_page_nums() - Number of pages one segment of a vector spans.
+ */
+static unsigned int pump_iov_page_nums(const struct iovec* iov)
+{
+    unsigned long start = (unsigned long)iov->iov_base;
+    if (iov->iov_len == 0)
+        return 0;
+    return ((start + iov->iov_len - 1) >> PAGE_SHIFT) - (start >> PAGE_SHIFT) + 1;
+}
 
 /**
- * pump_buffer_setup()
+ * pump_alloc_pages_from_iov() - Pin the pages of every segment into one
+ *                               page_list.
  */
-static int  pump_buffer_setup(
-    struct pump_driver_data* this, 
-    char __user*             buff, 
-    size_t*                  xfer_size, 
-    bool                     xfer_first, 
-    bool                     xfer_last
+static int  pump_alloc_pages_from_iov(
+    struct pump_driver_data* this,
+    const struct iovec*      iov,
+    unsigned long            nr_segs,
+    unsigned long            n_pages
 )
 {
-    int  result = 0;
-    u64  start_time;
+    int           result        = 0;
+    int           dma_direction = (this->direction) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+    int           page_write    = (dma_direction == DMA_FROM_DEVICE) ? 1 : 0;
+    unsigned long seg;
 
-    if (PUMP_DEBUG_CHECK(this,debug_phase))
-        dev_info(this->dev, "pump_buffer_setup(%pK,%d)\n", buff, *xfer_size);
-    /*
-     *
-     */
-    start_time = get_jiffies_64();
-    /*
-     * user buffer to page_list
-     */
-    result = pump_alloc_pages_from_user_buffer(this, buff, *xfer_size);
-    if (result) 
-        goto failed;
-    /* pump_debug_pages(this); */
-    /*
-     * page_list to sg_table
-     */
-    result = pump_alloc_sg_table_from_pages(this, buff, *xfer_size);
-    if (result) 
-        goto failed;
-    /* pump_debug_sg_table(this); */
-    /*
-     * sg_table to pump_buf_list
-     */
-    result = pump_proc_add_buf_list_from_sg(
-        &this->pump_proc_data, /* struct pump_proc_data*  this       */
-        &this->pump_buf_list , /* struct list_head*       buf_list   */
-        this->sg_table.sgl   , /* struct scatterlist*     sg_list    */
-        this->sg_nums        , /* unsigned int            sg_nums    */
-        xfer_first           , /* bool                    xfer_first */
-        xfer_last            , /* bool                    xfer_last  */
-        PUMP_XFER_AXI_MODE     /* unsigned int            xfer_mode  */
-    );
-    /*
-     *
+    result = pump_pin_mm_charge(this, n_pages);
+    if (result)
+        return result;
+
+    this->page_list = kzalloc(n_pages * sizeof(struct page*), GFP_KERNEL);
+    if (this->page_list == NULL)
+        return -ENOMEM;
+    pump_pin_charge(this, 0, n_pages * sizeof(struct page*));
+
+    down_read(&current->mm->mmap_sem);
+    for (seg = 0; seg < nr_segs; seg++) {
+        unsigned int pages = pump_iov_page_nums(&iov[seg]);
+        if (pages == 0)
+            continue;
+        result = get_user_pages(
+            current                              , /* struct task_struct    */
+            current->mm                          , /* struct mm_struct      */
+            ((unsigned long)iov[seg].iov_base) & PAGE_MASK, /* page start   */
+            pages                                , /* buffer page number    */
+            page_write                           , /* page write mapping    */
+            0                                    , /* page force mapping    */
+            this->page_list + this->page_nums    , /* struct page **pages   */
+            NULL                                   /* struct vm_area_struct */
+        );
+        if (result > 0) {
+            this->page_nums += result;
+            pump_pin_charge(this, result, 0);
+        }
+        if (result != pages) {
+            result = (result < 0) ? result : -EINVAL;
+            break;
+        }
+        result = 0;
+    }
+    up_read(&current->mm->mmap_sem);
+    return result;
+}
+
+/**
+ * pump_iov_fill_sg() - Lay the pinned segments out as scatterlist entries.
+ * @sg_list:	Entries to fill, or NULL to only count them.
+ * returns:	The number of entries.
+ *
+ * Physically contiguous pages are packed into one entry as
+ * pump_alloc_sg_table_from_pages() does, but never across two segments.
+ */
+static unsigned int pump_iov_fill_sg(
+    struct pump_driver_data* this,
+    const struct iovec*      iov,
+    unsigned long            nr_segs,
+    struct scatterlist*      sg_list
+)
+{
+    struct scatterlist* sg      = sg_list;
+    struct page**       pages   = this->page_list;
+    unsigned int        sg_nums = 0;
+    unsigned long       seg;
+
+    for (seg = 0; seg < nr_segs; seg++) {
+        unsigned int  page_nums   = pump_iov_page_nums(&iov[seg]);
+        unsigned long page_offset = ((unsigned long)iov[seg].iov_base) & ~PAGE_MASK;
+        size_t        remain_size = iov[seg].iov_len;
+        unsigned int  curr_page   = 0;
+        while (curr_page < page_nums) {
+            unsigned int next_page = curr_page + 1;
+            size_t       xfer_size;
+            while ((next_page < page_nums) &&
+                   (next_page - curr_page < PUMP_SG_PACK_MAX) &&
+                   (page_to_pfn(pages[next_page]) == page_to_pfn(pages[next_page-1]) + 1))
+                next_page++;
+            xfer_size = min(remain_size, (size_t)(((next_page - curr_page) << PAGE_SHIFT) - page_offset));
+            if (sg != NULL) {
+                sg_set_page(sg, pages[curr_page], xfer_size, page_offset);
+                sg = sg_next(sg);
+            }
+            remain_size -= xfer_size;
+            page_offset  = 0;
+            curr_page    = next_page;
+            sg_nums++;
+        }
+        pages += page_nums;
+    }
+    return sg_nums;
+}
+
+/**
+ * pump_alloc_sg_table_from_iov() - Build and map one sg_table for all segments.
+ */
+static int  pump_alloc_sg_table_from_iov(struct pump_driver_data* this, const struct iovec* iov, unsigned long nr_segs)
+{
+    int           result        = 0;
+    int           dma_direction = (this->direction) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+    unsigned int  sg_nums       = pump_iov_fill_sg(this, iov, nr_segs, NULL);
+
+#ifdef ARCH_HAS_SG_CHAIN
+    result = sg_alloc_table(&this->sg_table, sg_nums, GFP_KERNEL);
+    if (result)
+        return result;
+#else
+    this->sg_table.sgl = kmalloc(sg_nums * sizeof(struct scatterlist), GFP_KERNEL);
+    if (this->sg_table.sgl == NULL)
+        return -ENOMEM;
+    sg_init_table(this->sg_table.sgl, sg_nums);
+    this->sg_table.nents      = sg_nums;
+    this->sg_table.orig_nents = sg_nums;
+#endif
+    pump_iov_fill_sg(this, iov, nr_segs, this->sg_table.sgl);
+    pump_pin_charge(this, 0, this->sg_table.orig_nents * sizeof(struct scatterlist));
+
+    this->sg_nums = dma_map_sg(this->dev, this->sg_table.sgl, this->sg_table.nents, dma_direction);
+    if (this->sg_nums == 0) {
+        pump_free_sg_table(this, &this->sg_table);
+        result = -ENOMEM;
+    }
+    return result;
+}
+
+
+static void pump_buffer_release(struct pump_driver_data* this);
+static bool pump_chain_cacheable(struct pump_driver_data* this);
+static struct pump_chain_entry* pump_chain_lookup(struct pump_driver_data* this, char __user* buff, size_t size, bool xfer_first, bool xfer_last);
+
+/**
+ * pump_align_split() - Find the parts of the user buffer outside whole cache lines.
+ *
+ * Transfers that do not span at least one whole line are left alone; they
+ * are small enough for the bounce_threshold path.
+ */
+static void pump_align_split(char __user* buff, size_t size, size_t* head, size_t* tail)
+{
+    unsigned long start      = (unsigned long)buff;
+    unsigned long end        = start + size;
+    unsigned long body_start = ALIGN(start, PUMP_ALIGN_SIZE);
+    unsigned long body_end   = end & ~(unsigned long)(PUMP_ALIGN_SIZE-1);
+
+    if ((body_start >= body_end) || (body_start < start)) {
+        *head = 0;
+        *tail = 0;
+    } else {
+        *head = body_start - start;
+        *tail = end - body_end;
+    }
+}
+
+/**
+ * pump_align_add_buf_list() - Add a head or tail through the alignment bounce buffer.
+ * @offset:	Offset of the part in the user buffer.
+ * @size:	Size of the part.
+ * @bounce_offset: Offset in the bounce buffer (0 for the head, PUMP_ALIGN_SIZE for the tail).
+ */
+static int  pump_align_add_buf_list(
+    struct pump_driver_data* this, 
+    size_t                   offset, 
+    size_t                   size, 
+    size_t                   bounce_offset, 
+    bool                     xfer_first, 
+    bool                     xfer_last
+)
+{
+    struct scatterlist sg;
+
+    if ((this->direction) &&
+        (copy_from_user((char*)this->align_buf->buf_ptr + bounce_offset, this->align_buff + offset, size) != 0))
+        return -EFAULT;
+    pump_proc_bounce_sync_for_device(&this->pump_proc_data, this->align_buf, bounce_offset, size);
+    sg_init_table(&sg, 1);
+    sg_dma_address(&sg) = this->align_buf->buf_addr + bounce_offset;
+    sg_dma_len(&sg)     = size;
+    this->align_bounce_bytes += size;
+    return pump_proc_add_buf_list_from_sg(
+        &this->pump_proc_data, /* struct pump_proc_data*  this       */
+        &this->pump_buf_list , /* struct list_head*       buf_list   */
+        &sg                  , /* struct scatterlist*     sg_list    */
+        1                    , /* unsigned int            sg_nums    */
+        xfer_first           , /* bool                    xfer_first */
+        xfer_last            , /* bool                    xfer_last  */
+        PUMP_XFER_AXI_MODE     /* unsigned int            xfer_mode  */
+    );
+}
+
+/**
+ * pump_align_finish() - Copy the bounced head and tail of a read back to the user.
+ * @done:	Number of bytes the pump has transferred.
+ */
+static int  pump_align_finish(struct pump_driver_data* this, size_t done)
+{
+    int status = 0;
+
+    if ((this->align_buf == NULL) || (this->direction != 0))
+        return 0;
+    if ((this->align_head > 0) && (done >= this->align_head)) {
+        pump_proc_bounce_sync_for_cpu(&this->pump_proc_data, this->align_buf, 0, this->align_head);
+        if (copy_to_user(this->align_buff, this->align_buf->buf_ptr, this->align_head) != 0)
+            status = -EFAULT;
+    }
+    if ((this->align_tail > 0) && (done >= this->align_size)) {
+        pump_proc_bounce_sync_for_cpu(&this->pump_proc_data, this->align_buf, PUMP_ALIGN_SIZE, this->align_tail);
+        if (copy_to_user(this->align_buff + this->align_size - this->align_tail,
+                         (char*)this->align_buf->buf_ptr + PUMP_ALIGN_SIZE, this->align_tail) != 0)
+            status = -EFAULT;
+    }
+    return status;
+}
+
+/**
+ * pump_buffer_setup()
+ */
+static int  pump_buffer_setup(
+    struct pump_driver_data* this, 
+    char __user*             buff, 
+    size_t*                  xfer_size, 
+    bool                     xfer_first, 
+    bool                     xfer_last
+)
+{
+    int    result = 0;
+    u64    start_time;
+    size_t head   = 0;
+    size_t tail   = 0;
+    size_t body;
+
+    if (PUMP_DEBUG_CHECK(this,debug_phase))
+        dev_info(this->dev, "pump_buffer_setup(%pK,%d)\n", buff, *xfer_size);
+    /*
+     *
+     */
+    start_time = get_jiffies_64();
+    pump_event_begin(this, *xfer_size);
+    /*
+     * 前回と同じアドレスと長さの read()/write() なら、キャッシュに残して
+     * おいたピン留め済みのページと sg_table と命令コードをそのまま使う.
+     * キャッシュのページは既にピン留めの予算に数えられているので、予算
+     * による分割よりも先に探す.
+     */
+    if ((*xfer_size > 0) && (pump_chain_cacheable(this))) {
+        struct pump_chain_entry* entry = pump_chain_lookup(this, buff, *xfer_size, xfer_first, xfer_last);
+        if (entry != NULL) {
+            int dma_direction = (this->direction) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+            dma_sync_sg_for_device(this->dev, entry->sg_table.sgl, entry->sg_table.nents, dma_direction);
+            this->chain_entry      = entry;
+            this->chain_hit_count++;
+            this->event.sg_nums    = entry->sg_nums;
+            this->event.table_nums = pump_proc_table_nums(&entry->table_list);
+            pump_usec_add(this, &this->usec_buffer_setup, start_time);
+            if (PUMP_DEBUG_CHECK(this,debug_phase))
+                dev_info(this->dev, "pump_buffer_setup() => chain cache hit\n");
+            return 0;
+        }
+        this->chain_miss_count++;
+    }
+    /*
+     * ピン留めの予算を越える要求は、予算に収まる分だけを転送して短い
+     * バイト数を返す. 予算を使っているのが遅延解放待ちのページやキャッシュ
+     * に残したページなら、それらを解放してから測り直す.
+     */
+    {
+        size_t window = pump_pin_window(this, buff, *xfer_size);
+        if ((window < *xfer_size) && (this->chain_nums > 0)) {
+            pump_chain_shrink(this, 1);
+            window = pump_pin_window(this, buff, *xfer_size);
+        }
+        if ((window == 0) && (*xfer_size > 0) && (atomic_read(&this->release_pending) > 0)) {
+            flush_work(&this->release_work);
+            window = pump_pin_window(this, buff, *xfer_size);
+        }
+        if ((window == 0) && (*xfer_size > 0)) {
+            result = -ENOMEM;
+            goto failed;
+        }
+        if (window < *xfer_size) {
+            *xfer_size        = window;
+            xfer_last         = 0;
+            this->event.bytes = window;
+            this->pin_window_count++;
+        }
+    }
+    /*
+     * キャッシュラインに揃っていない先頭と末尾はバウンスバッファを通し、
+     * 揃っている本体だけをピン留めして直接転送する.
+     */
+    if (this->align_bounce)
+        pump_align_split(buff, *xfer_size, &head, &tail);
+    if ((head > 0) || (tail > 0)) {
+        this->align_buf = pump_proc_bounce_get(&this->pump_proc_data);
+        if (this->align_buf == NULL) {
+            head = 0;
+            tail = 0;
+        } else {
+            this->align_buff = buff;
+            this->align_size = *xfer_size;
+            this->align_head = head;
+            this->align_tail = tail;
+            this->align_xfer_count++;
+            this->event.head_bytes = head;
+            this->event.tail_bytes = tail;
+        }
+    }
+    body = *xfer_size - head - tail;
+    /*
+     * バウンスバッファを通さずに全体を直接転送する時だけ、キャッシュに
+     * 残せるように命令コードを作る.
+     */
+    if ((head == 0) && (tail == 0) && (body > 0) && (pump_chain_cacheable(this))) {
+        this->chain_new = kzalloc(sizeof(*this->chain_new), GFP_KERNEL);
+        if (this->chain_new != NULL) {
+            this->chain_new->addr       = (unsigned long)buff;
+            this->chain_new->size       = body;
+            this->chain_new->xfer_first = xfer_first;
+            this->chain_new->xfer_last  = xfer_last;
+        }
+    }
+    if (head > 0) {
+        result = pump_align_add_buf_list(this, 0, head, 0, xfer_first, 0);
+        if (result)
+            goto failed;
+    }
+    /*
+     * user buffer to page_list
+     */
+    result = pump_alloc_pages_from_user_buffer(this, buff + head, body);
+    this->event.usec_pin = pump_evlog_lap(&this->event_mark);
+    if (result) 
+        goto failed;
+    /* pump_debug_pages(this); */
+    /*
+     * page_list to sg_table
+     */
+    result = pump_alloc_sg_table_from_pages(this, buff + head, body);
+    this->event.usec_map = pump_evlog_lap(&this->event_mark);
+    if (result) 
+        goto failed;
+    /* pump_debug_sg_table(this); */
+    /*
+     * sg_table to pump_buf_list
+     */
+    if (this->chain_new != NULL) {
+        result = pump_proc_prog_add_sg(
+            &this->pump_proc_data, /* struct pump_proc_data*  this       */
+            &this->pump_buf_list , /* struct list_head*       prog_list  */
+            this->sg_table.sgl   , /* struct scatterlist*     sg_list    */
+            this->sg_nums        , /* unsigned int            sg_nums    */
+            xfer_first           , /* bool                    xfer_first */
+            xfer_last            , /* bool                    xfer_last  */
+            PUMP_XFER_AXI_MODE     /* unsigned int            xfer_mode  */
+        );
+    } else {
+        result = pump_proc_add_buf_list_from_sg(
+            &this->pump_proc_data, /* struct pump_proc_data*  this       */
+            &this->pump_buf_list , /* struct list_head*       buf_list   */
+            this->sg_table.sgl   , /* struct scatterlist*     sg_list    */
+            this->sg_nums        , /* unsigned int            sg_nums    */
+            xfer_first && !head  , /* bool                    xfer_first */
+            xfer_last  && !tail  , /* bool                    xfer_last  */
+            PUMP_XFER_AXI_MODE     /* unsigned int            xfer_mode  */
+        );
+    }
+    if (result)
+        goto failed;
+    if (tail > 0) {
+        result = pump_align_add_buf_list(this, head + body, tail, PUMP_ALIGN_SIZE, 0, xfer_last);
+        if (result)
+            goto failed;
+    }
+    this->event.usec_build = pump_evlog_lap(&this->event_mark);
+    this->event.sg_nums    = this->sg_nums + ((head > 0) ? 1 : 0) + ((tail > 0) ? 1 : 0);
+    this->event.table_nums = pump_proc_table_nums(&this->pump_buf_list);
+    /*
+     *
      */
-    this->usec_buffer_setup += jiffies_to_usecs((unsigned long)(get_jiffies_64() - start_time));
+    pump_usec_add(this, &this->usec_buffer_setup, start_time);
     /*
      *
      */
@@ -484,379 +1619,3097 @@ static int  pump_buffer_setup(
     return 0;
 
  failed:
+    this->event.result = result;
+    kfree(this->chain_new);
+    this->chain_new = NULL;
+    pump_buffer_release(this);
     if (PUMP_DEBUG_CHECK(this,debug_phase))
         dev_info(this->dev, "pump_buffer_setup() => error(%d)\n", result);
     return result;
 }
 
 /**
- * pump_buffer_release()
+ * pump_buffer_setup_iov() - Pin, map and build one operation code chain for
+ *                           all segments of a vector.
+ * returns:	-ENOBUFS if the vector must be transferred segment by segment.
+ *
+ * The vector is not split by the pin budget and not bounced, so it falls
+ * back when it does not fit in pin_limit or when an outlet segment is not
+ * cache line aligned and align_bounce is set.
  */
-static void pump_buffer_release(struct pump_driver_data* this)
+static int  pump_buffer_setup_iov(
+    struct pump_driver_data* this,
+    const struct iovec*      iov,
+    unsigned long            nr_segs,
+    size_t                   xfer_size,
+    bool                     xfer_first,
+    bool                     xfer_last
+)
 {
-    int  i;
-    int  dma_direction = (this->direction) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
-    u64  start_time;
+    int           result  = 0;
+    unsigned long n_pages = 0;
+    unsigned long seg;
+    u64           start_time;
+
+    for (seg = 0; seg < nr_segs; seg++) {
+        if ((this->direction == 0) && (this->align_bounce)) {
+            size_t head, tail;
+            pump_align_split(iov[seg].iov_base, iov[seg].iov_len, &head, &tail);
+            if ((head > 0) || (tail > 0))
+                return -ENOBUFS;
+        }
+        n_pages += pump_iov_page_nums(&iov[seg]);
+    }
+    if (pump_pin_window(this, NULL, n_pages << PAGE_SHIFT) < (n_pages << PAGE_SHIFT))
+        return -ENOBUFS;
 
     if (PUMP_DEBUG_CHECK(this,debug_phase))
-        dev_info(this->dev, "pump_buffer_release()\n");
+        dev_info(this->dev, "pump_buffer_setup_iov(%lu,%d)\n", nr_segs, xfer_size);
 
     start_time = get_jiffies_64();
+    pump_event_begin(this, xfer_size);
 
-    pump_proc_clear_buf_list(&this->pump_proc_data, &this->pump_buf_list);
+    result = pump_alloc_pages_from_iov(this, iov, nr_segs, n_pages);
+    this->event.usec_pin = pump_evlog_lap(&this->event_mark);
+    if (result)
+        goto failed;
 
-    if (this->sg_nums != 0) {
-        dma_unmap_sg(this->dev, this->sg_table.sgl, this->sg_table.nents, dma_direction);
-        pump_free_sg_table(this);
-        this->sg_nums = 0;
+    result = pump_alloc_sg_table_from_iov(this, iov, nr_segs);
+    this->event.usec_map = pump_evlog_lap(&this->event_mark);
+    if (result)
+        goto failed;
+
+    result = pump_proc_add_buf_list_from_sg(
+        &this->pump_proc_data, /* struct pump_proc_data*  this       */
+        &this->pump_buf_list , /* struct list_head*       buf_list   */
+        this->sg_table.sgl   , /* struct scatterlist*     sg_list    */
+        this->sg_nums        , /* unsigned int            sg_nums    */
+        xfer_first           , /* bool                    xfer_first */
+        xfer_last            , /* bool                    xfer_last  */
+        PUMP_XFER_AXI_MODE     /* unsigned int            xfer_mode  */
+    );
+    if (result)
+        goto failed;
+    this->event.usec_build = pump_evlog_lap(&this->event_mark);
+    this->event.sg_nums    = this->sg_nums;
+    this->event.table_nums = pump_proc_table_nums(&this->pump_buf_list);
+    pump_usec_add(this, &this->usec_buffer_setup, start_time);
+
+    if (PUMP_DEBUG_CHECK(this,debug_op_table))
+        pump_proc_debug_buf_list(&this->pump_proc_data, &this->pump_buf_list);
+    return 0;
+
+ failed:
+    this->event.result = result;
+    pump_buffer_release(this);
+    if (PUMP_DEBUG_CHECK(this,debug_phase))
+        dev_info(this->dev, "pump_buffer_setup_iov() => error(%d)\n", result);
+    return result;
+}
+
+/**
+ * struct pump_release_job - Resources of one transfer waiting to be released
+ */
+struct pump_release_job {
+    struct list_head        list;
+    struct list_head        buf_list;
+    struct sg_table         sg_table;
+    unsigned int            sg_nums;
+    struct page**           page_list;
+    unsigned int            page_nums;
+    unsigned long           pin_pages;
+    unsigned long           desc_bytes;
+    struct mm_struct*       pin_mm;
+    unsigned long           pin_mm_pages;
+};
+
+/**
+ * pump_release_job_run() - Free the operation code tables, unmap and unpin.
+ *
+ * The pages are put back with one release_pages() call instead of one
+ * page_cache_release() per page.
+ */
+static void pump_release_job_run(struct pump_driver_data* this, struct pump_release_job* job)
+{
+    int  i;
+    int  dma_direction = (this->direction) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+
+    /*
+     * PUMPが止まらなかった時は、DMAがまだ命令コードとページを使っている
+     * かもしれないので解放しない. 次に止められた時に pump_xfer_recover()
+     * が解放する. 取っておく場所も無ければ、そのまま手放す.
+     */
+    if (ACCESS_ONCE(this->stop_failed)) {
+        struct pump_release_job* hold = kmalloc(sizeof(*hold), GFP_KERNEL);
+        if (hold != NULL) {
+            *hold = *job;
+            INIT_LIST_HEAD(&hold->buf_list);
+            list_splice_init(&job->buf_list, &hold->buf_list);
+            spin_lock(&this->release_lock);
+            list_add_tail(&hold->list, &this->quarantine_list);
+            spin_unlock(&this->release_lock);
+        }
+        return;
     }
 
-    if (this->page_list != NULL) {
+    pump_proc_clear_buf_list(&this->pump_proc_data, &job->buf_list);
+
+    if (job->sg_nums != 0)
+        dma_unmap_sg(this->dev, job->sg_table.sgl, job->sg_table.nents, dma_direction);
+    pump_free_sg_table(this, &job->sg_table);
+
+    if (job->page_list != NULL) {
         if (dma_direction == DMA_FROM_DEVICE) {
-            for (i = 0; i < this->page_nums; i++) {
-                if (!PageReserved(this->page_list[i]))
-                    SetPageDirty(this->page_list[i]);
-                page_cache_release(this->page_list[i]);
-            }
-        } else {
-            for (i = 0; i < this->page_nums; i++) {
-                page_cache_release(this->page_list[i]);
+            for (i = 0; i < job->page_nums; i++) {
+                if (!PageReserved(job->page_list[i]))
+                    SetPageDirty(job->page_list[i]);
             }
         }
-        kfree(this->page_list);
-        this->page_list = NULL;
-        this->page_nums = 0;
+        release_pages(job->page_list, job->page_nums, 0);
+        kfree(job->page_list);
+    }
+    pump_pin_mm_put(job->pin_mm, job->pin_mm_pages);
+    atomic_long_sub(job->pin_pages , &this->pinned_pages);
+    atomic_long_sub(job->desc_bytes, &this->desc_bytes  );
+}
+
+/**
+ * pump_clear_buf_list() - Free operation code tables the engine has run.
+ */
+static void pump_clear_buf_list(struct pump_driver_data* this, struct list_head* buf_list)
+{
+    struct pump_release_job job;
+
+    memset(&job, 0, sizeof(job));
+    INIT_LIST_HEAD(&job.buf_list);
+    list_splice_init(buf_list, &job.buf_list);
+    pump_release_job_run(this, &job);
+}
+
+/**
+ * pump_bounce_release() - Give back a bounce buffer the engine has used.
+ */
+static void pump_bounce_release(struct pump_driver_data* this, struct pump_proc_bounce* bounce)
+{
+    if (this->stop_failed) {
+        spin_lock(&this->release_lock);
+        list_add_tail(&bounce->list, &this->quarantine_bounce_list);
+        spin_unlock(&this->release_lock);
+        return;
+    }
+    pump_proc_bounce_put(&this->pump_proc_data, bounce);
+}
+
+/**
+ * pump_xfer_stop() - Stop the pump and remember if it did not stop.
+ *
+ * Until a later stop succeeds every buffer released by the driver is held
+ * in the quarantine lists instead of being freed.
+ */
+static int  pump_xfer_stop(struct pump_driver_data* this)
+{
+    int result = pump_proc_stop(&this->pump_proc_data);
+    if (result != 0)
+        this->stop_failed = 1;
+    return result;
+}
+
+/**
+ * pump_xfer_recover() - Try to stop a pump that did not stop before, and
+ *                       free what was held while it ran.
+ *
+ * Called with this->sem held.
+ */
+static int  pump_xfer_recover(struct pump_driver_data* this)
+{
+    struct pump_release_job* job;
+    struct pump_release_job* next_job;
+    struct pump_proc_bounce* bounce;
+    struct pump_proc_bounce* next_bounce;
+    LIST_HEAD(job_list);
+    LIST_HEAD(bounce_list);
+
+    if (!this->stop_failed)
+        return 0;
+    if (pump_proc_stop(&this->pump_proc_data) != 0)
+        return -EBUSY;
+    dev_info(this->dev, "pump stopped, releasing the held buffers\n");
+    this->stop_failed = 0;
+    spin_lock(&this->release_lock);
+    list_splice_init(&this->quarantine_list       , &job_list   );
+    list_splice_init(&this->quarantine_bounce_list, &bounce_list);
+    spin_unlock(&this->release_lock);
+    list_for_each_entry_safe(job, next_job, &job_list, list) {
+        list_del(&job->list);
+        pump_release_job_run(this, job);
+        kfree(job);
+    }
+    list_for_each_entry_safe(bounce, next_bounce, &bounce_list, list) {
+        list_del(&bounce->list);
+        pump_proc_bounce_put(&this->pump_proc_data, bounce);
+    }
+    return 0;
+}
+
+/**
+ * pump_release_work() - Run the deferred release jobs.
+ */
+static void pump_release_work(struct work_struct* work)
+{
+    struct pump_driver_data* this = container_of(work, struct pump_driver_data, release_work);
+    struct pump_release_job* job;
+    struct pump_release_job* next_job;
+    LIST_HEAD(release_list);
+
+    spin_lock(&this->release_lock);
+    list_splice_init(&this->release_list, &release_list);
+    spin_unlock(&this->release_lock);
+
+    list_for_each_entry_safe(job, next_job, &release_list, list) {
+        list_del(&job->list);
+        pump_release_job_run(this, job);
+        kfree(job);
+        atomic_dec(&this->release_pending);
+    }
+}
+
+/**
+ * pump_chain_cacheable() - Whether the current read()/write() may use the
+ *                          chain cache.
+ *
+ * Cached pages stay pinned after the call returns but are not charged to
+ * pinned_vm, so callers held to RLIMIT_MEMLOCK by pin_rlimit never use it.
+ */
+static bool pump_chain_cacheable(struct pump_driver_data* this)
+{
+    if ((USE_CHAIN_CACHE == 0) || (this->chain_cache_max == 0) || (current->mm == NULL))
+        return 0;
+    return (!this->pin_rlimit) || (capable(CAP_IPC_LOCK));
+}
+
+/**
+ * pump_chain_lookup() - Find an idle entry for the buffer and mark it used.
+ *
+ * Called with this->sem held.  The entry is moved to the head of
+ * chain_list, which is kept in least recently used order from the tail.
+ */
+static struct pump_chain_entry* pump_chain_lookup(
+    struct pump_driver_data* this,
+    char __user*             buff,
+    size_t                   size,
+    bool                     xfer_first,
+    bool                     xfer_last
+)
+{
+    struct pump_chain_entry* entry;
+    struct pump_chain_entry* found = NULL;
+
+    spin_lock(&this->chain_lock);
+    list_for_each_entry(entry, &this->chain_list, list) {
+        if ((entry->chain_mm->mm == current->mm   ) &&
+            (entry->addr         == (unsigned long)buff) &&
+            (entry->size         == size          ) &&
+            (entry->xfer_first   == xfer_first    ) &&
+            (entry->xfer_last    == xfer_last     ) &&
+            (entry->in_use       == 0             ) &&
+            (entry->stale        == 0             )) {
+            entry->in_use = 1;
+            list_move(&entry->list, &this->chain_list);
+            found = entry;
+            break;
+        }
     }
-    this->usec_buffer_release += jiffies_to_usecs((unsigned long)(get_jiffies_64() - start_time));
+    spin_unlock(&this->chain_lock);
+    return found;
+}
+
+#if (USE_CHAIN_CACHE == 1)
+/**
+ * pump_chain_invalidate() - Mark the entries overlapping [@start, @end) stale.
+ *
+ * Runs in the mmu notifier, where this->sem must not be taken; the entries
+ * are freed by pump_chain_work().  Their pages are still pinned, so the
+ * engine never writes to memory that was given back.
+ */
+static void pump_chain_invalidate(struct pump_chain_mm* chain_mm, unsigned long start, unsigned long end)
+{
+    struct pump_driver_data* this  = chain_mm->driver_data;
+    struct pump_chain_entry* entry;
+    bool                     found = 0;
+
+    spin_lock(&this->chain_lock);
+    list_for_each_entry(entry, &this->chain_list, list) {
+        if ((entry->chain_mm == chain_mm) &&
+            ((entry->addr & PAGE_MASK) < end) &&
+            (start < PAGE_ALIGN(entry->addr + entry->size))) {
+            entry->stale = 1;
+            found = 1;
+        }
+    }
+    spin_unlock(&this->chain_lock);
+    if (found)
+        schedule_work(&this->chain_work);
+}
+
+static void pump_chain_mmu_release(struct mmu_notifier* mn, struct mm_struct* mm)
+{
+    pump_chain_invalidate(container_of(mn, struct pump_chain_mm, notifier), 0, ULONG_MAX);
+}
+
+static void pump_chain_mmu_invalidate_page(struct mmu_notifier* mn, struct mm_struct* mm, unsigned long address)
+{
+    pump_chain_invalidate(container_of(mn, struct pump_chain_mm, notifier), address, address + PAGE_SIZE);
+}
+
+static void pump_chain_mmu_invalidate_range_start(struct mmu_notifier* mn, struct mm_struct* mm, unsigned long start, unsigned long end)
+{
+    pump_chain_invalidate(container_of(mn, struct pump_chain_mm, notifier), start, end);
+}
+
+static const struct mmu_notifier_ops pump_chain_mmu_ops = {
+    .release                = pump_chain_mmu_release,
+    .invalidate_page        = pump_chain_mmu_invalidate_page,
+    .invalidate_range_start = pump_chain_mmu_invalidate_range_start,
+};
+#endif
+
+/**
+ * pump_chain_mm_get() - Find or register the notifier for current->mm.
+ */
+static struct pump_chain_mm* pump_chain_mm_get(struct pump_driver_data* this)
+{
+#if (USE_CHAIN_CACHE == 1)
+    struct pump_chain_mm* chain_mm;
+
+    list_for_each_entry(chain_mm, &this->chain_mm_list, list) {
+        if (chain_mm->mm == current->mm)
+            return chain_mm;
+    }
+    chain_mm = kzalloc(sizeof(*chain_mm), GFP_KERNEL);
+    if (chain_mm == NULL)
+        return NULL;
+    chain_mm->driver_data  = this;
+    chain_mm->mm           = current->mm;
+    chain_mm->notifier.ops = &pump_chain_mmu_ops;
+    if (mmu_notifier_register(&chain_mm->notifier, current->mm) != 0) {
+        kfree(chain_mm);
+        return NULL;
+    }
+    atomic_inc(&current->mm->mm_count);
+    list_add(&chain_mm->list, &this->chain_mm_list);
+    return chain_mm;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * pump_chain_mm_put() - Unregister the notifier after the last entry of the mm.
+ */
+static void pump_chain_mm_put(struct pump_driver_data* this, struct pump_chain_mm* chain_mm)
+{
+#if (USE_CHAIN_CACHE == 1)
+    if (--chain_mm->entry_nums > 0)
+        return;
+    list_del(&chain_mm->list);
+    mmu_notifier_unregister(&chain_mm->notifier, chain_mm->mm);
+    mmdrop(chain_mm->mm);
+    kfree(chain_mm);
+#endif
+}
+
+/**
+ * pump_chain_free() - Unmap, unpin and free an idle entry.
+ *
+ * Called with this->sem held.
+ */
+static void pump_chain_free(struct pump_driver_data* this, struct pump_chain_entry* entry)
+{
+    struct pump_release_job job;
+
+    spin_lock(&this->chain_lock);
+    list_del(&entry->list);
+    spin_unlock(&this->chain_lock);
+    this->chain_nums--;
+    this->chain_bytes -= (entry->pin_pages << PAGE_SHIFT) + entry->desc_bytes;
+
+    /*
+     * キャッシュしたエントリは pinned_vm に加算していないので pin_mm は NULL.
+     */
+    memset(&job, 0, sizeof(job));
+    INIT_LIST_HEAD(&job.buf_list);
+    list_splice_init(&entry->table_list, &job.buf_list);
+    job.sg_table   = entry->sg_table;
+    job.sg_nums    = entry->sg_nums;
+    job.page_list  = entry->page_list;
+    job.page_nums  = entry->page_nums;
+    job.pin_pages  = entry->pin_pages;
+    job.desc_bytes = entry->desc_bytes;
+    pump_release_job_run(this, &job);
+
+    pump_chain_mm_put(this, entry->chain_mm);
+    kfree(entry);
+}
+
+/**
+ * pump_chain_shrink() - Free stale entries, then the least recently used
+ *                       ones beyond chain_cache_max.
+ * @all:	Free every idle entry.
+ *
+ * Called with this->sem held.  An entry used by the running transfer is
+ * freed when it comes back in pump_buffer_release().
+ */
+static void pump_chain_shrink(struct pump_driver_data* this, bool all)
+{
+    struct pump_chain_entry* entry;
+    struct pump_chain_entry* prev_entry;
+
+    list_for_each_entry_safe_reverse(entry, prev_entry, &this->chain_list, list) {
+        if (entry->in_use)
+            continue;
+        if ((all) || (entry->stale) || (this->chain_nums > this->chain_cache_max))
+            pump_chain_free(this, entry);
+    }
+}
+
+/**
+ * pump_chain_work() - Free the entries the mmu notifier marked stale.
+ */
+static void pump_chain_work(struct work_struct* work)
+{
+    struct pump_driver_data* this = container_of(work, struct pump_driver_data, chain_work);
+
+    mutex_lock(&this->sem);
+    pump_chain_shrink(this, 0);
+    mutex_unlock(&this->sem);
+}
+
+/**
+ * pump_chain_sync_for_cpu() - Hand an outlet entry back to the user.
+ *
+ * A cached outlet buffer is not unmapped, so the cache lines the user is
+ * about to read are invalidated here, and the pages are dirtied after
+ * every transfer as pump_release_job_run() does.
+ */
+static void pump_chain_sync_for_cpu(struct pump_driver_data* this, struct pump_chain_entry* entry)
+{
+    int i;
+
+    if (this->direction != 0)
+        return;
+    dma_sync_sg_for_cpu(this->dev, entry->sg_table.sgl, entry->sg_table.nents, DMA_FROM_DEVICE);
+    for (i = 0; i < entry->page_nums; i++) {
+        if (!PageReserved(entry->page_list[i]))
+            SetPageDirty(entry->page_list[i]);
+    }
+}
+
+/**
+ * pump_chain_put() - Keep the resources of the current transfer in the
+ *                    chain cache instead of releasing them.
+ * returns:	True if they are now owned by the cache.
+ */
+static bool pump_chain_put(struct pump_driver_data* this)
+{
+    struct pump_chain_entry* entry = this->chain_new;
+
+    this->chain_new = NULL;
+    if (entry == NULL)
+        return 0;
+    if ((this->page_list == NULL) || (this->sg_nums == 0) || (list_empty(&this->pump_buf_list)) ||
+        ((entry->chain_mm = pump_chain_mm_get(this)) == NULL)) {
+        kfree(entry);
+        return 0;
+    }
+    INIT_LIST_HEAD(&entry->table_list);
+    list_splice_init(&this->pump_buf_list, &entry->table_list);
+    entry->sg_table   = this->sg_table;
+    entry->sg_nums    = this->sg_nums;
+    entry->page_list  = this->page_list;
+    entry->page_nums  = this->page_nums;
+    entry->pin_pages  = this->pin_pages;
+    entry->desc_bytes = this->pin_desc_bytes;
+    memset(&this->sg_table, 0, sizeof(this->sg_table));
+    this->sg_nums        = 0;
+    this->page_list      = NULL;
+    this->page_nums      = 0;
+    this->pin_pages      = 0;
+    this->pin_desc_bytes = 0;
+    pump_chain_sync_for_cpu(this, entry);
+
+    entry->chain_mm->entry_nums++;
+    spin_lock(&this->chain_lock);
+    list_add(&entry->list, &this->chain_list);
+    spin_unlock(&this->chain_lock);
+    this->chain_nums++;
+    this->chain_bytes += (entry->pin_pages << PAGE_SHIFT) + entry->desc_bytes;
+    pump_chain_shrink(this, 0);
+    return 1;
+}
+
+/**
+ * pump_buffer_release()
+ *
+ * With release_async the caller only waits for dma_unmap_sg() of an
+ * outlet transfer, which invalidates the cache lines the user is about to
+ * read.  Everything else is handed to pump_release_work().
+ */
+static void pump_buffer_release(struct pump_driver_data* this)
+{
+    struct pump_release_job  local_job;
+    struct pump_release_job* job = &local_job;
+    u64                      start_time;
+
+    if (PUMP_DEBUG_CHECK(this,debug_phase))
+        dev_info(this->dev, "pump_buffer_release()\n");
+
+    start_time = get_jiffies_64();
+
+    /*
+     * キャッシュから使ったエントリは解放せずに戻す. 転送中に無効になった
+     * エントリはここで解放する.
+     */
+    if (this->chain_entry != NULL) {
+        struct pump_chain_entry* entry = this->chain_entry;
+        this->chain_entry = NULL;
+        pump_chain_sync_for_cpu(this, entry);
+        entry->in_use = 0;
+        if ((entry->stale) || (this->stop_failed))
+            pump_chain_free(this, entry);
+        pump_usec_add(this, &this->usec_buffer_release, start_time);
+        pump_event_commit(this);
+        return;
+    }
+    if (pump_chain_put(this)) {
+        pump_pin_mm_uncharge(this);
+        pump_usec_add(this, &this->usec_buffer_release, start_time);
+        pump_event_commit(this);
+        return;
+    }
+
+    if ((this->release_async) &&
+        (!this->stop_failed) &&
+        (this->page_list != NULL) &&
+        (atomic_read(&this->release_pending) < PUMP_RELEASE_PENDING_MAX)) {
+        job = kmalloc(sizeof(*job), GFP_KERNEL);
+        if (job == NULL)
+            job = &local_job;
+    }
+    INIT_LIST_HEAD(&job->buf_list);
+    list_splice_init(&this->pump_buf_list, &job->buf_list);
+    job->sg_table  = this->sg_table;
+    job->sg_nums   = this->sg_nums;
+    job->page_list = this->page_list;
+    job->page_nums = this->page_nums;
+    job->pin_pages  = this->pin_pages;
+    job->desc_bytes = this->pin_desc_bytes;
+    /*
+     * pinned_vm はページを手放した後で減らすので、mm の参照ごとジョブに渡す.
+     */
+    job->pin_mm       = this->pin_mm;
+    job->pin_mm_pages = this->pin_mm_pages;
+    if (job->pin_mm != NULL)
+        atomic_inc(&job->pin_mm->mm_count);
+    memset(&this->sg_table, 0, sizeof(this->sg_table));
+    this->sg_nums        = 0;
+    this->page_list      = NULL;
+    this->page_nums      = 0;
+    this->pin_pages      = 0;
+    this->pin_desc_bytes = 0;
+    this->pin_mm         = NULL;
+    this->pin_mm_pages   = 0;
+
+    if (job == &local_job) {
+        pump_release_job_run(this, job);
+    } else {
+        if ((this->direction == 0) && (job->sg_nums != 0)) {
+            dma_unmap_sg(this->dev, job->sg_table.sgl, job->sg_table.nents, DMA_FROM_DEVICE);
+            job->sg_nums = 0;
+        }
+        atomic_inc(&this->release_pending);
+        spin_lock(&this->release_lock);
+        list_add_tail(&job->list, &this->release_list);
+        spin_unlock(&this->release_lock);
+        schedule_work(&this->release_work);
+        this->release_deferred_count++;
+    }
+    if (this->align_buf != NULL) {
+        pump_bounce_release(this, this->align_buf);
+        this->align_buf  = NULL;
+        this->align_head = 0;
+        this->align_tail = 0;
+    }
+    pump_usec_add(this, &this->usec_buffer_release, start_time);
+    pump_event_commit(this);
+}
+
+/**
+ * pump_bypass_regs_private() - Whether the register page maps only this engine.
+ *
+ * The region is claimed with request_mem_region(), so when it starts and
+ * ends on page boundaries no other engine's registers share its pages.
+ * Packed register blocks, as in the reference design, cannot be handed
+ * to user space without giving it the sibling engine too.
+ */
+static bool pump_bypass_regs_private(struct pump_driver_data* this)
+{
+    struct resource* res = this->proc_regs_res;
+    return (res != NULL) &&
+           ((res->start           & ~PAGE_MASK) == 0) &&
+           ((resource_size(res)   & ~PAGE_MASK) == 0);
+}
+
+/**
+ * pump_bypass_enter() - Hand the engine to a user space process.
+ * @file:	File that owns the engine until it is closed.
+ * @bypass:	PUMP_IOCTL_BYPASS_ENTER argument.
+ * returns:	Success or error status.
+ *
+ * Taking this->sem waits for a running transfer; once bypass_file is set
+ * pump_xfer_start_list() refuses every other transfer.
+ */
+static long pump_bypass_enter(struct pump_driver_data* this, struct file* file, struct pump_ioctl_bypass* bypass)
+{
+    struct eventfd_ctx* eventfd;
+    size_t              desc_size = PAGE_ALIGN(bypass->desc_size);
+    long                result    = 0;
+
+    if (!capable(CAP_SYS_RAWIO))
+        return -EPERM;
+    if ((desc_size < PUMP_BYPASS_DESC_HEADER) || (desc_size > PUMP_BYPASS_DESC_MAX))
+        return -EINVAL;
+    if (this->proc_regs_res == NULL)
+        return -ENODEV;
+    if (!pump_bypass_regs_private(this))
+        return -EINVAL;
+    eventfd = eventfd_ctx_fdget(bypass->eventfd);
+    if (IS_ERR(eventfd))
+        return PTR_ERR(eventfd);
+    if (mutex_lock_interruptible(&this->sem)) {
+        eventfd_ctx_put(eventfd);
+        return -ERESTARTSYS;
+    }
+    pump_batch_flush(this, &this->batch_flush_sync_count);
+    if (!this->bypass_enable) {
+        result = -EPERM;
+        goto failed;
+    }
+    if (this->bypass_file != NULL) {
+        result = -EBUSY;
+        goto failed;
+    }
+    this->bypass_desc_ptr = dma_alloc_coherent(this->dev, desc_size, &this->bypass_desc_addr, GFP_KERNEL);
+    if (this->bypass_desc_ptr == NULL) {
+        result = -ENOMEM;
+        goto failed;
+    }
+    memset(this->bypass_desc_ptr, 0, desc_size);
+    this->bypass_desc_size = desc_size;
+    spin_lock_irq(&this->bypass_lock);
+    this->bypass_eventfd   = eventfd;
+    this->bypass_file      = file;
+    spin_unlock_irq(&this->bypass_lock);
+    mutex_unlock(&this->sem);
+
+    bypass->desc_addr   = this->bypass_desc_addr;
+    bypass->regs_size   = resource_size(this->proc_regs_res);
+    bypass->regs_offset = this->proc_regs_res->start & ~PAGE_MASK;
+    dev_info(this->dev, "bypass entered by %s[%d]\n", current->comm, current->pid);
+    return 0;
+
+ failed:
+    mutex_unlock(&this->sem);
+    eventfd_ctx_put(eventfd);
+    return result;
+}
+
+/**
+ * pump_bypass_exit() - Take the engine back when the owner file is closed.
+ *
+ * The file is only released after every mapping of it is gone, so the
+ * descriptor region is no longer visible to user space here.
+ */
+static void pump_bypass_exit(struct pump_driver_data* this)
+{
+    struct eventfd_ctx* eventfd;
+
+    mutex_lock(&this->sem);
+    if (pump_xfer_stop(this) != 0)
+        dev_warn(this->dev, "bypass owner left the pump running\n");
+    spin_lock_irq(&this->bypass_lock);
+    eventfd               = this->bypass_eventfd;
+    this->bypass_eventfd  = NULL;
+    this->bypass_file     = NULL;
+    spin_unlock_irq(&this->bypass_lock);
+    eventfd_ctx_put(eventfd);
+    if (!this->stop_failed)
+        dma_free_coherent(this->dev, this->bypass_desc_size, this->bypass_desc_ptr, this->bypass_desc_addr);
+    this->bypass_desc_ptr = NULL;
+    this->pump_proc_data.status = 0;
+    mutex_unlock(&this->sem);
+}
+
+/**
+ * pump_bypass_complete() - Forward a completion to the bypass owner.
+ */
+static bool pump_bypass_complete(struct pump_driver_data* this)
+{
+    struct pump_bypass_status* record;
+    unsigned long              irq_flags;
+    unsigned int               status;
+
+    spin_lock_irqsave(&this->bypass_lock, irq_flags);
+    if (this->bypass_eventfd == NULL) {
+        spin_unlock_irqrestore(&this->bypass_lock, irq_flags);
+        return 0;
+    }
+    spin_lock(&this->pump_proc_data.irq_lock);
+    status = this->pump_proc_data.status;
+    this->pump_proc_data.status = 0;
+    spin_unlock(&this->pump_proc_data.irq_lock);
+    record = this->bypass_desc_ptr;
+    record->status = status;
+    wmb();
+    record->complete_count++;
+    eventfd_signal(this->bypass_eventfd, 1);
+    this->bypass_irq_count++;
+    spin_unlock_irqrestore(&this->bypass_lock, irq_flags);
+    return 1;
+}
+
+/**
+ * pump_mmap() - Map the registers or the descriptor region for the bypass owner.
+ * @file:	Pointer to the file structure.
+ * @vma:	The mapping, PUMP_BYPASS_MMAP_REGS or PUMP_BYPASS_MMAP_DESC.
+ * returns:	Success or error status.
+ */
+static int pump_mmap(struct file* file, struct vm_area_struct* vma)
+{
+    struct pump_driver_data* this   = pump_file_driver_data(file);
+    unsigned long            offset = vma->vm_pgoff << PAGE_SHIFT;
+    unsigned long            size   = vma->vm_end - vma->vm_start;
+
+    if (this->bypass_file != file)
+        return -EPERM;
+    if (offset == PUMP_BYPASS_MMAP_REGS) {
+        if ((size != PAGE_SIZE) || (!pump_bypass_regs_private(this)))
+            return -EINVAL;
+        vma->vm_flags     |= VM_IO | VM_DONTEXPAND | VM_DONTDUMP;
+        vma->vm_page_prot  = pgprot_noncached(vma->vm_page_prot);
+        return io_remap_pfn_range(vma, vma->vm_start, this->proc_regs_res->start >> PAGE_SHIFT,
+                                  PAGE_SIZE, vma->vm_page_prot);
+    }
+    if (offset == PUMP_BYPASS_MMAP_DESC) {
+        if (size > this->bypass_desc_size)
+            return -EINVAL;
+        vma->vm_pgoff = 0;
+        return dma_mmap_coherent(this->dev, vma, this->bypass_desc_ptr, this->bypass_desc_addr, size);
+    }
+    return -EINVAL;
+}
+
+/**
+ * pump_open() - The is the driver open function.
+ * @inode:	Pointer to the inode structure of this device.
+ * @file:	Pointer to the file structure.
+ * returns:	Success or error status.
+ */
+static int pump_open(struct inode *inode, struct file *file)
+{
+    struct pump_driver_data* driver_data;
+    struct pump_file_data*   file_data;
+    int status = 0;
+
+    driver_data = container_of(inode->i_cdev, struct pump_driver_data, cdev);
+    file_data   = kzalloc(sizeof(*file_data), GFP_KERNEL);
+    if (file_data == NULL)
+        return -ENOMEM;
+    file_data->driver_data = driver_data;
+    file_data->buf_handle  = 0;
+    mutex_init(&file_data->buf_lock);
+    INIT_LIST_HEAD(&file_data->buf_list);
+    INIT_LIST_HEAD(&file_data->prog_list);
+    file->private_data   = file_data;
+    driver_data->is_open = 1;
+    write_seqcount_begin(&driver_data->usec_seq);
+    driver_data->usec_buffer_setup   = 0;
+    driver_data->usec_buffer_release = 0;
+    driver_data->usec_pump_run       = 0;
+    driver_data->usec_table_build    = 0;
+    write_seqcount_end(&driver_data->usec_seq);
+
+    return status;
+}
+
+/**
+ * pump_release() - The is the driver release function.
+ * @inode:	Pointer to the inode structure of this device.
+ * @file:	Pointer to the file structure.
+ * returns:	Success.
+ */
+static int pump_release(struct inode *inode, struct file *file)
+{
+    struct pump_file_data*   file_data = file->private_data;
+    struct pump_driver_data* this      = file_data->driver_data;
+    struct pump_buf*         buf;
+    struct pump_buf*         next_buf;
+    struct pump_prog*        prog;
+    struct pump_prog*        next_prog;
+
+    list_for_each_entry_safe(prog, next_prog, &file_data->prog_list, list) {
+        list_del(&prog->list);
+        pump_prog_free(this, prog);
+    }
+    /*
+     * PUMPが止まらなかった時は、DMAが使っているかもしれない登録済みの
+     * バッファを解放せずに手放す.
+     */
+    list_for_each_entry_safe(buf, next_buf, &file_data->buf_list, list) {
+        list_del(&buf->list);
+        if (ACCESS_ONCE(this->stop_failed))
+            dev_warn(this->dev, "pump is not stopped, leaking registered buffer %u\n", buf->handle);
+        else
+            pump_buf_release(buf);
+    }
+    if (file_data->session_file != NULL)
+        fput(file_data->session_file);
+    mutex_lock(&this->sem);
+    if (this->batch_file == file_data)
+        pump_batch_flush(this, &this->batch_flush_sync_count);
+    mutex_unlock(&this->sem);
+    if (this->bypass_file == file)
+        pump_bypass_exit(this);
+    kfree(file_data);
+
+    this->is_open = 0;
+
+    return 0;
+}
+
+/**
+ *
+ */
+static void pump_done_work(struct pump_driver_data* this)
+{
+    if (pump_bypass_complete(this))
+        return;
+    wake_up_interruptible(&this->wait_queue);
+}
+
+/**
+ * pump_xfer_deadline_usec() - Time allowed for a transfer of @xfer_size bytes.
+ *
+ * deadline_min_usec plus the time the transfer takes at min_mb_per_sec
+ * (1MB/sec is 1byte/usec), but never more than timeout_msec.  With
+ * min_mb_per_sec=0 only timeout_msec applies.
+ */
+static u64  pump_xfer_deadline_usec(struct pump_driver_data* this, size_t xfer_size)
+{
+    u64 timeout_usec  = (u64)this->timeout_msec * USEC_PER_MSEC;
+    u64 deadline_usec;
+
+    if (this->min_mb_per_sec == 0)
+        return timeout_usec;
+    deadline_usec = this->deadline_min_usec + div_u64(xfer_size, this->min_mb_per_sec);
+    return min(deadline_usec, timeout_usec);
+}
+
+/**
+ * pump_deadline_timer() - The transfer ran past its deadline.
+ *
+ * Only wakes up the waiter; pump_xfer_wait() stops the pump in process
+ * context.
+ */
+static enum hrtimer_restart pump_deadline_timer(struct hrtimer* timer)
+{
+    struct pump_driver_data* this = container_of(timer, struct pump_driver_data, deadline_timer);
+    this->deadline_expired = 1;
+    wake_up_interruptible(&this->wait_queue);
+    return HRTIMER_NORESTART;
+}
+
+/**
+ * pump_xfer_start() - Start the pump with the operation code tables built by
+ *                     pump_buffer_setup().
+ */
+static int  pump_xfer_start_list(struct pump_driver_data* this, struct list_head* buf_list)
+{
+    u64 deadline_usec = pump_xfer_deadline_usec(this, this->event.bytes);
+
+    if (this->bypass_file != NULL) {
+        this->event.result = -EBUSY;
+        return this->event.result;
+    }
+    if (pump_xfer_recover(this) != 0) {
+        this->event.result = -EBUSY;
+        return this->event.result;
+    }
+    this->xfer_list        = buf_list;
+    this->deadline_expired = 0;
+    this->xfer_start_time  = get_jiffies_64();
+    this->event_mark       = ktime_get();
+    this->event.result     = pump_proc_start(&this->pump_proc_data, buf_list);
+    if (this->event.result == 0)
+        hrtimer_start(&this->deadline_timer, ns_to_ktime(deadline_usec * NSEC_PER_USEC), HRTIMER_MODE_REL);
+    return this->event.result;
+}
+static int  pump_xfer_start(struct pump_driver_data* this)
+{
+    if (this->chain_entry != NULL) {
+        pump_proc_prog_prepare(&this->pump_proc_data);
+        return pump_xfer_start_list(this, &this->chain_entry->table_list);
+    }
+    if (this->chain_new != NULL)
+        pump_proc_prog_prepare(&this->pump_proc_data);
+    return pump_xfer_start_list(this, &this->pump_buf_list);
+}
+
+/**
+ * pump_xfer_wait() - Wait for the pump started by pump_xfer_start().
+ */
+static int  pump_xfer_wait(struct pump_driver_data* this)
+{
+    ktime_t now_time;
+    ktime_t done_time;
+
+    wait_event_interruptible(
+        this->wait_queue                                              , /* wait_queue_head_t wq */
+        ((this->pump_proc_data.status != 0) || this->deadline_expired)  /* bool condition       */
+    );
+    hrtimer_cancel(&this->deadline_timer);
+    /*
+     * 完了を検出した時刻で、ハードウェアの実行時間とウェイクアップの時間を分ける.
+     */
+    now_time  = ktime_get();
+    done_time = this->pump_proc_data.done_time;
+    if (ktime_to_ns(done_time) >= ktime_to_ns(this->event_mark)) {
+        this->event.usec_run    = (u32)ktime_us_delta(done_time, this->event_mark);
+        this->event.usec_wakeup = (u32)ktime_us_delta(now_time , done_time);
+    } else {
+        this->event.usec_run    = (u32)ktime_us_delta(now_time , this->event_mark);
+    }
+    this->event_mark = now_time;
+    this->event.status = this->pump_proc_data.status;
+    this->event.cpu    = this->pump_proc_data.last_complete_cpu;
+    /*
+     * 期限切れまたはシグナルで起こされた場合はPUMPを止めて、どこまで転送したかを記録する.
+     */
+    if (this->pump_proc_data.status == 0) {
+        int stop_status = pump_xfer_stop(this);
+        if (stop_status == 0)
+            this->event.stop_bytes = pump_proc_xfer_position(&this->pump_proc_data, this->xfer_list);
+        if (pump_align_finish(this, this->event.stop_bytes) != 0)
+            this->event.stop_bytes = 0;
+        if (this->deadline_expired) {
+            this->timeout_count++;
+            dev_warn_ratelimited(this->dev, "transfer timed out after %u usec, stopped at %u of %u bytes\n",
+                                 this->event.usec_run, this->event.stop_bytes, this->event.bytes);
+            this->event.result = -ETIMEDOUT;
+        } else {
+            this->event.result = -EINTR;
+        }
+        if (stop_status != 0)
+            this->event.result = stop_status;
+        return this->event.result;
+    }
+    pump_usec_add(this, &this->usec_pump_run, this->xfer_start_time);
+    if (pump_align_finish(this, this->align_size) != 0) {
+        this->event.result = -EFAULT;
+        return -EFAULT;
+    }
+    if (0) {
+        dev_info(this->dev, "STAT=%08X\n", this->pump_proc_data.status);
+        dev_info(this->dev, "CORE=%08X,%08X,%08X\n", 
+                 regs_read(this->core_regs_addr+ 0),
+                 regs_read(this->core_regs_addr+ 8),
+                 regs_read(this->core_regs_addr+12));
+        dev_info(this->dev, "PROC=%08X,%08X,%08X\n", 
+                 regs_read(this->proc_regs_addr+ 0),
+                 regs_read(this->proc_regs_addr+ 8),
+                 regs_read(this->proc_regs_addr+12));
+    }
+    return 0;
+}
+
+/**
+ * pump_xfer_result() - Number of bytes to report for a transfer that ended with @status.
+ *
+ * An interrupted transfer reports the bytes that were done before the
+ * pump was stopped, so that the caller can resubmit only the remainder.
+ */
+static ssize_t pump_xfer_result(struct pump_driver_data* this, int status, size_t xfer_size)
+{
+    if (status == 0)
+        return xfer_size;
+    if ((status == -EINTR) && (this->event.stop_bytes > 0))
+        return this->event.stop_bytes;
+    return status;
+}
+
+/**
+ * pump_bounce_xfer() - Transfer through a preallocated bounce buffer.
+ * @this:	Pointer to the driver data.
+ * @buff:	Pointer to the user buffer.
+ * @xfer_size:	The number of bytes, at most PUMP_BOUNCE_SIZE.
+ * returns:	Success, error status, or -ENOBUFS when no bounce buffer is free.
+ *
+ * 小さな転送ではページのピン留めや sg_table やオペレーションコード表を
+ * 作るよりも、コピーした方が速い.
+ */
+static int  pump_bounce_xfer(
+    struct pump_driver_data* this, 
+    char __user*             buff, 
+    size_t                   xfer_size, 
+    bool                     xfer_first, 
+    bool                     xfer_last
+)
+{
+    struct pump_proc_bounce* bounce;
+    int                      status;
+    u64                      start_time;
+
+    bounce = pump_proc_bounce_get(&this->pump_proc_data);
+    if (bounce == NULL)
+        return -ENOBUFS;
+
+    start_time = get_jiffies_64();
+    pump_event_begin(this, xfer_size);
+    if ((this->direction) && (copy_from_user(bounce->buf_ptr, buff, xfer_size) != 0)) {
+        status = -EFAULT;
+        goto failed;
+    }
+    this->event.usec_pin = pump_evlog_lap(&this->event_mark);
+    status = pump_proc_bounce_prepare(
+                 &this->pump_proc_data, /* struct pump_proc_data*   this       */
+                 bounce               , /* struct pump_proc_bounce* bounce     */
+                 xfer_size            , /* size_t                   xfer_size  */
+                 xfer_first           , /* bool                     xfer_first */
+                 xfer_last            , /* bool                     xfer_last  */
+                 PUMP_XFER_AXI_MODE     /* unsigned int             xfer_mode  */
+             );
+    if (status != 0)
+        goto failed;
+    this->event.usec_build = pump_evlog_lap(&this->event_mark);
+    this->event.sg_nums    = 1;
+    this->event.table_nums = 1;
+    pump_usec_add(this, &this->usec_buffer_setup, start_time);
+
+    status = pump_xfer_start_list(this, &bounce->table_list);
+    if (status == 0)
+        status = pump_xfer_wait(this);
+
+    start_time = get_jiffies_64();
+    pump_proc_bounce_finish(&this->pump_proc_data, bounce);
+    if ((status == 0) && (this->direction == 0) && (copy_to_user(buff, bounce->buf_ptr, xfer_size) != 0))
+        status = -EFAULT;
+    pump_usec_add(this, &this->usec_buffer_release, start_time);
+
+ failed:
+    this->event.result = status;
+    pump_event_commit(this);
+    pump_bounce_release(this, bounce);
+    return status;
+}
+
+/**
+ * pump_batch_flush() - Transfer the staged writes as one chain.
+ * @flush_count:	Counter of the reason for the flush.
+ *
+ * Called with this->sem held.  Every staged write gets its own XFER
+ * operation code, so the engine sees the same message boundaries as with
+ * one write() per transfer.  Only one file stages at a time; an error is
+ * kept in the batch_error of that file (batch_file) and returned by its
+ * next write(), fsync() or close(), not by another opener of the device.
+ */
+static void pump_batch_flush(struct pump_driver_data* this, unsigned long* flush_count)
+{
+    struct scatterlist* sg;
+    unsigned int        i;
+    size_t              offset = 0;
+    int                 status;
+    u64                 start_time;
+    LIST_HEAD(buf_list);
+
+    if (this->batch_buf == NULL)
+        return;
+    hrtimer_cancel(&this->batch_timer);
+    if (this->batch_msg_nums == 0)
+        goto done;
+
+    start_time = get_jiffies_64();
+    pump_event_begin(this, this->batch_size);
+    pump_proc_bounce_sync_for_device(&this->pump_proc_data, this->batch_buf, 0, this->batch_size);
+    sg_init_table(this->batch_sg, this->batch_msg_nums);
+    for_each_sg(this->batch_sg, sg, this->batch_msg_nums, i) {
+        sg_dma_address(sg) = this->batch_buf->buf_addr + offset;
+        sg_dma_len(sg)     = this->batch_msg_size[i];
+        offset += this->batch_msg_size[i];
+    }
+    status = pump_proc_add_buf_list_from_sg(
+        &this->pump_proc_data, /* struct pump_proc_data*  this       */
+        &buf_list            , /* struct list_head*       buf_list   */
+        this->batch_sg       , /* struct scatterlist*     sg_list    */
+        this->batch_msg_nums , /* unsigned int            sg_nums    */
+        this->batch_first    , /* bool                    xfer_first */
+        this->batch_last     , /* bool                    xfer_last  */
+        PUMP_XFER_AXI_MODE     /* unsigned int            xfer_mode  */
+    );
+    this->event.usec_build = pump_evlog_lap(&this->event_mark);
+    this->event.sg_nums    = this->batch_msg_nums;
+    this->event.table_nums = pump_proc_table_nums(&buf_list);
+    pump_usec_add(this, &this->usec_buffer_setup, start_time);
+    if (status == 0)
+        status = pump_xfer_start_list(this, &buf_list);
+    if (status == 0)
+        status = pump_xfer_wait(this);
+
+    start_time = get_jiffies_64();
+    pump_clear_buf_list(this, &buf_list);
+    pump_usec_add(this, &this->usec_buffer_release, start_time);
+    this->event.result = status;
+    pump_event_commit(this);
+
+    if ((status != 0) && (this->batch_file != NULL) && (this->batch_file->batch_error == 0))
+        this->batch_file->batch_error = status;
+    (*flush_count)++;
+    this->batch_msg_hist [min(fls(this->batch_msg_nums) - 1, PUMP_BATCH_HIST_NUMS - 1)]++;
+    this->batch_byte_hist[min(fls(this->batch_size / PUMP_BATCH_HIST_BYTES), PUMP_BATCH_HIST_NUMS - 1)]++;
+
+ done:
+    pump_bounce_release(this, this->batch_buf);
+    this->batch_buf      = NULL;
+    this->batch_file     = NULL;
+    this->batch_size     = 0;
+    this->batch_msg_nums = 0;
+}
+
+/**
+ * pump_batch_write() - Stage one small write.
+ * returns:	-ENOBUFS if no staging buffer is free and the write must be
+ *		transferred by itself.
+ *
+ * The staged writes are flushed when they reach batch_threshold, with the
+ * write that ends the stream, or batch_delay_usec after the first one.
+ */
+static int  pump_batch_write(
+    struct pump_driver_data* this, 
+    struct pump_file_data*   file_data, 
+    const char __user*       buff, 
+    size_t                   xfer_size, 
+    bool                     xfer_first, 
+    bool                     xfer_last
+)
+{
+    if ((this->batch_buf != NULL) && (this->batch_msg_nums > 0) && (this->batch_file != file_data))
+        pump_batch_flush(this, &this->batch_flush_sync_count);
+    if ((this->batch_buf != NULL) &&
+        ((this->batch_size + xfer_size > this->batch_buf->buf_size) ||
+         (this->batch_msg_nums >= PUMP_BATCH_MSG_MAX)))
+        pump_batch_flush(this, &this->batch_flush_size_count);
+
+    if (this->batch_buf == NULL) {
+        this->batch_buf = pump_proc_bounce_get(&this->pump_proc_data);
+        if (this->batch_buf == NULL)
+            return -ENOBUFS;
+    }
+    if (copy_from_user((char*)this->batch_buf->buf_ptr + this->batch_size, buff, xfer_size) != 0) {
+        if (this->batch_msg_nums == 0)
+            pump_batch_flush(this, &this->batch_flush_sync_count);
+        return -EFAULT;
+    }
+    if (this->batch_msg_nums == 0) {
+        this->batch_first = xfer_first;
+        this->batch_file  = file_data;
+    }
+    this->batch_last = xfer_last;
+    this->batch_msg_size[this->batch_msg_nums++] = xfer_size;
+    this->batch_size += xfer_size;
+    this->batch_msg_count++;
+
+    if ((xfer_last) || (this->batch_size >= this->batch_threshold))
+        pump_batch_flush(this, &this->batch_flush_size_count);
+    else if (this->batch_msg_nums == 1)
+        hrtimer_start(&this->batch_timer, ns_to_ktime((u64)this->batch_delay_usec * NSEC_PER_USEC), HRTIMER_MODE_REL);
+    return 0;
+}
+
+/**
+ * pump_batch_timer() - batch_delay_usec passed since the first staged write.
+ */
+static enum hrtimer_restart pump_batch_timer(struct hrtimer* timer)
+{
+    struct pump_driver_data* this = container_of(timer, struct pump_driver_data, batch_timer);
+    schedule_work(&this->batch_work);
+    return HRTIMER_NORESTART;
+}
+
+static void pump_batch_work(struct work_struct* work)
+{
+    struct pump_driver_data* this = container_of(work, struct pump_driver_data, batch_work);
+
+    mutex_lock(&this->sem);
+    pump_batch_flush(this, &this->batch_flush_timer_count);
+    mutex_unlock(&this->sem);
+}
+
+/**
+ * pump_batch_sync() - Flush the staged writes and collect the error of the file.
+ */
+static int  pump_batch_sync(struct pump_driver_data* this, struct pump_file_data* file_data)
+{
+    int result;
+
+    pump_batch_flush(this, &this->batch_flush_sync_count);
+    result = file_data->batch_error;
+    file_data->batch_error = 0;
+    return result;
+}
+
+/**
+ * pump_read() - The is the driver read function.
+ * @file:	Pointer to the file structure.
+ * @buff:	Pointer to the user buffer.
+ * @count:	The number of bytes to be written.
+ * @ppos:	Pointer to the offset value
+ * returns:	Success or error status.
+ */
+static ssize_t pump_read(struct file* file, char __user* buff, size_t count, loff_t* ppos)
+{
+    struct pump_driver_data* this       = pump_file_driver_data(file);
+    int                      result     = 0;
+    int                      status     = 0;
+    size_t                   xfer_size  = 0;
+    bool                     xfer_first = (*ppos == 0) ? 1 : 0;
+    bool                     xfer_last;
+    /*
+     *
+     */
+    if (mutex_lock_interruptible(&this->sem))
+        return -ERESTARTSYS;
+    /*
+     * limit_sizeを越える読み出しは、EOF(result=0)を返す.
+     */
+    if (*ppos >= this->limit_size) {
+        result = 0;
+        goto return_unlock;
+    }
+    /*
+     *
+     */
+    if (*ppos + count >= this->limit_size) {
+        xfer_last = 1;
+        xfer_size = this->limit_size - *ppos;
+    }
+    else {
+        xfer_last = 0;
+        xfer_size = count;
+    }
+    /*
+     * bounce_threshold 以下の転送はバウンスバッファを使う.
+     */
+    if ((xfer_size > 0) && (xfer_size <= this->bounce_threshold)) {
+        status = pump_bounce_xfer(this, (char __user*)buff, xfer_size, xfer_first, xfer_last);
+        if (status != -ENOBUFS) {
+            if (status != 0) {
+                result = status;
+            } else {
+                *ppos += xfer_size;
+                result = xfer_size;
+            }
+            goto return_unlock;
+        }
+    }
+    /*
+     *
+     */
+    status = pump_buffer_setup(
+                 this        , /* struct pump_driver_data* this       */
+                 buff        , /* char __user*             buff       */
+                 &xfer_size  , /* size_t*                  xfer_size  */
+                 xfer_first  , /* bool                     xfer_first */
+                 xfer_last     /* bool                     xfer_last  */
+    );
+    if (status != 0) {
+        result = status;
+        goto return_unlock;
+    }
+    /*
+     *
+     */
+    status = pump_xfer_start(this);
+    if (status != 0) {
+        result = status;
+        goto return_release;
+    }
+    status = pump_xfer_wait(this);
+    result = pump_xfer_result(this, status, xfer_size);
+    if (result > 0)
+        *ppos += result;
+    /*
+     *
+     */
+ return_release:
+    pump_buffer_release(this);
+ return_unlock:
+    mutex_unlock(&this->sem);
+    return result;
+}
+
+/**
+ * pump_write() - The is the driver write function.
+ * @file:	Pointer to the file structure.
+ * @buff:	Pointer to the user buffer.
+ * @count:	The number of bytes to be written.
+ * @ppos:	Pointer to the offset value
+ * returns:	Success or error status.
+ */
+static ssize_t pump_write(struct file* file, const char __user* buff, size_t count, loff_t* ppos)
+{
+    struct pump_file_data*   file_data  = file->private_data;
+    struct pump_driver_data* this       = file_data->driver_data;
+    int                      result     = 0;
+    int                      status     = 0;
+    size_t                   xfer_size  = count;
+    bool                     xfer_first = (*ppos == 0) ? 1 : 0;
+    bool                     xfer_last;
+    /*
+     *
+     */
+    if (mutex_lock_interruptible(&this->sem))
+        return -ERESTARTSYS;
+    /*
+     * まとめて転送した書き込みのエラーは、次の書き込みで返す.
+     */
+    if (file_data->batch_error != 0) {
+        result = file_data->batch_error;
+        file_data->batch_error = 0;
+        goto return_unlock;
+    }
+    /*
+     * limit_sizeを越える書き込みは、書いたフリをする.
+     */
+    if (*ppos >= this->limit_size) {
+        *ppos += count;
+        result = count;
+        goto return_unlock;
+    }
+    /*
+     *
+     */
+    if (*ppos + count >= this->limit_size) {
+        xfer_last = 1;
+        xfer_size = this->limit_size - *ppos;
+    }
+    else {
+        xfer_last = 0;
+        xfer_size = count;
+    }
+    /*
+     * batch_enable の時、batch_threshold 未満の書き込みは溜めておいて
+     * まとめて転送する. それ以外の書き込みの前には溜めた分を転送して、
+     * 順番を保つ.
+     */
+    if ((this->batch_enable) && (xfer_size > 0) && (xfer_size < this->batch_threshold)) {
+        status = pump_batch_write(this, file_data, buff, xfer_size, xfer_first, xfer_last);
+        if (status != -ENOBUFS) {
+            if (status != 0) {
+                result = status;
+            } else {
+                *ppos += xfer_size;
+                result = xfer_size;
+            }
+            goto return_unlock;
+        }
+    }
+    pump_batch_flush(this, &this->batch_flush_sync_count);
+    /*
+     * bounce_threshold 以下の転送はバウンスバッファを使う.
+     */
+    if ((xfer_size > 0) && (xfer_size <= this->bounce_threshold)) {
+        status = pump_bounce_xfer(this, (char __user*)buff, xfer_size, xfer_first, xfer_last);
+        if (status != -ENOBUFS) {
+            if (status != 0) {
+                result = status;
+            } else {
+                *ppos += xfer_size;
+                result = xfer_size;
+            }
+            goto return_unlock;
+        }
+    }
+    /*
+     *
+     */
+    status = pump_buffer_setup(
+                 this        , /* struct pump_driver_data* this       */
+                 buff        , /* char __user*             buff       */
+                 &xfer_size  , /* size_t*                  xfer_size  */
+                 xfer_first  , /* bool                     xfer_first */
+                 xfer_last     /* bool                     xfer_last  */
+    );
+    if (status != 0) {
+        result = status;
+        goto return_unlock;
+    }
+    /*
+     *
+     */
+    status = pump_xfer_start(this);
+    if (status != 0) {
+        result = status;
+        goto return_release;
+    }
+    status = pump_xfer_wait(this);
+    result = pump_xfer_result(this, status, xfer_size);
+    if (result > 0)
+        *ppos += result;
+    /*
+     *
+     */
+ return_release:
+    pump_buffer_release(this);
+ return_unlock:
+    mutex_unlock(&this->sem);
+    return result;
+}
+
+/**
+ * pump_xfer_iov() - Transfer a vector as one operation code chain.
+ * @file:	Pointer to the file structure.
+ * @iov:	Segments of the user buffer.
+ * @nr_segs:	The number of segments.
+ * @ppos:	Pointer to the offset value
+ * returns:	Success or error status.
+ *
+ * xfer_first goes on the first segment and xfer_last on the final one, and
+ * the engine is started and waited for once.  Vectors that cannot be sent
+ * as one chain (single or small segments, crossing limit_size, over the pin
+ * budget) are transferred segment by segment like the VFS does.
+ */
+static ssize_t pump_xfer_iov(struct file* file, const struct iovec* iov, unsigned long nr_segs, loff_t* ppos)
+{
+    struct pump_driver_data* this       = pump_file_driver_data(file);
+    size_t                   xfer_size  = iov_length(iov, nr_segs);
+    ssize_t                  result     = 0;
+    int                      status;
+    unsigned long            seg;
+
+    if ((nr_segs > 1) && (xfer_size > this->bounce_threshold)) {
+        if (mutex_lock_interruptible(&this->sem))
+            return -ERESTARTSYS;
+        pump_batch_flush(this, &this->batch_flush_sync_count);
+        if (*ppos + xfer_size <= this->limit_size) {
+            bool xfer_first = (*ppos == 0) ? 1 : 0;
+            bool xfer_last  = (*ppos + xfer_size == this->limit_size) ? 1 : 0;
+            status = pump_buffer_setup_iov(this, iov, nr_segs, xfer_size, xfer_first, xfer_last);
+            if (status != -ENOBUFS) {
+                if (status != 0) {
+                    result = status;
+                    goto return_unlock;
+                }
+                status = pump_xfer_start(this);
+                if (status == 0)
+                    status = pump_xfer_wait(this);
+                result = pump_xfer_result(this, status, xfer_size);
+                if (result > 0)
+                    *ppos += result;
+                pump_buffer_release(this);
+                goto return_unlock;
+            }
+        }
+        mutex_unlock(&this->sem);
+    }
+    for (seg = 0; seg < nr_segs; seg++) {
+        ssize_t size = (this->direction) ?
+                       pump_write(file, iov[seg].iov_base, iov[seg].iov_len, ppos) :
+                       pump_read (file, iov[seg].iov_base, iov[seg].iov_len, ppos) ;
+        if (size < 0) {
+            if (result == 0)
+                result = size;
+            break;
+        }
+        result += size;
+        if (size < iov[seg].iov_len)
+            break;
+    }
+    return result;
+
+ return_unlock:
+    mutex_unlock(&this->sem);
+    return result;
+}
+
+/**
+ * pump_aio_read() - readv() of the outlet device.
+ */
+static ssize_t pump_aio_read(struct kiocb* iocb, const struct iovec* iov, unsigned long nr_segs, loff_t pos)
+{
+    ssize_t result = pump_xfer_iov(iocb->ki_filp, iov, nr_segs, &pos);
+    iocb->ki_pos = pos;
+    return result;
+}
+
+/**
+ * pump_aio_write() - writev() of the intake device.
+ */
+static ssize_t pump_aio_write(struct kiocb* iocb, const struct iovec* iov, unsigned long nr_segs, loff_t pos)
+{
+    ssize_t result = pump_xfer_iov(iocb->ki_filp, iov, nr_segs, &pos);
+    iocb->ki_pos = pos;
+    return result;
+}
+
+/**
+ * pump_fsync() - Transfer the writes staged by batch_enable.
+ */
+static int pump_fsync(struct file* file, loff_t start, loff_t end, int datasync)
+{
+    struct pump_driver_data* this = pump_file_driver_data(file);
+    int                      result;
+
+    if (mutex_lock_interruptible(&this->sem))
+        return -ERESTARTSYS;
+    result = pump_batch_sync(this, file->private_data);
+    mutex_unlock(&this->sem);
+    return result;
+}
+
+/**
+ * pump_flush() - Transfer the staged writes when a file descriptor is closed.
+ */
+static int pump_flush(struct file* file, fl_owner_t id)
+{
+    struct pump_driver_data* this = pump_file_driver_data(file);
+    int                      result;
+
+    mutex_lock(&this->sem);
+    result = pump_batch_sync(this, file->private_data);
+    mutex_unlock(&this->sem);
+    return result;
+}
+
+/**
+ * pump_find_buf() - Look up a registered buffer of the file.
+ */
+static struct pump_buf* pump_find_buf(struct pump_file_data* file_data, u32 handle)
+{
+    struct pump_buf* buf;
+    list_for_each_entry(buf, &file_data->buf_list, list) {
+        if (buf->handle == handle)
+            return buf;
+    }
+    return NULL;
+}
+
+/**
+ * pump_buf_xfer() - Transfer a range of a registered buffer.
+ * @file_data:	Pointer to the file structure.
+ * @xfer:	Handle, range and framing of the transfer.
+ * returns:	Number of bytes transferred or error status.
+ */
+static long pump_buf_xfer(struct pump_file_data* file_data, struct pump_ioctl_buf_xfer* xfer)
+{
+    struct pump_driver_data* this = file_data->driver_data;
+    struct pump_buf*         buf;
+    struct sg_table          sg_table;
+    long                     result;
+    int                      status;
+    u64                      start_time;
+
+    if (mutex_lock_interruptible(&file_data->buf_lock))
+        return -ERESTARTSYS;
+
+    buf = pump_find_buf(file_data, xfer->handle);
+    if (buf == NULL) {
+        result = -ENOENT;
+        goto return_unlock_buf;
+    }
+    /*
+     * 転送したバイト数は ioctl の戻り値(int)で返すので INT_MAX を越えられない.
+     */
+    if (xfer->length > INT_MAX) {
+        result = -EINVAL;
+        goto return_unlock_buf;
+    }
+    status = pump_buf_clip_sg(buf, xfer->offset, xfer->length, &sg_table);
+    if (status != 0) {
+        result = status;
+        goto return_unlock_buf;
+    }
+    if (mutex_lock_interruptible(&this->sem)) {
+        result = -ERESTARTSYS;
+        goto return_free_sg;
+    }
+    pump_batch_flush(this, &this->batch_flush_sync_count);
+    /*
+     * 登録済みのバッファはピン留めもマップも済んでいるので、
+     * オペレーションコードの表を作るだけ.
+     */
+    start_time = get_jiffies_64();
+    pump_event_begin(this, xfer->length);
+    status = pump_proc_add_buf_list_from_sg(
+        &this->pump_proc_data,                      /* struct pump_proc_data*  this       */
+        &this->pump_buf_list ,                      /* struct list_head*       buf_list   */
+        sg_table.sgl         ,                      /* struct scatterlist*     sg_list    */
+        sg_table.nents       ,                      /* unsigned int            sg_nums    */
+        (xfer->flags & PUMP_XFER_FIRST) ? 1 : 0,    /* bool                    xfer_first */
+        (xfer->flags & PUMP_XFER_LAST ) ? 1 : 0,    /* bool                    xfer_last  */
+        PUMP_XFER_AXI_MODE                          /* unsigned int            xfer_mode  */
+    );
+    pump_usec_add(this, &this->usec_buffer_setup, start_time);
+    this->event.usec_build = pump_evlog_lap(&this->event_mark);
+    this->event.sg_nums    = sg_table.nents;
+    this->event.table_nums = pump_proc_table_nums(&this->pump_buf_list);
+    if (status != 0) {
+        this->event.result = status;
+        result = status;
+        goto return_clear;
+    }
+    pump_buf_sync_for_device(buf, xfer->offset, xfer->length);
+    status = pump_xfer_start(this);
+    if (status == 0)
+        status = pump_xfer_wait(this);
+    pump_buf_sync_for_cpu(buf, xfer->offset, xfer->length);
+    result = pump_xfer_result(this, status, xfer->length);
+
+ return_clear:
+    pump_clear_buf_list(this, &this->pump_buf_list);
+    pump_event_commit(this);
+    mutex_unlock(&this->sem);
+ return_free_sg:
+    pump_buf_free_clip_sg(&sg_table);
+ return_unlock_buf:
+    mutex_unlock(&file_data->buf_lock);
+    return result;
+}
+
+/**
+ * pump_prog_load() - Check a user program and compile it.
+ * @file_data:	Pointer to the file structure.
+ * @load:	PUMP_IOCTL_PROG_LOAD argument.
+ * returns:	Success or error status.
+ *
+ * Only ranges of registered buffers of this file are accepted, so the
+ * chain can never reach memory the caller does not own.  LINK and NONE
+ * are only ever placed by the driver.
+ */
+static long pump_prog_load(struct pump_file_data* file_data, struct pump_ioctl_prog_load* load)
+{
+    struct pump_driver_data*    this = file_data->driver_data;
+    struct pump_ioctl_buf_xfer* ops;
+    struct pump_prog*           prog;
+    long                        result = 0;
+    unsigned int                i;
+    unsigned int                j;
+
+    if ((load->op_nums == 0) || (load->op_nums > PUMP_PROG_OPS_MAX))
+        return -EINVAL;
+    ops = kmalloc(load->op_nums * sizeof(*ops), GFP_KERNEL);
+    if (ops == NULL)
+        return -ENOMEM;
+    if (copy_from_user(ops, (void __user*)(unsigned long)load->ops, load->op_nums * sizeof(*ops))) {
+        kfree(ops);
+        return -EFAULT;
+    }
+    prog = kzalloc(sizeof(*prog) + load->op_nums * sizeof(struct pump_buf*), GFP_KERNEL);
+    if (prog == NULL) {
+        kfree(ops);
+        return -ENOMEM;
+    }
+    INIT_LIST_HEAD(&prog->table_list);
+
+    if (mutex_lock_interruptible(&file_data->buf_lock)) {
+        result = -ERESTARTSYS;
+        goto return_free;
+    }
+    if (mutex_lock_interruptible(&this->sem)) {
+        result = -ERESTARTSYS;
+        goto return_unlock_buf;
+    }
+    for (i = 0; i < load->op_nums; i++) {
+        struct pump_buf* buf;
+        struct sg_table  sg_table;
+        if ((ops[i].flags & ~(PUMP_XFER_FIRST | PUMP_XFER_LAST)) ||
+            (ops[i].length == 0) || (ops[i].length > INT_MAX - prog->xfer_size)) {
+            result = -EINVAL;
+            goto return_unlock;
+        }
+        buf = pump_find_buf(file_data, ops[i].handle);
+        if (buf == NULL) {
+            result = -ENOENT;
+            goto return_unlock;
+        }
+        result = pump_buf_clip_sg(buf, ops[i].offset, ops[i].length, &sg_table);
+        if (result != 0)
+            goto return_unlock;
+        result = pump_proc_prog_add_sg(
+            &this->pump_proc_data,                      /* struct pump_proc_data*  this       */
+            &prog->table_list    ,                      /* struct list_head*       prog_list  */
+            sg_table.sgl         ,                      /* struct scatterlist*     sg_list    */
+            sg_table.nents       ,                      /* unsigned int            sg_nums    */
+            (ops[i].flags & PUMP_XFER_FIRST) ? 1 : 0,   /* bool                    xfer_first */
+            (ops[i].flags & PUMP_XFER_LAST ) ? 1 : 0,   /* bool                    xfer_last  */
+            PUMP_XFER_AXI_MODE                          /* unsigned int            xfer_mode  */
+        );
+        pump_buf_free_clip_sg(&sg_table);
+        if (result != 0)
+            goto return_unlock;
+        prog->xfer_size += ops[i].length;
+        for (j = 0; j < prog->buf_nums; j++) {
+            if (prog->buf[j] == buf)
+                break;
+        }
+        if (j == prog->buf_nums)
+            prog->buf[prog->buf_nums++] = buf;
+    }
+    for (j = 0; j < prog->buf_nums; j++)
+        prog->buf[j]->prog_users++;
+    do {
+        prog->handle = ++file_data->prog_handle;
+    } while ((prog->handle == 0) || (pump_find_prog(file_data, prog->handle) != NULL));
+    list_add_tail(&prog->list, &file_data->prog_list);
+    load->handle = prog->handle;
+
+ return_unlock:
+    mutex_unlock(&this->sem);
+ return_unlock_buf:
+    mutex_unlock(&file_data->buf_lock);
+ return_free:
+    if (result != 0) {
+        pump_proc_clear_buf_list(&this->pump_proc_data, &prog->table_list);
+        kfree(prog);
+    }
+    kfree(ops);
+    return result;
+}
+
+/**
+ * pump_prog_run() - Run a compiled program as one transfer.
+ * @file_data:	Pointer to the file structure.
+ * @handle:	Handle of the program.
+ * returns:	Number of bytes transferred or error status.
+ */
+static long pump_prog_run(struct pump_file_data* file_data, u32 handle)
+{
+    struct pump_driver_data* this = file_data->driver_data;
+    struct pump_prog*        prog;
+    long                     result;
+    int                      status;
+    unsigned int             i;
+
+    if (mutex_lock_interruptible(&file_data->buf_lock))
+        return -ERESTARTSYS;
+    prog = pump_find_prog(file_data, handle);
+    if (prog == NULL) {
+        result = -ENOENT;
+        goto return_unlock_buf;
+    }
+    if (mutex_lock_interruptible(&this->sem)) {
+        result = -ERESTARTSYS;
+        goto return_unlock_buf;
+    }
+    pump_batch_flush(this, &this->batch_flush_sync_count);
+    pump_event_begin(this, prog->xfer_size);
+    this->event.table_nums = pump_proc_table_nums(&prog->table_list);
+    for (i = 0; i < prog->buf_nums; i++)
+        pump_buf_sync_for_device(prog->buf[i], 0, prog->buf[i]->size);
+    pump_proc_prog_prepare(&this->pump_proc_data);
+    status = pump_xfer_start_list(this, &prog->table_list);
+    if (status == 0)
+        status = pump_xfer_wait(this);
+    for (i = 0; i < prog->buf_nums; i++)
+        pump_buf_sync_for_cpu(prog->buf[i], 0, prog->buf[i]->size);
+    result = pump_xfer_result(this, status, prog->xfer_size);
+    this->xfer_list = &this->pump_buf_list;
+    pump_event_commit(this);
+    mutex_unlock(&this->sem);
+ return_unlock_buf:
+    mutex_unlock(&file_data->buf_lock);
+    return result;
+}
+
+static const struct file_operations pump_driver_intake_fops;
+static const struct file_operations pump_driver_outlet_fops;
+
+/**
+ * pump_session_bind() - Bind the opposite direction pump opened as @fd.
+ * @file_data:	Pointer to the file structure.
+ * @fd:		File descriptor of the peer, or -1 to unbind.
+ * returns:	Success or error status.
+ *
+ * The file holds a reference to the peer file until it is unbound or
+ * closed.  Two files may not be bound to each other, since neither could
+ * then ever be released.
+ */
+static long pump_session_bind(struct pump_file_data* file_data, int fd)
+{
+    struct file*           peer_file = NULL;
+    struct file*           old_file;
+    struct pump_file_data* peer_data;
+
+    if (fd >= 0) {
+        peer_file = fget(fd);
+        if (peer_file == NULL)
+            return -EBADF;
+        if ((peer_file->f_op != &pump_driver_intake_fops) &&
+            (peer_file->f_op != &pump_driver_outlet_fops)) {
+            fput(peer_file);
+            return -EINVAL;
+        }
+        peer_data = peer_file->private_data;
+        if (peer_data->driver_data->direction == file_data->driver_data->direction) {
+            fput(peer_file);
+            return -EINVAL;
+        }
+    }
+    mutex_lock(&pump_session_lock);
+    if ((peer_file != NULL) && (peer_data->session_file != NULL)) {
+        mutex_unlock(&pump_session_lock);
+        fput(peer_file);
+        return -EBUSY;
+    }
+    mutex_lock(&file_data->buf_lock);
+    old_file = file_data->session_file;
+    file_data->session_file = peer_file;
+    mutex_unlock(&file_data->buf_lock);
+    mutex_unlock(&pump_session_lock);
+    if (old_file != NULL)
+        fput(old_file);
+    return 0;
+}
+
+/**
+ * pump_session_xfer() - Run an intake and an outlet transfer as one transaction.
+ * @file_data:	Pointer to the file structure.
+ * @xfer:	Buffers of both sides; results and timing are returned in it.
+ * returns:	Success or the first error status.
+ *
+ * Locks the intake before the outlet so that two sessions bound the
+ * opposite way around do not deadlock.  The outlet is started first so it
+ * is ready for whatever the intake produces.
+ */
+static long pump_session_xfer(struct pump_file_data* file_data, struct pump_ioctl_session_xfer* xfer)
+{
+    struct pump_driver_data*        this = file_data->driver_data;
+    struct pump_driver_data*        engine[2];   /* [0]=outlet, [1]=intake */
+    struct pump_ioctl_session_side* side[2];
+    bool                            setup[2]   = {0, 0};
+    bool                            started[2] = {0, 0};
+    size_t                          xfer_size[2];
+    int                             begun      = 0;
+    long                            result     = 0;
+    int                             i;
+
+    side[0] = &xfer->outlet;
+    side[1] = &xfer->intake;
+    for (i = 0; i < 2; i++) {
+        side[i]->result       = 0;
+        side[i]->usec_setup   = 0;
+        side[i]->usec_run     = 0;
+        side[i]->usec_wakeup  = 0;
+        side[i]->usec_release = 0;
+        if ((side[i]->length == 0) || (side[i]->length > INT_MAX))
+            return -EINVAL;
+    }
+    if (mutex_lock_interruptible(&file_data->buf_lock))
+        return -ERESTARTSYS;
+    if (file_data->session_file == NULL) {
+        result = -ENOTCONN;
+        goto return_unlock_file;
+    }
+    engine[ this->direction] = this;
+    engine[!this->direction] = pump_file_driver_data(file_data->session_file);
+
+    if (mutex_lock_interruptible(&engine[1]->sem)) {
+        result = -ERESTARTSYS;
+        goto return_unlock_file;
+    }
+    if (mutex_lock_interruptible(&engine[0]->sem)) {
+        result = -ERESTARTSYS;
+        goto return_unlock_intake;
+    }
+    pump_batch_flush(engine[0], &engine[0]->batch_flush_sync_count);
+    pump_batch_flush(engine[1], &engine[1]->batch_flush_sync_count);
+    /*
+     * 出力側から準備して起動し、入力側を起動してから両方の終了を待つ.
+     */
+    for (i = 0; i < 2; i++) {
+        int    status;
+        xfer_size[i] = side[i]->length;
+        begun++;
+        status = pump_buffer_setup(
+                     engine[i]                                  , /* struct pump_driver_data* this       */
+                     (char __user*)(unsigned long)side[i]->addr , /* char __user*             buff       */
+                     &xfer_size[i]                              , /* size_t*                  xfer_size  */
+                     (side[i]->flags & PUMP_XFER_FIRST) ? 1 : 0 , /* bool                     xfer_first */
+                     (side[i]->flags & PUMP_XFER_LAST ) ? 1 : 0   /* bool                     xfer_last  */
+        );
+        if (status != 0) {
+            side[i]->result = status;
+            result = status;
+            goto return_release;
+        }
+        setup[i] = 1;
+    }
+    for (i = 0; i < 2; i++) {
+        int status = pump_xfer_start(engine[i]);
+        if (status != 0) {
+            side[i]->result = status;
+            result = status;
+            goto return_stop;
+        }
+        started[i] = 1;
+    }
+    for (i = 1; i >= 0; i--) {
+        int status = pump_xfer_wait(engine[i]);
+        side[i]->result = pump_xfer_result(engine[i], status, xfer_size[i]);
+        if ((status != 0) && (result == 0))
+            result = status;
+    }
+    goto return_release;
+
+ return_stop:
+    for (i = 0; i < 2; i++) {
+        if ((started[i]) && (pump_xfer_stop(engine[i]) != 0))
+            result = -EBUSY;
+    }
+ return_release:
+    for (i = 0; i < begun; i++) {
+        if (setup[i])
+            pump_buffer_release(engine[i]);
+        side[i]->usec_setup   = engine[i]->event.usec_pin + engine[i]->event.usec_map + engine[i]->event.usec_build;
+        side[i]->usec_run     = engine[i]->event.usec_run;
+        side[i]->usec_wakeup  = engine[i]->event.usec_wakeup;
+        side[i]->usec_release = engine[i]->event.usec_release;
+    }
+    mutex_unlock(&engine[0]->sem);
+ return_unlock_intake:
+    mutex_unlock(&engine[1]->sem);
+ return_unlock_file:
+    mutex_unlock(&file_data->buf_lock);
+    return result;
+}
+
+/**
+ * pump_get_stats() - Take a snapshot of every statistic of the device.
+ *
+ * Never takes this->sem, so it does not wait for a running transfer.
+ */
+static void pump_get_stats(struct pump_driver_data* this, struct pump_ioctl_stats* stats)
+{
+    unsigned int  seq;
+    unsigned long irq_flags;
+    unsigned long irq_per_sec;
+    unsigned long complete_per_sec;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->size         = sizeof(*stats);
+    stats->timestamp_ns = ktime_to_ns(ktime_get());
+    do {
+        seq = read_seqcount_begin(&this->usec_seq);
+        stats->usec_buffer_setup   = this->usec_buffer_setup;
+        stats->usec_buffer_release = this->usec_buffer_release;
+        stats->usec_pump_run       = this->usec_pump_run;
+    } while (read_seqcount_retry(&this->usec_seq, seq));
+    stats->xfer_bytes  = pump_stat_xfer_bytes (&this->stat);
+    stats->xfer_count  = pump_stat_xfer_count (&this->stat);
+    stats->xfer_errors = pump_stat_xfer_errors(&this->stat);
+    pump_stat_get_rates(&this->stat, stats->bytes_per_sec, stats->ops_per_sec_x100);
+    pump_proc_irq_rate(&this->pump_proc_data, &irq_per_sec, &complete_per_sec);
+    spin_lock_irqsave(&this->pump_proc_data.irq_lock, irq_flags);
+    stats->irq_count        = this->pump_proc_data.irq_count;
+    stats->complete_count   = this->pump_proc_data.complete_count;
+    spin_unlock_irqrestore(&this->pump_proc_data.irq_lock, irq_flags);
+    stats->irq_per_sec      = irq_per_sec;
+    stats->complete_per_sec = complete_per_sec;
+    stats->irq_none_count   = pump_proc_irq_none_count(&this->pump_proc_data);
+    stats->pinned_bytes     = (u64)atomic_long_read(&this->pinned_pages) << PAGE_SHIFT;
+    stats->pinned_peak      = (u64)ACCESS_ONCE(this->pinned_peak) << PAGE_SHIFT;
+    stats->desc_bytes       = atomic_long_read(&this->desc_bytes);
+    stats->desc_peak        = ACCESS_ONCE(this->desc_peak);
+}
+
+/**
+ * pump_ioctl() - The is the driver ioctl function.
+ * @file:	Pointer to the file structure.
+ * @cmd:	The ioctl command.
+ * @arg:	Pointer to the argument in user space.
+ * returns:	Success or error status.
+ */
+static long pump_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
+{
+    struct pump_file_data*   file_data     = file->private_data;
+    struct pump_driver_data* this          = file_data->driver_data;
+    int                      dma_direction = (this->direction) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+    void __user*             argp          = (void __user*)arg;
+    long                     result        = 0;
+
+    switch (cmd) {
+        case PUMP_IOCTL_BUF_ALLOC: {
+            struct pump_ioctl_buf_alloc buf_alloc;
+            if (copy_from_user(&buf_alloc, argp, sizeof(buf_alloc)))
+                return -EFAULT;
+            if ((buf_alloc.size == 0) || (buf_alloc.size > 0xFFFFFFFF))
+                return -EINVAL;
+            result = pump_buf_export(this->dev, buf_alloc.size, &buf_alloc.fd);
+            if (result != 0)
+                return result;
+            if (copy_to_user(argp, &buf_alloc, sizeof(buf_alloc)))
+                return -EFAULT;
+            return 0;
+        }
+        case PUMP_IOCTL_BUF_IMPORT: {
+            struct pump_ioctl_buf_import buf_import;
+            struct pump_buf*             buf;
+            if (copy_from_user(&buf_import, argp, sizeof(buf_import)))
+                return -EFAULT;
+            buf = pump_buf_import(this->dev, buf_import.fd, dma_direction);
+            if (IS_ERR(buf))
+                return PTR_ERR(buf);
+            if (mutex_lock_interruptible(&file_data->buf_lock)) {
+                pump_buf_release(buf);
+                return -ERESTARTSYS;
+            }
+            do {
+                buf->handle = ++file_data->buf_handle;
+            } while ((buf->handle == 0) || (pump_find_buf(file_data, buf->handle) != NULL));
+            list_add_tail(&buf->list, &file_data->buf_list);
+            buf_import.handle = buf->handle;
+            buf_import.size   = buf->size;
+            mutex_unlock(&file_data->buf_lock);
+            if (copy_to_user(argp, &buf_import, sizeof(buf_import)))
+                return -EFAULT;
+            return 0;
+        }
+        case PUMP_IOCTL_BUF_RELEASE: {
+            u32              handle;
+            struct pump_buf* buf;
+            if (get_user(handle, (u32 __user*)argp))
+                return -EFAULT;
+            if (mutex_lock_interruptible(&file_data->buf_lock))
+                return -ERESTARTSYS;
+            buf = pump_find_buf(file_data, handle);
+            if ((buf != NULL) && ((buf->prog_users > 0) || (ACCESS_ONCE(this->stop_failed)))) {
+                mutex_unlock(&file_data->buf_lock);
+                return -EBUSY;
+            }
+            if (buf != NULL)
+                list_del(&buf->list);
+            mutex_unlock(&file_data->buf_lock);
+            if (buf == NULL)
+                return -ENOENT;
+            pump_buf_release(buf);
+            return 0;
+        }
+        case PUMP_IOCTL_BUF_XFER: {
+            struct pump_ioctl_buf_xfer buf_xfer;
+            if (copy_from_user(&buf_xfer, argp, sizeof(buf_xfer)))
+                return -EFAULT;
+            return pump_buf_xfer(file_data, &buf_xfer);
+        }
+        case PUMP_IOCTL_SESSION_BIND: {
+            s32 fd;
+            if (get_user(fd, (s32 __user*)argp))
+                return -EFAULT;
+            return pump_session_bind(file_data, fd);
+        }
+        case PUMP_IOCTL_SESSION_XFER: {
+            struct pump_ioctl_session_xfer session_xfer;
+            if (copy_from_user(&session_xfer, argp, sizeof(session_xfer)))
+                return -EFAULT;
+            result = pump_session_xfer(file_data, &session_xfer);
+            if (copy_to_user(argp, &session_xfer, sizeof(session_xfer)))
+                return -EFAULT;
+            return result;
+        }
+        case PUMP_IOCTL_PROG_LOAD: {
+            struct pump_ioctl_prog_load prog_load;
+            if (copy_from_user(&prog_load, argp, sizeof(prog_load)))
+                return -EFAULT;
+            result = pump_prog_load(file_data, &prog_load);
+            if (result != 0)
+                return result;
+            if (copy_to_user(argp, &prog_load, sizeof(prog_load)))
+                return -EFAULT;
+            return 0;
+        }
+        case PUMP_IOCTL_PROG_RUN: {
+            u32 handle;
+            if (get_user(handle, (u32 __user*)argp))
+                return -EFAULT;
+            return pump_prog_run(file_data, handle);
+        }
+        case PUMP_IOCTL_PROG_RELEASE: {
+            u32               handle;
+            struct pump_prog* prog;
+            if (get_user(handle, (u32 __user*)argp))
+                return -EFAULT;
+            if (mutex_lock_interruptible(&file_data->buf_lock))
+                return -ERESTARTSYS;
+            prog = pump_find_prog(file_data, handle);
+            if (prog != NULL) {
+                list_del(&prog->list);
+                pump_prog_free(this, prog);
+            }
+            mutex_unlock(&file_data->buf_lock);
+            return (prog != NULL) ? 0 : -ENOENT;
+        }
+        case PUMP_IOCTL_BYPASS_ENTER: {
+            struct pump_ioctl_bypass bypass;
+            if (copy_from_user(&bypass, argp, sizeof(bypass)))
+                return -EFAULT;
+            result = pump_bypass_enter(this, file, &bypass);
+            if (result != 0)
+                return result;
+            if (copy_to_user(argp, &bypass, sizeof(bypass)))
+                return -EFAULT;
+            return 0;
+        }
+        case PUMP_IOCTL_BUF_ADDR: {
+            struct pump_ioctl_buf_addr buf_addr;
+            struct pump_buf*           buf;
+            if (this->bypass_file != file)
+                return -EPERM;
+            if (copy_from_user(&buf_addr, argp, sizeof(buf_addr)))
+                return -EFAULT;
+            if (mutex_lock_interruptible(&file_data->buf_lock))
+                return -ERESTARTSYS;
+            buf = pump_find_buf(file_data, buf_addr.handle);
+            if (buf == NULL)
+                result = -ENOENT;
+            else if (buf->sg_table->nents != 1)
+                result = -EINVAL;
+            else
+                buf_addr.addr = sg_dma_address(buf->sg_table->sgl);
+            mutex_unlock(&file_data->buf_lock);
+            if (result != 0)
+                return result;
+            if (copy_to_user(argp, &buf_addr, sizeof(buf_addr)))
+                return -EFAULT;
+            return 0;
+        }
+        case PUMP_IOCTL_GET_STATS: {
+            struct pump_ioctl_stats stats;
+            u32                     size;
+            if (get_user(size, (u32 __user*)argp))
+                return -EFAULT;
+            if (size < sizeof(u32))
+                return -EINVAL;
+            pump_get_stats(this, &stats);
+            if (copy_to_user(argp, &stats, min_t(u32, size, sizeof(stats))))
+                return -EFAULT;
+            return 0;
+        }
+        default:
+            return -ENOTTY;
+    }
+}
+
+/**
+ *
+ */
+static const struct file_operations pump_driver_intake_fops = {
+    .owner          = THIS_MODULE,
+    .open           = pump_open,
+    .release        = pump_release,
+    .write          = pump_write,
+    .aio_write      = pump_aio_write,
+    .fsync          = pump_fsync,
+    .flush          = pump_flush,
+    .unlocked_ioctl = pump_ioctl,
+    .compat_ioctl   = pump_ioctl,
+    .mmap           = pump_mmap,
+};
+static const struct file_operations pump_driver_outlet_fops = {
+    .owner          = THIS_MODULE,
+    .open           = pump_open,
+    .release        = pump_release,
+    .read           = pump_read,
+    .aio_read       = pump_aio_read,
+    .unlocked_ioctl = pump_ioctl,
+    .compat_ioctl   = pump_ioctl,
+    .mmap           = pump_mmap,
+};
+
+/**
+ * pump_driver_probe() -  Probe call for the device.
+ *
+ * @pdev:	handle to the platform device structure.
+ * Returns 0 on success, negative error otherwise.
+ *
+ * It does all the memory allocation and registration for the device.
+ */
+static int pump_driver_probe(struct platform_device *pdev)
+{
+    struct pump_driver_data*    this     = NULL;
+    int                         result   = 0;
+    unsigned int                done     = 0;
+    const unsigned int          DONE_ADD_CHRDEV             = (1 <<  0);
+    const unsigned int          DONE_GET_CORE_REGS_RESOUCE  = (1 <<  1);
+    const unsigned int          DONE_REQ_CORE_REGS_REGION   = (1 <<  2);
+    const unsigned int          DONE_MAP_CORE_REGS_ADDR     = (1 <<  3);
+    const unsigned int          DONE_GET_PROC_REGS_RESOUCE  = (1 <<  4);
+    const unsigned int          DONE_REQ_PROC_REGS_REGION   = (1 <<  5);
+    const unsigned int          DONE_MAP_PROC_REGS_ADDR     = (1 <<  6);
+    const unsigned int          DONE_DEVICE_CREATE          = (1 <<  7);
+    const unsigned int          DONE_GET_IRQ_RESOUCE        = (1 <<  8);
+    const unsigned int          DONE_IRQ_REQUEST            = (1 <<  9);
+    const unsigned int          DONE_PUMP_PROC_SETUP        = (1 << 10);
+    const unsigned int          DONE_ALLOC_WORKQUEUE        = (1 << 11);
+    const unsigned int          DONE_EVLOG_SETUP            = (1 << 12);
+    unsigned long               core_regs_addr = 0L;
+    unsigned long               core_regs_size = 0L;
+    unsigned long               proc_regs_addr = 0L;
+    unsigned long               proc_regs_size = 0L;
+    char*                       device_name;
+
+#if (PUMP_DEBUG == 1)
+    dev_info(&pdev->dev, "PUMP Driver probe start\n");
+#endif
+    /*
+     * create (pump_driver_data*)this.
+     */
+    {
+        this = kzalloc(sizeof(*this), GFP_KERNEL);
+        if (IS_ERR_OR_NULL(this)) {
+            dev_err(&pdev->dev, "couldn't allocate device private record\n");
+            result = PTR_ERR(this);
+            this = NULL;
+            goto failed;
+        }
+        dev_set_drvdata(&pdev->dev, this);
+    }
+    /*
+     * get device number
+     */
+    {
+        u32 minor_number;
+        int status;
+        status = of_property_read_u32(pdev->dev.of_node, "minor-number", &minor_number);
+        if (status != 0) {
+            dev_err(&pdev->dev, "invalid property minor number\n");
+            result = -ENODEV;
+            goto failed;
+        }
+        this->device_number = MKDEV(MAJOR(pump_device_number), MINOR(minor_number));
+    }
+    /*
+     * get direction to make this->direction
+     */
+    {
+        u32 direction;
+        int status;          
+        status = of_property_read_u32(pdev->dev.of_node, "direction", &direction);
+        if ((status != 0) || (direction > 1)) {
+            dev_err(&pdev->dev, "invalid property direction \n");
+            result = -ENODEV;
+            goto failed;
+        }
+        this->direction = direction;
+    }
+    /*
+     * device create to this->dev and device_name
+     */
+    {
+        this->dev = device_create(
+                        pump_sys_class           , /* struct class*  class   */
+                        NULL                     , /* struct device* parent  */
+                        this->device_number      , /* dev_t          devt    */
+                        (void *)this             , /* void*          drvdata */
+                        DEVICE_NAME_FORMAT       , /* const char*    fmt     */
+                        MINOR(this->device_number) /* ...                    */
+                    );
+        if (IS_ERR_OR_NULL(this->dev)) {
+            dev_err(&pdev->dev, "device_create() failed\n");
+            result = PTR_ERR(this->dev);
+            this->dev = NULL;
+            goto failed;
+        }
+        device_name = dev_name(this->dev);
+        dma_set_coherent_mask(this->dev, 0xFFFFFFFF);
+        done |= DONE_DEVICE_CREATE;
+    }
+    /*
+     * get core register resouce and ioremap to this->core_regs_addr
+     */
+    {
+        this->core_regs_res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+        if (this->core_regs_res == NULL) {
+            dev_err(&pdev->dev, "invalid register address\n");
+            result = -ENODEV;
+            goto failed;
+        }
+        done |= DONE_GET_CORE_REGS_RESOUCE;
+        core_regs_addr = this->core_regs_res->start;
+        core_regs_size = this->core_regs_res->end - this->core_regs_res->start + 1;
+
+        if (request_mem_region(core_regs_addr, core_regs_size, device_name) == NULL) {
+            dev_err(&pdev->dev, "couldn't lock memory region at %pr\n", this->core_regs_res);
+            result = -EBUSY;
+            goto failed;
+        }
+        done |= DONE_REQ_CORE_REGS_REGION;
+
+        this->core_regs_addr = ioremap_nocache(core_regs_addr, core_regs_size);
+        if (this->core_regs_addr == NULL) {
+            dev_err(&pdev->dev, "ioremap(%pr) failed\n", this->core_regs_res);
+            result = -ENODEV;
+            goto failed;
+        }
+        done |= DONE_MAP_CORE_REGS_ADDR;
+    }
+    /*
+     * get proc register resouce and ioremap to this->prco_regs_addr
+     */
+    {
+        this->proc_regs_res = platform_get_resource(pdev, IORESOURCE_MEM, 1);
+        if (this->proc_regs_res != NULL) {
+            proc_regs_addr = this->proc_regs_res->start;
+            proc_regs_size = this->proc_regs_res->end - this->proc_regs_res->start + 1;
+
+            if (request_mem_region(proc_regs_addr, proc_regs_size, device_name) == NULL) {
+                dev_err(&pdev->dev, "couldn't lock memory region at %pr\n", this->proc_regs_res);
+                result = -EBUSY;
+                goto failed;
+            }
+            done |= DONE_REQ_PROC_REGS_REGION;
+
+            this->proc_regs_addr = ioremap_nocache(proc_regs_addr, proc_regs_size);
+            if (this->proc_regs_addr == NULL) {
+                dev_err(&pdev->dev, "ioremap(%pr) failed\n", this->proc_regs_res);
+                result = -ENODEV;
+                goto failed;
+            }
+            done |= DONE_MAP_PROC_REGS_ADDR;
+        }
+        done |= DONE_GET_PROC_REGS_RESOUCE;
+    }
+    /*
+     * get interrupt number to this->irq
+     */
+    {
+        this->irq_res = platform_get_resource(pdev, IORESOURCE_IRQ, 0);
+        if (this->irq_res == NULL) {
+            dev_err(&pdev->dev, "interrupt not found\n");
+            result = -ENODEV;
+            goto failed;
+        }
+        done |= DONE_GET_IRQ_RESOUCE;
+
+        this->irq = this->irq_res->start;
+    }
+    /*
+     * add chrdev.
+     */
+    {
+        if (this->direction == 0)
+            cdev_init(&this->cdev, &pump_driver_outlet_fops);
+        else
+            cdev_init(&this->cdev, &pump_driver_intake_fops);
+        this->cdev.owner = THIS_MODULE;
+        if (cdev_add(&this->cdev, this->device_number, 1) != 0) {
+            dev_err(&pdev->dev, "cdev_add() failed\n");
+            result = -ENODEV;
+            goto failed;
+        }
+        done |= DONE_ADD_CHRDEV;
+    }
+    /*
+     *
+     */
+    this->limit_size   = 0xFFFFFFFF;
+    this->timeout_msec = PUMP_TIMEOUT_DEF;
+    this->min_mb_per_sec    = PUMP_MIN_MB_PER_SEC_DEF;
+    this->deadline_min_usec = PUMP_DEADLINE_MIN_USEC_DEF;
+    this->timeout_count     = 0;
+    this->deadline_expired  = 0;
+    this->xfer_list         = &this->pump_buf_list;
+    hrtimer_init(&this->deadline_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    this->deadline_timer.function = pump_deadline_timer;
+    this->bounce_threshold = PUMP_BOUNCE_THRESHOLD_DEF;
+    this->align_bounce     = 1;
+    this->align_buf        = NULL;
+    this->release_async    = 1;
+    this->release_deferred_count = 0;
+    this->pin_limit        = PUMP_PIN_LIMIT_DEF;
+    this->chain_cache_max  = PUMP_CHAIN_CACHE_DEF;
+    this->batch_enable     = 0;
+    this->batch_threshold  = PUMP_BATCH_THRESHOLD_DEF;
+    this->batch_delay_usec = PUMP_BATCH_DELAY_USEC_DEF;
+    this->pin_rlimit       = 1;
+    atomic_long_set(&this->pinned_pages, 0);
+    atomic_long_set(&this->desc_bytes  , 0);
+    this->pinned_peak      = 0;
+    this->desc_peak        = 0;
+    this->pin_window_count = 0;
+    this->pin_pages        = 0;
+    this->pin_desc_bytes   = 0;
+    this->pin_mm           = NULL;
+    this->pin_mm_pages     = 0;
+    this->bypass_enable    = 0;
+    this->bypass_file      = NULL;
+    this->bypass_eventfd   = NULL;
+    this->bypass_desc_ptr  = NULL;
+    this->bypass_irq_count = 0;
+    spin_lock_init(&this->bypass_lock);
+    spin_lock_init(&this->release_lock);
+    INIT_LIST_HEAD(&this->release_list);
+    INIT_WORK(&this->release_work, pump_release_work);
+    INIT_LIST_HEAD(&this->quarantine_list);
+    INIT_LIST_HEAD(&this->quarantine_bounce_list);
+    spin_lock_init(&this->chain_lock);
+    INIT_LIST_HEAD(&this->chain_list);
+    INIT_LIST_HEAD(&this->chain_mm_list);
+    INIT_WORK(&this->chain_work, pump_chain_work);
+    hrtimer_init(&this->batch_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    this->batch_timer.function = pump_batch_timer;
+    INIT_WORK(&this->batch_work, pump_batch_work);
+    atomic_set(&this->release_pending, 0);
+    this->usec_buffer_setup   = 0;
+    this->usec_buffer_release = 0;
+    this->usec_pump_run       = 0;
+    this->usec_table_build    = 0;
+    seqcount_init(&this->usec_seq);
+    this->complete_highpri    = 0;
+    this->irq_affinity_cpu    = -1;
+    mutex_init(&this->sem);
+    kref_init(&this->kref);
+    this->removed             = 0;
+    INIT_LIST_HEAD(&this->pump_buf_list);
+    init_waitqueue_head(&this->wait_queue);
+
+#if (PUMP_DEBUG == 1)
+    this->debug_phase     = 0;
+    this->debug_op_table  = 0;
+    this->debug_sg_table  = 0;
+    this->debug_interrupt = 0;
+    this->debug_key_held  = 0;
+#endif   
+    /*
+     *
+     */
+    {
+        int status;
+        status = pump_proc_setup(
+                     &this->pump_proc_data, /* struct pump_proc_data* this        */
+                     this->dev            , /* struct device*         dev         */
+                     this->direction      , /* int                    direction   */
+                     this->proc_regs_addr , /* void __iomem*          regs_addr   */
+                     pump_done_work       , /* void                   (*done_func)*/
+                     (void*)this            /* void*                  done_arg    */
+                 );
+        if (status != 0) {
+            dev_err(&pdev->dev, "pump_proc_setup() failed\n");
+            result = status;
+            goto failed;
+        }
+        this->pump_proc_data.link_mode = PUMP_LINK_AXI_MODE;
+        done |= DONE_PUMP_PROC_SETUP;
+        /*
+         * "ocm-pool" があれば、オペコードの表をそのプール(mmio-sram)から取る.
+         * プールはPUMPのマスターポートから見えるアドレスになければならない.
+         */
+        this->pump_proc_data.ocm_pool  = of_get_named_gen_pool(pdev->dev.of_node, "ocm-pool", 0);
+        this->pump_proc_data.table_ocm = (this->pump_proc_data.ocm_pool != NULL);
+        if (this->pump_proc_data.ocm_pool != NULL)
+            dev_info(&pdev->dev, "opecode tables in ocm-pool (%zu bytes)\n",
+                     gen_pool_size(this->pump_proc_data.ocm_pool));
+        status = pump_proc_bounce_setup(&this->pump_proc_data, PUMP_BOUNCE_NUMS, PUMP_BOUNCE_SIZE);
+        if (status != 0) {
+            dev_err(&pdev->dev, "pump_proc_bounce_setup() failed\n");
+            result = status;
+            goto failed;
+        }
+    }
+    /*
+     * bound high priority workqueue for the completion work.
+     */
+    {
+        this->complete_wq = alloc_workqueue("%s", WQ_HIGHPRI | WQ_MEM_RECLAIM, 1, device_name);
+        if (this->complete_wq == NULL) {
+            dev_err(&pdev->dev, "alloc_workqueue() failed\n");
+            result = -ENOMEM;
+            goto failed;
+        }
+        done |= DONE_ALLOC_WORKQUEUE;
+    }
+    /*
+     * per-transfer event log in debugfs.
+     */
+    {
+        if (pump_evlog_setup(&this->evlog, pump_debugfs_root, device_name, PUMP_EVLOG_ENTRIES_DEF) != 0) {
+            dev_err(&pdev->dev, "pump_evlog_setup() failed\n");
+            result = -ENOMEM;
+            goto failed;
+        }
+        done |= DONE_EVLOG_SETUP;
+    }
+    pump_stat_setup(&this->stat);
+    /*
+     * attach to the dispatcher of the (shared) interrupt line.
+     */
+    {
+        if (pump_proc_request_irq(&this->pump_proc_data, this->irq, DRIVER_NAME) != 0) {
+            dev_err(&pdev->dev, "request_irq(%pr) failed\n", this->irq_res);
+            result = -EBUSY;
+            goto failed;
+        }
+        done |= DONE_IRQ_REQUEST;
+    }
+    /*
+     *
+     */
+#if (PUMP_DEBUG == 1)
+    {
+        dev_info(this->dev, "driver installed\n");
+        dev_info(this->dev, "private record     = %pK (%dbytes)\n", this, sizeof(*this));
+        dev_info(this->dev, "direction          = %d\n"           , this->direction);
+        dev_info(this->dev, "major number       = %d\n"           , MAJOR(this->device_number));
+        dev_info(this->dev, "minor number       = %d\n"           , MINOR(this->device_number));
+        dev_info(this->dev, "core regs resource = %pr\n"          , this->core_regs_res );
+        dev_info(this->dev, "core regs address  = %pK\n"          , this->core_regs_addr);
+    }
+    if (this->proc_regs_res != NULL) {
+        dev_info(this->dev, "proc regs resource = %pr\n"          , this->proc_regs_res );
+        dev_info(this->dev, "proc regs address  = %pK\n"          , this->proc_regs_addr);
+    }
+    { 
+        dev_info(this->dev, "irq resource       = %pr\n"          , this->irq_res  );
+    }
+#endif
+    return 0;
+
+ failed:
+    if (done & DONE_IRQ_REQUEST         ) { pump_proc_free_irq(&this->pump_proc_data); }
+    if (done & DONE_PUMP_PROC_SETUP     ) { pump_proc_cleanup(&this->pump_proc_data);}
+    if (done & DONE_EVLOG_SETUP         ) { pump_evlog_cleanup(&this->evlog); }
+    if (done & DONE_ALLOC_WORKQUEUE     ) { destroy_workqueue(this->complete_wq); }
+    if (done & DONE_DEVICE_CREATE       ) { device_destroy(pump_sys_class, this->device_number);}
+    if (done & DONE_MAP_CORE_REGS_ADDR  ) { iounmap(this->core_regs_addr); }
+    if (done & DONE_REQ_CORE_REGS_REGION) { release_mem_region(core_regs_addr, core_regs_size);}
+    if (done & DONE_MAP_PROC_REGS_ADDR  ) { iounmap(this->proc_regs_addr); }
+    if (done & DONE_REQ_PROC_REGS_REGION) { release_mem_region(proc_regs_addr, proc_regs_size);}
+    if (done & DONE_ADD_CHRDEV          ) { cdev_del(&this->cdev); }
+    if (this != NULL)                     { kfree(this); dev_set_drvdata(&pdev->dev, NULL); }
+    return result;
+}
+
+
+/**
+ * pump_driver_free() - Free the device structure when the last reference goes.
+ *
+ * A striped device holds a reference to each member engine, so the
+ * structure outlives pump_driver_remove() until the stripe lets it go.
+ */
+static void pump_driver_free(struct kref* kref)
+{
+    kfree(container_of(kref, struct pump_driver_data, kref));
+}
+
+/**
+ * pump_driver_remove() -  Remove call for the device.
+ *
+ * @pdev:	handle to the platform device structure.
+ * Returns 0 or error status.
+ *
+ * Unregister the device after releasing the resources.
+ */
+static int pump_driver_remove(struct platform_device *pdev)
+{
+    struct pump_driver_data* this  = dev_get_drvdata(&pdev->dev);
+
+    if (!this)
+        return -ENODEV;
+
+    /*
+     * ストライプが this->sem を取った後に removed を見て転送を止めるので、
+     * 以降はハードウェアに触れない.
+     */
+    mutex_lock(&this->sem);
+    this->removed = 1;
+    mutex_unlock(&this->sem);
+
+    /*
+     * 溜めた書き込みは割り込みを解放する前に転送する.
+     */
+    hrtimer_cancel(&this->batch_timer);
+    cancel_work_sync(&this->batch_work);
+    mutex_lock(&this->sem);
+    pump_batch_flush(this, &this->batch_flush_sync_count);
+    pump_chain_shrink(this, 1);
+    mutex_unlock(&this->sem);
+    pump_proc_free_irq(&this->pump_proc_data);
+    cancel_work_sync(&this->chain_work);
+    flush_work(&this->release_work);
+#if (PUMP_DEBUG == 1)
+    if (this->debug_key_held)
+        static_key_slow_dec(&pump_debug_key);
+#endif
+    hrtimer_cancel(&this->deadline_timer);
+    pump_proc_clear_buf_list(&this->pump_proc_data, &this->pump_buf_list);
+    pump_proc_cleanup(&this->pump_proc_data);
+    pump_evlog_cleanup(&this->evlog);
+    destroy_workqueue(this->complete_wq);
+
+    device_destroy(pump_sys_class, this->device_number);
+
+    if (this->core_regs_addr != NULL) {
+        unsigned long regs_addr = this->core_regs_res->start;
+        unsigned long regs_size = this->core_regs_res->end - this->core_regs_res->start + 1;
+        iounmap(this->core_regs_addr);
+        release_mem_region(regs_addr, regs_size);
+    }
+
+    if (this->proc_regs_addr != NULL) {
+        unsigned long regs_addr = this->proc_regs_res->start;
+        unsigned long regs_size = this->proc_regs_res->end - this->proc_regs_res->start + 1;
+        iounmap(this->proc_regs_addr);
+        release_mem_region(regs_addr, regs_size);
+    }
+
+    cdev_del(&this->cdev);
+
+    dev_set_drvdata(&pdev->dev, NULL);
+
+    kref_put(&this->kref, pump_driver_free);
+
+#if (PUMP_DEBUG == 1)
+    dev_info(&pdev->dev, "driver unloaded\n");
+#endif
+    return 0;
+}
+
+/**
+ * Open Firmware Device Identifier Matching Table
+ */
+static struct of_device_id pump_of_match[] = {
+    { .compatible = "ikwzm,pump-0.70.a", },
+    { /* end of table */}
+};
+
+MODULE_DEVICE_TABLE(of, pump_of_match);
+
+/**
+ * Platform Driver Structure
+ */
+static struct platform_driver pump_platform_driver = {
+    .probe  = pump_driver_probe,
+    .remove = pump_driver_remove,
+    .driver = {
+        .owner = THIS_MODULE,
+        .name  = DRIVER_NAME,
+        .of_match_table = pump_of_match,
+    },
+};
+
+/******************************************************************************
+ * Striped Device
+ ******************************************************************************
+ * 同じ方向の複数のPUMPを束ねて一つのデバイス(/dev/pump_stripeN)として見せる.
+ * 一回の read/write を stripe_unit 単位でほぼ等分して各PUMPに割り当て、全ての
+ * PUMPを起動してから全ての終了を待つ. 返り値は先頭から連続して転送を終えた
+ * バイト数.
+ * 各PUMPはそれぞれ独立したストリームを出すので、PUMP_XFER_FIRST/LAST は
+ * 先頭と最後のチャンクだけでなく全てのPUMPのチャンクに付ける. 片方にしか
+ * 付けないと、他のPUMPのストリームはフレームが開かず閉じないままになる.
+ * 束ねたPUMPは参照を持つので、先に PUMP が remove されても構造体は残り、
+ * 転送は -ENODEV で失敗する.
+ *
+ * Device Tree の例:
+ *
+ *	pump-stripe@0 {
+ *		compatible = "ikwzm,pump-stripe-0.70.a";
+ *		minor-number = <8>;
+ *		pump-engines = <&pump2 &pump3>;
+ *	};
+ ******************************************************************************/
+#define DEVICE_STRIPE_NAME_FORMAT  "pump_stripe%d"
+#define PUMP_STRIPE_ENGINE_MAX     (8)
+#define PUMP_STRIPE_UNIT_DEF       (PAGE_SIZE)
+
+static struct class*  pump_stripe_sys_class = NULL;
+
+/**
+ * struct pump_stripe_data - Striped device structure
+ */
+struct pump_stripe_data {
+    struct device*          dev;
+    struct cdev             cdev;
+    dev_t                   device_number;
+    struct mutex            sem;
+    int                     direction;
+    unsigned int            engine_nums;
+    struct platform_device* engine_pdev[PUMP_STRIPE_ENGINE_MAX];
+    struct pump_driver_data* engine[PUMP_STRIPE_ENGINE_MAX];
+    char                    engine_name[PUMP_STRIPE_ENGINE_MAX][16];
+    unsigned long           limit_size;
+    unsigned long           stripe_unit;
+    unsigned long           usec_pump_run;
+};
+
+#define DEF_STRIPE_ATTR_SHOW(__attr_name, __format, __value) \
+static ssize_t pump_stripe_show_ ## __attr_name(struct device *dev, struct device_attribute *attr, char *buf) \
+{ \
+    ssize_t status; \
+    struct pump_stripe_data* this = dev_get_drvdata(dev); \
+    if (mutex_lock_interruptible(&this->sem) != 0) \
+        return -ERESTARTSYS; \
+    status = sprintf(buf, __format, (__value)); \
+    mutex_unlock(&this->sem); \
+    return status; \
+}
+
+#define DEF_STRIPE_ATTR_SET(__attr_name, __min, __max) \
+static ssize_t pump_stripe_set_ ## __attr_name(struct device *dev, struct device_attribute *attr, const char *buf, size_t size) \
+{ \
+    ssize_t       status; \
+    unsigned long value;  \
+    struct pump_stripe_data* this = dev_get_drvdata(dev);              \
+    if (0 != mutex_lock_interruptible(&this->sem)){return -ERESTARTSYS;}     \
+    if (0 != (status = kstrtoul(buf, 10, &value))) {           goto failed;} \
+    if ((value < __min) || (__max < value)) {status = -EINVAL; goto failed;} \
+    this->__attr_name = value;                                               \
+    status = size;                                                           \
+  failed:                                                                    \
+    mutex_unlock(&this->sem);                                                \
+    return status;                                                           \
 }
 
+DEF_STRIPE_ATTR_SHOW(direction     , "%d\n" , this->direction);
+DEF_STRIPE_ATTR_SHOW(engine_nums   , "%u\n" , this->engine_nums);
+DEF_STRIPE_ATTR_SHOW(limit_size    , "%lu\n", this->limit_size);
+DEF_STRIPE_ATTR_SHOW(stripe_unit   , "%lu\n", this->stripe_unit);
+DEF_STRIPE_ATTR_SET( limit_size    , 0        , 0xFFFFFFFF);
+
 /**
- * pump_open() - The is the driver open function.
- * @inode:	Pointer to the inode structure of this device.
- * @file:	Pointer to the file structure.
- * returns:	Success or error status.
+ * usec_pump_run は転送中でも読めるように this->sem を取らない.
  */
-static int pump_open(struct inode *inode, struct file *file)
+static ssize_t pump_stripe_show_usec_pump_run(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    struct pump_driver_data* driver_data;
-    int status = 0;
+    struct pump_stripe_data* this = dev_get_drvdata(dev);
+    return sprintf(buf, "%lu\n", ACCESS_ONCE(this->usec_pump_run));
+}
 
-    driver_data = container_of(inode->i_cdev, struct pump_driver_data, cdev);
-    file->private_data   = driver_data;
-    driver_data->is_open = 1;
-    driver_data->usec_buffer_setup   = 0;
-    driver_data->usec_buffer_release = 0;
-    driver_data->usec_pump_run       = 0;
+static ssize_t pump_stripe_show_engines(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    ssize_t      status = 0;
+    unsigned int i;
+    struct pump_stripe_data* this = dev_get_drvdata(dev);
+    if (mutex_lock_interruptible(&this->sem) != 0)
+        return -ERESTARTSYS;
+    for (i = 0; i < this->engine_nums; i++)
+        status += sprintf(buf + status, "%s%s", (i > 0) ? " " : "", this->engine_name[i]);
+    status += sprintf(buf + status, "\n");
+    mutex_unlock(&this->sem);
+    return status;
+}
 
+/**
+ * stripe_unit : チャンクの大きさの単位. ALIGN() で丸めるので 2 のべき乗に限る.
+ */
+static ssize_t pump_stripe_set_stripe_unit(struct device *dev, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t       status;
+    unsigned long value;
+    struct pump_stripe_data* this = dev_get_drvdata(dev);
+    if (0 != mutex_lock_interruptible(&this->sem)){return -ERESTARTSYS;}
+    if (0 != (status = kstrtoul(buf, 10, &value))) {                   goto failed;}
+    if ((value < PAGE_SIZE) || (0x10000000 < value)) {status = -EINVAL; goto failed;}
+    if (!is_power_of_2(value))                       {status = -EINVAL; goto failed;}
+    this->stripe_unit = value;
+    status = size;
+  failed:
+    mutex_unlock(&this->sem);
     return status;
 }
 
+static struct device_attribute pump_stripe_device_attrs[] = {
+  __ATTR(direction           , 0644, pump_stripe_show_direction    , NULL),
+  __ATTR(engine_nums         , 0644, pump_stripe_show_engine_nums  , NULL),
+  __ATTR(engines             , 0644, pump_stripe_show_engines      , NULL),
+  __ATTR(limit_size          , 0644, pump_stripe_show_limit_size   , pump_stripe_set_limit_size ),
+  __ATTR(stripe_unit         , 0644, pump_stripe_show_stripe_unit  , pump_stripe_set_stripe_unit),
+  __ATTR(usec_pump_run       , 0644, pump_stripe_show_usec_pump_run, NULL),
+  __ATTR_NULL,
+};
+
+#if (USE_DEV_GROUPS == 1)
+
+static struct attribute *pump_stripe_attrs[] = {
+  &(pump_stripe_device_attrs[ 0].attr),
+  &(pump_stripe_device_attrs[ 1].attr),
+  &(pump_stripe_device_attrs[ 2].attr),
+  &(pump_stripe_device_attrs[ 3].attr),
+  &(pump_stripe_device_attrs[ 4].attr),
+  &(pump_stripe_device_attrs[ 5].attr),
+  NULL
+};
+static struct attribute_group  pump_stripe_attr_group = {
+  .attrs = pump_stripe_attrs
+};
+static const struct attribute_group* pump_stripe_attr_groups[] = {
+  &pump_stripe_attr_group,
+  NULL
+};
+
+#define SET_STRIPE_SYS_CLASS_ATTRIBUTES(sys_class) {(sys_class)->dev_groups = pump_stripe_attr_groups; }
+#else
+#define SET_STRIPE_SYS_CLASS_ATTRIBUTES(sys_class) {(sys_class)->dev_attrs  = pump_stripe_device_attrs;}
+#endif
+
 /**
- * pump_release() - The is the driver release function.
- * @inode:	Pointer to the inode structure of this device.
- * @file:	Pointer to the file structure.
- * returns:	Success.
+ * pump_stripe_xfer() - Split one transfer across every engine of the stripe.
+ * @this:	Pointer to the striped device.
+ * @buff:	Pointer to the user buffer.
+ * @xfer_size:	The number of bytes to be transferred.
+ * @xfer_first:	Mark the first operation code of each engine as First.
+ * @xfer_last:	Mark the last operation code of each engine as Last.
+ * returns:	Number of bytes transferred in order, or error status.
+ *
+ * Every engine carries its own stream, so each chunk is framed on its own
+ * engine rather than as one slice of a single stream.
  */
-static int pump_release(struct inode *inode, struct file *file)
+static ssize_t pump_stripe_xfer(
+    struct pump_stripe_data* this,
+    char __user*             buff,
+    size_t                   xfer_size,
+    bool                     xfer_first,
+    bool                     xfer_last
+)
 {
-    struct pump_driver_data* this = file->private_data;
+    size_t        chunk_size = ALIGN(DIV_ROUND_UP(xfer_size, this->engine_nums), this->stripe_unit);
+    size_t        chunk[PUMP_STRIPE_ENGINE_MAX];
+    int           error[PUMP_STRIPE_ENGINE_MAX];
+    unsigned int  locked  = 0;
+    unsigned int  setup   = 0;
+    unsigned int  started = 0;
+    unsigned int  i;
+    ssize_t       result  = 0;
+    u64           start_time;
 
-    this->is_open = 0;
+    for (i = 0; i < this->engine_nums; i++) {
+        if (mutex_lock_interruptible(&this->engine[i]->sem)) {
+            result = -ERESTARTSYS;
+            goto return_unlock;
+        }
+        locked++;
+        if (this->engine[i]->removed) {
+            result = -ENODEV;
+            goto return_unlock;
+        }
+        pump_batch_flush(this->engine[i], &this->engine[i]->batch_flush_sync_count);
+    }
+    /*
+     * 各PUMPにバッファの一部を割り当てる.
+     */
+    for (i = 0; i < this->engine_nums; i++) {
+        size_t offset = i * chunk_size;
+        int    status;
+        if (offset >= xfer_size)
+            break;
+        chunk[i] = min(chunk_size, xfer_size - offset);
+        error[i] = 0;
+        status = pump_buffer_setup(this->engine[i], buff + offset, &chunk[i], xfer_first, xfer_last);
+        if (status != 0) {
+            result = status;
+            goto return_release;
+        }
+        setup++;
+    }
+    /*
+     * 全てのPUMPを起動してから終了を待つ.
+     */
+    start_time = get_jiffies_64();
+    for (i = 0; i < setup; i++) {
+        int status = pump_xfer_start(this->engine[i]);
+        if (status != 0) {
+            result = status;
+            goto return_stop;
+        }
+        started++;
+    }
+    for (i = 0; i < started; i++) {
+        error[i] = pump_xfer_wait(this->engine[i]);
+    }
+    this->usec_pump_run += jiffies_to_usecs((unsigned long)(get_jiffies_64() - start_time));
+    /*
+     * 先頭から連続して終了した分だけを転送したバイト数として返す.
+     */
+    for (i = 0; i < started; i++) {
+        if (error[i] != 0) {
+            ssize_t partial = pump_xfer_result(this->engine[i], error[i], chunk[i]);
+            if (partial > 0)
+                result += partial;
+            else if (result == 0)
+                result = error[i];
+            break;
+        }
+        result += chunk[i];
+        if (chunk[i] < min(chunk_size, xfer_size - i * chunk_size))
+            break;
+    }
+    goto return_release;
 
-    return 0;
+ return_stop:
+    for (i = 0; i < started; i++) {
+        if (pump_xfer_stop(this->engine[i]) != 0)
+            result = -EBUSY;
+    }
+ return_release:
+    for (i = 0; i < setup; i++)
+        pump_buffer_release(this->engine[i]);
+ return_unlock:
+    for (i = 0; i < locked; i++)
+        mutex_unlock(&this->engine[i]->sem);
+    return result;
 }
 
 /**
- *
+ * pump_stripe_open() - The is the striped device open function.
  */
-static void pump_done_work(struct pump_driver_data* this)
+static int pump_stripe_open(struct inode *inode, struct file *file)
 {
-    wake_up_interruptible(&this->wait_queue);
+    struct pump_stripe_data* this = container_of(inode->i_cdev, struct pump_stripe_data, cdev);
+    file->private_data  = this;
+    this->usec_pump_run = 0;
+    return 0;
 }
 
 /**
- * pump_irq() - The main interrupt handler.
- * @irq:	The interrupt number.
- * @data:	Pointer to the driver data structure.
- * returns: IRQ_HANDLED after the interrupt is handled.
- **/
-static irqreturn_t pump_irq(int irq, void *data)
+ * pump_stripe_release() - The is the striped device release function.
+ */
+static int pump_stripe_release(struct inode *inode, struct file *file)
 {
-    struct pump_driver_data* this = data;
-    return pump_proc_irq(&this->pump_proc_data);
+    return 0;
 }
 
 /**
- * pump_read() - The is the driver read function.
- * @file:	Pointer to the file structure.
- * @buff:	Pointer to the user buffer.
- * @count:	The number of bytes to be written.
- * @ppos:	Pointer to the offset value
- * returns:	Success or error status.
+ * pump_stripe_read() - The is the striped device read function.
  */
-static ssize_t pump_read(struct file* file, char __user* buff, size_t count, loff_t* ppos)
+static ssize_t pump_stripe_read(struct file* file, char __user* buff, size_t count, loff_t* ppos)
 {
-    struct pump_driver_data* this       = file->private_data;
-    int                      result     = 0;
-    int                      status     = 0;
-    size_t                   xfer_size  = 0;
+    struct pump_stripe_data* this       = file->private_data;
+    ssize_t                  result;
+    size_t                   xfer_size;
     bool                     xfer_first = (*ppos == 0) ? 1 : 0;
     bool                     xfer_last;
-    u64                      start_time;
-    /*
-     *
-     */
+
     if (mutex_lock_interruptible(&this->sem))
         return -ERESTARTSYS;
-    /*
-     * limit_sizeを越える読み出しは、EOF(result=0)を返す.
-     */
+
     if (*ppos >= this->limit_size) {
         result = 0;
         goto return_unlock;
     }
-    /*
-     *
-     */
     if (*ppos + count >= this->limit_size) {
         xfer_last = 1;
         xfer_size = this->limit_size - *ppos;
-    }
-    else {
+    } else {
         xfer_last = 0;
         xfer_size = count;
     }
-    /*
-     *
-     */
-    status = pump_buffer_setup(
-                 this        , /* struct pump_driver_data* this       */
-                 buff        , /* char __user*             buff       */
-                 &xfer_size  , /* size_t*                  xfer_size  */
-                 xfer_first  , /* bool                     xfer_first */
-                 xfer_last     /* bool                     xfer_last  */
-    );
-    if (status != 0) {
-        result = status;
-        goto return_unlock;
-    }
-    /*
-     *
-     */
-    start_time = get_jiffies_64();
-    status = pump_proc_start(&this->pump_proc_data, &this->pump_buf_list);
-    if (status != 0) {
-        result = status;
-        goto return_release;
-    }
-    status = wait_event_interruptible_timeout(
-                 this->wait_queue                    , /* wait_queue_head_t wq */
-                 (this->pump_proc_data.status != 0)  , /* bool condition       */
-                 msecs_to_jiffies(this->timeout_msec)  /* long timeout         */
-             );
-    if (status == 0) {
-        pump_proc_stop(&this->pump_proc_data);
-        result = -ETIMEDOUT;
-        goto return_release;
-    }
-    this->usec_pump_run += jiffies_to_usecs((unsigned long)(get_jiffies_64() - start_time));
-    if (0) {
-        dev_info(this->dev, "STAT=%08X\n", this->pump_proc_data.status);
-        dev_info(this->dev, "CORE=%08X,%08X,%08X\n", 
-                 regs_read(this->core_regs_addr+ 0),
-                 regs_read(this->core_regs_addr+ 8),
-                 regs_read(this->core_regs_addr+12));
-        dev_info(this->dev, "PROC=%08X,%08X,%08X\n", 
-                 regs_read(this->proc_regs_addr+ 0),
-                 regs_read(this->proc_regs_addr+ 8),
-                 regs_read(this->proc_regs_addr+12));
-    }
-    /*
-     *
-     */
-    *ppos += xfer_size;
-    result = xfer_size;
-    /*
-     *
-     */
- return_release:
-    pump_buffer_release(this);
+    result = pump_stripe_xfer(this, buff, xfer_size, xfer_first, xfer_last);
+    if (result > 0)
+        *ppos += result;
+
  return_unlock:
     mutex_unlock(&this->sem);
     return result;
 }
 
 /**
- * pump_write() - The is the driver write function.
- * @file:	Pointer to the file structure.
- * @buff:	Pointer to the user buffer.
- * @count:	The number of bytes to be written.
- * @ppos:	Pointer to the offset value
- * returns:	Success or error status.
+ * pump_stripe_write() - The is the striped device write function.
  */
-static ssize_t pump_write(struct file* file, const char __user* buff, size_t count, loff_t* ppos)
+static ssize_t pump_stripe_write(struct file* file, const char __user* buff, size_t count, loff_t* ppos)
 {
-    struct pump_driver_data* this       = file->private_data;
-    int                      result     = 0;
-    int                      status     = 0;
-    size_t                   xfer_size  = count;
+    struct pump_stripe_data* this       = file->private_data;
+    ssize_t                  result;
+    size_t                   xfer_size;
     bool                     xfer_first = (*ppos == 0) ? 1 : 0;
     bool                     xfer_last;
-    u64                      start_time;
-    /*
-     *
-     */
+
     if (mutex_lock_interruptible(&this->sem))
         return -ERESTARTSYS;
-    /*
-     * limit_sizeを越える書き込みは、書いたフリをする.
-     */
+
     if (*ppos >= this->limit_size) {
         *ppos += count;
         result = count;
         goto return_unlock;
     }
-    /*
-     *
-     */
     if (*ppos + count >= this->limit_size) {
         xfer_last = 1;
         xfer_size = this->limit_size - *ppos;
-    }
-    else {
+    } else {
         xfer_last = 0;
         xfer_size = count;
     }
-    /*
-     *
-     */
-    status = pump_buffer_setup(
-                 this        , /* struct pump_driver_data* this       */
-                 buff        , /* char __user*             buff       */
-                 &xfer_size  , /* size_t*                  xfer_size  */
-                 xfer_first  , /* bool                     xfer_first */
-                 xfer_last     /* bool                     xfer_last  */
-    );
-    if (status != 0) {
-        result = status;
-        goto return_unlock;
-    }
-    /*
-     *
-     */
-    start_time = get_jiffies_64();
-    status = pump_proc_start(&this->pump_proc_data, &this->pump_buf_list);
-    if (status != 0) {
-        result = status;
-        goto return_release;
-    }
-    status = wait_event_interruptible_timeout(
-                 this->wait_queue                    , /* wait_queue_head_t wq */
-                 (this->pump_proc_data.status != 0)  , /* bool condition       */
-                 msecs_to_jiffies(this->timeout_msec)  /* long timeout         */
-             );
-    if (status == 0) {
-        pump_proc_stop(&this->pump_proc_data);
-        result = -ETIMEDOUT;
-        goto return_release;
-    }
-    this->usec_pump_run += jiffies_to_usecs((unsigned long)(get_jiffies_64() - start_time));
-    if (0) {
-        dev_info(this->dev, "STAT=%08X\n", this->pump_proc_data.status);
-        dev_info(this->dev, "CORE=%08X,%08X,%08X\n", 
-                 regs_read(this->core_regs_addr+ 0),
-                 regs_read(this->core_regs_addr+ 8),
-                 regs_read(this->core_regs_addr+12));
-        dev_info(this->dev, "PROC=%08X,%08X,%08X\n", 
-                 regs_read(this->proc_regs_addr+ 0),
-                 regs_read(this->proc_regs_addr+ 8),
-                 regs_read(this->proc_regs_addr+12));
-    }
-    /*
-     *
-     */
-    *ppos += xfer_size;
-    result = xfer_size;
-    /*
-     *
-     */
- return_release:
-    pump_buffer_release(this);
+    result = pump_stripe_xfer(this, (char __user*)buff, xfer_size, xfer_first, xfer_last);
+    if (result > 0)
+        *ppos += result;
+
  return_unlock:
     mutex_unlock(&this->sem);
     return result;
 }
 
-/**
- *
- */
-static const struct file_operations pump_driver_intake_fops = {
+static const struct file_operations pump_stripe_intake_fops = {
     .owner   = THIS_MODULE,
-    .open    = pump_open,
-    .release = pump_release,
-    .write   = pump_write,
+    .open    = pump_stripe_open,
+    .release = pump_stripe_release,
+    .write   = pump_stripe_write,
 };
-static const struct file_operations pump_driver_outlet_fops = {
+static const struct file_operations pump_stripe_outlet_fops = {
     .owner   = THIS_MODULE,
-    .open    = pump_open,
-    .release = pump_release,
-    .read    = pump_read,
+    .open    = pump_stripe_open,
+    .release = pump_stripe_release,
+    .read    = pump_stripe_read,
 };
 
 /**
- * pump_driver_probe() -  Probe call for the device.
+ * pump_stripe_put_engines() - Drop the references to the member engines.
+ */
+static void pump_stripe_put_engines(struct pump_stripe_data* this)
+{
+    unsigned int i;
+    for (i = 0; i < this->engine_nums; i++) {
+        if (this->engine[i] != NULL)
+            kref_put(&this->engine[i]->kref, pump_driver_free);
+        if (this->engine_pdev[i] != NULL)
+            put_device(&this->engine_pdev[i]->dev);
+        this->engine_pdev[i] = NULL;
+        this->engine[i]      = NULL;
+    }
+    this->engine_nums = 0;
+}
+
+/**
+ * pump_stripe_probe() -  Probe call for the striped device.
  *
  * @pdev:	handle to the platform device structure.
  * Returns 0 on success, negative error otherwise.
- *
- * It does all the memory allocation and registration for the device.
  */
-static int pump_driver_probe(struct platform_device *pdev)
-{
-    struct pump_driver_data*    this     = NULL;
-    int                         result   = 0;
-    unsigned int                done     = 0;
-    const unsigned int          DONE_ADD_CHRDEV             = (1 <<  0);
-    const unsigned int          DONE_GET_CORE_REGS_RESOUCE  = (1 <<  1);
-    const unsigned int          DONE_REQ_CORE_REGS_REGION   = (1 <<  2);
-    const unsigned int          DONE_MAP_CORE_REGS_ADDR     = (1 <<  3);
-    const unsigned int          DONE_GET_PROC_REGS_RESOUCE  = (1 <<  4);
-    const unsigned int          DONE_REQ_PROC_REGS_REGION   = (1 <<  5);
-    const unsigned int          DONE_MAP_PROC_REGS_ADDR     = (1 <<  6);
-    const unsigned int          DONE_DEVICE_CREATE          = (1 <<  7);
-    const unsigned int          DONE_GET_IRQ_RESOUCE        = (1 <<  8);
-    const unsigned int          DONE_IRQ_REQUEST            = (1 <<  9);
-    const unsigned int          DONE_PUMP_PROC_SETUP        = (1 << 10);
-    unsigned long               core_regs_addr = 0L;
-    unsigned long               core_regs_size = 0L;
-    unsigned long               proc_regs_addr = 0L;
-    unsigned long               proc_regs_size = 0L;
-    char*                       device_name;
+static int pump_stripe_probe(struct platform_device *pdev)
+{
+    struct pump_stripe_data*    this     = NULL;
+    int                         result   = 0;
+    unsigned int                done     = 0;
+    const unsigned int          DONE_ADD_CHRDEV             = (1 <<  0);
+    const unsigned int          DONE_DEVICE_CREATE          = (1 <<  1);
+    int                         engine_nums;
+    unsigned int                i;
 
-#if (PUMP_DEBUG == 1)
-    dev_info(&pdev->dev, "PUMP Driver probe start\n");
-#endif
-    /*
-     * create (pump_driver_data*)this.
-     */
-    {
-        this = kzalloc(sizeof(*this), GFP_KERNEL);
-        if (IS_ERR_OR_NULL(this)) {
-            dev_err(&pdev->dev, "couldn't allocate device private record\n");
-            result = PTR_ERR(this);
-            this = NULL;
-            goto failed;
-        }
-        dev_set_drvdata(&pdev->dev, this);
+    this = kzalloc(sizeof(*this), GFP_KERNEL);
+    if (IS_ERR_OR_NULL(this)) {
+        dev_err(&pdev->dev, "couldn't allocate device private record\n");
+        return -ENOMEM;
     }
+    dev_set_drvdata(&pdev->dev, this);
     /*
      * get device number
      */
     {
         u32 minor_number;
-        int status;
-        status = of_property_read_u32(pdev->dev.of_node, "minor-number", &minor_number);
-        if (status != 0) {
+        if (of_property_read_u32(pdev->dev.of_node, "minor-number", &minor_number) != 0) {
             dev_err(&pdev->dev, "invalid property minor number\n");
             result = -ENODEV;
             goto failed;
@@ -864,272 +4717,134 @@ static int pump_driver_probe(struct platform_device *pdev)
         this->device_number = MKDEV(MAJOR(pump_device_number), MINOR(minor_number));
     }
     /*
-     * get direction to make this->direction
-     */
-    {
-        u32 direction;
-        int status;          
-        status = of_property_read_u32(pdev->dev.of_node, "direction", &direction);
-        if ((status != 0) || (direction > 1)) {
-            dev_err(&pdev->dev, "invalid property direction \n");
-            result = -ENODEV;
-            goto failed;
-        }
-        this->direction = direction;
-    }
-    /*
-     * device create to this->dev and device_name
+     * look up the member engines. they must all have the same direction.
      */
-    {
-        this->dev = device_create(
-                        pump_sys_class           , /* struct class*  class   */
-                        NULL                     , /* struct device* parent  */
-                        this->device_number      , /* dev_t          devt    */
-                        (void *)this             , /* void*          drvdata */
-                        DEVICE_NAME_FORMAT       , /* const char*    fmt     */
-                        MINOR(this->device_number) /* ...                    */
-                    );
-        if (IS_ERR_OR_NULL(this->dev)) {
-            dev_err(&pdev->dev, "device_create() failed\n");
-            result = PTR_ERR(this->dev);
-            this->dev = NULL;
-            goto failed;
-        }
-        device_name = dev_name(this->dev);
-        dma_set_coherent_mask(this->dev, 0xFFFFFFFF);
-        done |= DONE_DEVICE_CREATE;
+    engine_nums = of_count_phandle_with_args(pdev->dev.of_node, "pump-engines", NULL);
+    if ((engine_nums < 1) || (engine_nums > PUMP_STRIPE_ENGINE_MAX)) {
+        dev_err(&pdev->dev, "invalid property pump-engines\n");
+        result = -ENODEV;
+        goto failed;
     }
-    /*
-     * get core register resouce and ioremap to this->core_regs_addr
-     */
-    {
-        this->core_regs_res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
-        if (this->core_regs_res == NULL) {
-            dev_err(&pdev->dev, "invalid register address\n");
+    for (i = 0; i < engine_nums; i++) {
+        struct device_node*      np   = of_parse_phandle(pdev->dev.of_node, "pump-engines", i);
+        struct platform_device*  engine_pdev;
+        struct pump_driver_data* engine;
+        if (np == NULL) {
+            dev_err(&pdev->dev, "invalid property pump-engines[%d]\n", i);
             result = -ENODEV;
             goto failed;
         }
-        done |= DONE_GET_CORE_REGS_RESOUCE;
-        core_regs_addr = this->core_regs_res->start;
-        core_regs_size = this->core_regs_res->end - this->core_regs_res->start + 1;
-
-        if (request_mem_region(core_regs_addr, core_regs_size, device_name) == NULL) {
-            dev_err(&pdev->dev, "couldn't lock memory region at %pr\n", this->core_regs_res);
-            result = -EBUSY;
+        engine_pdev = of_find_device_by_node(np);
+        of_node_put(np);
+        if (engine_pdev == NULL) {
+            result = -EPROBE_DEFER;
             goto failed;
         }
-        done |= DONE_REQ_CORE_REGS_REGION;
-
-        this->core_regs_addr = ioremap_nocache(core_regs_addr, core_regs_size);
-        if (this->core_regs_addr == NULL) {
-            dev_err(&pdev->dev, "ioremap(%pr) failed\n", this->core_regs_res);
-            result = -ENODEV;
+        this->engine_pdev[i] = engine_pdev;
+        this->engine_nums    = i+1;
+        /*
+         * remove と競合しないようにデバイスロックの下で参照を取る.
+         */
+        device_lock(&engine_pdev->dev);
+        engine = platform_get_drvdata(engine_pdev);
+        if (engine != NULL)
+            kref_get(&engine->kref);
+        device_unlock(&engine_pdev->dev);
+        if (engine == NULL) {
+            result = -EPROBE_DEFER;
             goto failed;
         }
-        done |= DONE_MAP_CORE_REGS_ADDR;
-    }
-    /*
-     * get proc register resouce and ioremap to this->prco_regs_addr
-     */
-    {
-        this->proc_regs_res = platform_get_resource(pdev, IORESOURCE_MEM, 1);
-        if (this->proc_regs_res != NULL) {
-            proc_regs_addr = this->proc_regs_res->start;
-            proc_regs_size = this->proc_regs_res->end - this->proc_regs_res->start + 1;
-
-            if (request_mem_region(proc_regs_addr, proc_regs_size, device_name) == NULL) {
-                dev_err(&pdev->dev, "couldn't lock memory region at %pr\n", this->proc_regs_res);
-                result = -EBUSY;
-                goto failed;
-            }
-            done |= DONE_REQ_PROC_REGS_REGION;
-
-            this->proc_regs_addr = ioremap_nocache(proc_regs_addr, proc_regs_size);
-            if (this->proc_regs_addr == NULL) {
-                dev_err(&pdev->dev, "ioremap(%pr) failed\n", this->proc_regs_res);
-                result = -ENODEV;
-                goto failed;
-            }
-            done |= DONE_MAP_PROC_REGS_ADDR;
+        this->engine[i] = engine;
+        strlcpy(this->engine_name[i], dev_name(engine->dev), sizeof(this->engine_name[i]));
+        if ((i > 0) && (engine->direction != this->engine[0]->direction)) {
+            dev_err(&pdev->dev, "pump-engines[%d] has different direction\n", i);
+            result = -EINVAL;
+            goto failed;
         }
-        done |= DONE_GET_PROC_REGS_RESOUCE;
     }
+    this->direction   = this->engine[0]->direction;
+    this->limit_size  = 0xFFFFFFFF;
+    this->stripe_unit = PUMP_STRIPE_UNIT_DEF;
+    mutex_init(&this->sem);
     /*
-     * get interrupt number to this->irq
+     * device create
      */
-    {
-        this->irq_res = platform_get_resource(pdev, IORESOURCE_IRQ, 0);
-        if (this->irq_res == NULL) {
-            dev_err(&pdev->dev, "interrupt not found\n");
-            result = -ENODEV;
-            goto failed;
-        }
-        done |= DONE_GET_IRQ_RESOUCE;
-
-        this->irq = this->irq_res->start;
-
-        if (request_irq(this->irq, pump_irq, IRQF_DISABLED | IRQF_SHARED, device_name, this) != 0) {
-            dev_err(&pdev->dev, "request_irq(%pr) failed\n", this->irq_res);
-            result = -EBUSY;
-            goto failed;
-        }
-        done |= DONE_IRQ_REQUEST;
+    this->dev = device_create(
+                    pump_stripe_sys_class    , /* struct class*  class   */
+                    NULL                     , /* struct device* parent  */
+                    this->device_number      , /* dev_t          devt    */
+                    (void *)this             , /* void*          drvdata */
+                    DEVICE_STRIPE_NAME_FORMAT, /* const char*    fmt     */
+                    MINOR(this->device_number) /* ...                    */
+                );
+    if (IS_ERR_OR_NULL(this->dev)) {
+        dev_err(&pdev->dev, "device_create() failed\n");
+        result = PTR_ERR(this->dev);
+        this->dev = NULL;
+        goto failed;
     }
+    done |= DONE_DEVICE_CREATE;
     /*
      * add chrdev.
      */
-    {
-        if (this->direction == 0)
-            cdev_init(&this->cdev, &pump_driver_outlet_fops);
-        else
-            cdev_init(&this->cdev, &pump_driver_intake_fops);
-        this->cdev.owner = THIS_MODULE;
-        if (cdev_add(&this->cdev, this->device_number, 1) != 0) {
-            dev_err(&pdev->dev, "cdev_add() failed\n");
-            result = -ENODEV;
-            goto failed;
-        }
-        done |= DONE_ADD_CHRDEV;
+    if (this->direction == 0)
+        cdev_init(&this->cdev, &pump_stripe_outlet_fops);
+    else
+        cdev_init(&this->cdev, &pump_stripe_intake_fops);
+    this->cdev.owner = THIS_MODULE;
+    if (cdev_add(&this->cdev, this->device_number, 1) != 0) {
+        dev_err(&pdev->dev, "cdev_add() failed\n");
+        result = -ENODEV;
+        goto failed;
     }
-    /*
-     *
-     */
-    this->limit_size   = 0xFFFFFFFF;
-    this->timeout_msec = PUMP_TIMEOUT_DEF;
-    this->usec_buffer_setup   = 0;
-    this->usec_buffer_release = 0;
-    this->usec_pump_run       = 0;
-    mutex_init(&this->sem);
-    INIT_LIST_HEAD(&this->pump_buf_list);
-    init_waitqueue_head(&this->wait_queue);
+    done |= DONE_ADD_CHRDEV;
 
 #if (PUMP_DEBUG == 1)
-    this->debug_phase     = 0;
-    this->debug_op_table  = 0;
-    this->debug_sg_table  = 0;
-    this->debug_interrupt = 0;
-#endif   
-    /*
-     *
-     */
-    {
-        int status;
-        status = pump_proc_setup(
-                     &this->pump_proc_data, /* struct pump_proc_data* this        */
-                     this->dev            , /* struct device*         dev         */
-                     this->direction      , /* int                    direction   */
-                     this->proc_regs_addr , /* void __iomem*          regs_addr   */
-                     pump_done_work       , /* void                   (*done_func)*/
-                     (void*)this            /* void*                  done_arg    */
-                 );
-        this->pump_proc_data.link_mode = PUMP_LINK_AXI_MODE;
-        done |= DONE_PUMP_PROC_SETUP;
-    }
-    /*
-     *
-     */
-#if (PUMP_DEBUG == 1)
-    {
-        dev_info(this->dev, "driver installed\n");
-        dev_info(this->dev, "private record     = %pK (%dbytes)\n", this, sizeof(*this));
-        dev_info(this->dev, "direction          = %d\n"           , this->direction);
-        dev_info(this->dev, "major number       = %d\n"           , MAJOR(this->device_number));
-        dev_info(this->dev, "minor number       = %d\n"           , MINOR(this->device_number));
-        dev_info(this->dev, "core regs resource = %pr\n"          , this->core_regs_res );
-        dev_info(this->dev, "core regs address  = %pK\n"          , this->core_regs_addr);
-    }
-    if (this->proc_regs_res != NULL) {
-        dev_info(this->dev, "proc regs resource = %pr\n"          , this->proc_regs_res );
-        dev_info(this->dev, "proc regs address  = %pK\n"          , this->proc_regs_addr);
-    }
-    { 
-        dev_info(this->dev, "irq resource       = %pr\n"          , this->irq_res  );
-    }
+    dev_info(this->dev, "striped device installed (%d engines)\n", this->engine_nums);
 #endif
     return 0;
 
  failed:
-    if (done & DONE_PUMP_PROC_SETUP     ) { pump_proc_cleanup(&this->pump_proc_data);}
-    if (done & DONE_IRQ_REQUEST         ) { free_irq(this->irq, this); }
-    if (done & DONE_DEVICE_CREATE       ) { device_destroy(pump_sys_class, this->device_number);}
-    if (done & DONE_MAP_CORE_REGS_ADDR  ) { iounmap(this->core_regs_addr); }
-    if (done & DONE_REQ_CORE_REGS_REGION) { release_mem_region(core_regs_addr, core_regs_size);}
-    if (done & DONE_MAP_PROC_REGS_ADDR  ) { iounmap(this->proc_regs_addr); }
-    if (done & DONE_REQ_PROC_REGS_REGION) { release_mem_region(proc_regs_addr, proc_regs_size);}
-    if (done & DONE_ADD_CHRDEV          ) { cdev_del(&this->cdev); }
-    if (this != NULL)                     { kfree(this); }
+    if (done & DONE_ADD_CHRDEV   ) { cdev_del(&this->cdev); }
+    if (done & DONE_DEVICE_CREATE) { device_destroy(pump_stripe_sys_class, this->device_number);}
+    pump_stripe_put_engines(this);
+    dev_set_drvdata(&pdev->dev, NULL);
+    kfree(this);
     return result;
 }
 
-
 /**
- * pump_driver_remove() -  Remove call for the device.
- *
- * @pdev:	handle to the platform device structure.
- * Returns 0 or error status.
- *
- * Unregister the device after releasing the resources.
+ * pump_stripe_remove() -  Remove call for the striped device.
  */
-static int pump_driver_remove(struct platform_device *pdev)
+static int pump_stripe_remove(struct platform_device *pdev)
 {
-    struct pump_driver_data* this  = dev_get_drvdata(&pdev->dev);
+    struct pump_stripe_data* this = dev_get_drvdata(&pdev->dev);
 
     if (!this)
         return -ENODEV;
 
-    pump_proc_clear_buf_list(&this->pump_proc_data, &this->pump_buf_list);
-    pump_proc_cleanup(&this->pump_proc_data);
-
-    device_destroy(pump_sys_class, this->device_number);
-
-    free_irq(this->irq, this);
-
-    if (this->core_regs_addr != NULL) {
-        unsigned long regs_addr = this->core_regs_res->start;
-        unsigned long regs_size = this->core_regs_res->end - this->core_regs_res->start + 1;
-        iounmap(this->core_regs_addr);
-        release_mem_region(regs_addr, regs_size);
-    }
-
-    if (this->proc_regs_addr != NULL) {
-        unsigned long regs_addr = this->proc_regs_res->start;
-        unsigned long regs_size = this->proc_regs_res->end - this->proc_regs_res->start + 1;
-        iounmap(this->proc_regs_addr);
-        release_mem_region(regs_addr, regs_size);
-    }
-
     cdev_del(&this->cdev);
-
+    device_destroy(pump_stripe_sys_class, this->device_number);
+    pump_stripe_put_engines(this);
     kfree(this);
-
     dev_set_drvdata(&pdev->dev, NULL);
-
-#if (PUMP_DEBUG == 1)
-    dev_info(&pdev->dev, "driver unloaded\n");
-#endif
     return 0;
 }
 
-/**
- * Open Firmware Device Identifier Matching Table
- */
-static struct of_device_id pump_of_match[] = {
-    { .compatible = "ikwzm,pump-0.70.a", },
+static struct of_device_id pump_stripe_of_match[] = {
+    { .compatible = "ikwzm,pump-stripe-0.70.a", },
     { /* end of table */}
 };
 
-MODULE_DEVICE_TABLE(of, pump_of_match);
+MODULE_DEVICE_TABLE(of, pump_stripe_of_match);
 
-/**
- * Platform Driver Structure
- */
-static struct platform_driver pump_platform_driver = {
-    .probe  = pump_driver_probe,
-    .remove = pump_driver_remove,
+static struct platform_driver pump_stripe_platform_driver = {
+    .probe  = pump_stripe_probe,
+    .remove = pump_stripe_remove,
     .driver = {
         .owner = THIS_MODULE,
-        .name  = DRIVER_NAME,
-        .of_match_table = pump_of_match,
+        .name  = DRIVER_NAME "-stripe",
+        .of_match_table = pump_stripe_of_match,
     },
 };
 
@@ -1143,6 +4858,8 @@ static int __init pump_module_init(void)
     const unsigned int DONE_ALLOC_CHRDEV    = (1 << 0);
     const unsigned int DONE_CREATE_CLASS    = (1 << 1);
     const unsigned int DONE_REGISTER_DRIVER = (1 << 2);
+    const unsigned int DONE_CREATE_STRIPE_CLASS    = (1 << 3);
+    const unsigned int DONE_REGISTER_STRIPE_DRIVER = (1 << 4);
 
     result = alloc_chrdev_region(&pump_device_number, 0, 0, DRIVER_NAME);
     if (result != 0) {
@@ -1162,6 +4879,13 @@ static int __init pump_module_init(void)
 
     done |= DONE_CREATE_CLASS;
 
+    /*
+     * debugfs は無くても動作するので、失敗してもエラーにしない.
+     */
+    pump_debugfs_root = debugfs_create_dir(DRIVER_NAME, NULL);
+    if (IS_ERR_OR_NULL(pump_debugfs_root))
+        pump_debugfs_root = NULL;
+
     result = platform_driver_register(&pump_platform_driver);
     if (result) {
         printk(KERN_ERR "%s: couldn't register platform driver\n", DRIVER_NAME);
@@ -1169,11 +4893,31 @@ static int __init pump_module_init(void)
     }
     done |= DONE_REGISTER_DRIVER;
 
+    pump_stripe_sys_class = class_create(THIS_MODULE, DRIVER_NAME "_stripe");
+    if (IS_ERR_OR_NULL(pump_stripe_sys_class)) {
+        printk(KERN_ERR "%s: couldn't create stripe sys class\n", DRIVER_NAME);
+        result = PTR_ERR(pump_stripe_sys_class);
+        pump_stripe_sys_class = NULL;
+        goto failed;
+    }
+    SET_STRIPE_SYS_CLASS_ATTRIBUTES(pump_stripe_sys_class);
+
+    done |= DONE_CREATE_STRIPE_CLASS;
+
+    result = platform_driver_register(&pump_stripe_platform_driver);
+    if (result) {
+        printk(KERN_ERR "%s: couldn't register stripe platform driver\n", DRIVER_NAME);
+        goto failed;
+    }
+    done |= DONE_REGISTER_STRIPE_DRIVER;
+
     return 0;
 
  failed:
+    if (done & DONE_REGISTER_STRIPE_DRIVER){platform_driver_unregister(&pump_stripe_platform_driver);}
+    if (done & DONE_CREATE_STRIPE_CLASS   ){class_destroy(pump_stripe_sys_class);}
     if (done & DONE_REGISTER_DRIVER){platform_driver_unregister(&pump_platform_driver);}
-    if (done & DONE_CREATE_CLASS   ){class_destroy(pump_sys_class);}
+    if (done & DONE_CREATE_CLASS   ){class_destroy(pump_sys_class); debugfs_remove_recursive(pump_debugfs_root);}
     if (done & DONE_ALLOC_CHRDEV   ){unregister_chrdev_region(pump_device_number, 0);}
 
     return result;
@@ -1184,7 +4928,10 @@ static int __init pump_module_init(void)
  */
 static void __exit pump_module_exit(void)
 {
+    platform_driver_unregister(&pump_stripe_platform_driver);
+    class_destroy(pump_stripe_sys_class);
     platform_driver_unregister(&pump_platform_driver);
+    debugfs_remove_recursive(pump_debugfs_root);
     class_destroy(pump_sys_class);
     unregister_chrdev_region(pump_device_number, 0);
 }
@@ -0,0 +1,241 @@
+/*
+ * pump_evlog.c
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "pump_evlog.h"
+
+/**
+ * pump_evlog_commit() - Append an entry to the ring.
+ *
+ * Writers never block: each one claims a slot with one atomic increment.
+ * The slot's seq is cleared while it is being filled so that a concurrent
+ * reader can tell a torn entry from a complete one.
+ */
+void pump_evlog_commit(struct pump_evlog* this, const struct pump_evlog_entry* entry)
+{
+    struct pump_evlog_entry* slot;
+    u32                      seq;
+
+    if (this->ring == NULL)
+        return;
+
+    seq  = (u32)atomic_inc_return(&this->head);
+    slot = &this->ring[(seq - 1) & (this->size - 1)];
+
+    ACCESS_ONCE(slot->seq) = 0;
+    smp_wmb();
+    memcpy((char*)slot  + sizeof(slot->seq),
+           (char*)entry + sizeof(entry->seq),
+           sizeof(*entry) - sizeof(entry->seq));
+    smp_wmb();
+    ACCESS_ONCE(slot->seq) = seq;
+}
+
+/**
+ * pump_evlog_snapshot() - Copy the complete entries, oldest first.
+ * returns:	Number of entries copied into @buf.
+ */
+static unsigned int pump_evlog_snapshot(struct pump_evlog* this, struct pump_evlog_entry* buf)
+{
+    u32          head  = (u32)atomic_read(&this->head);
+    u32          first = (head > this->size) ? head - this->size + 1 : 1;
+    unsigned int nums  = 0;
+    u32          seq;
+
+    for (seq = first; (seq != 0) && (seq <= head); seq++) {
+        struct pump_evlog_entry* slot = &this->ring[(seq - 1) & (this->size - 1)];
+        if (ACCESS_ONCE(slot->seq) != seq)
+            continue;
+        smp_rmb();
+        buf[nums] = *slot;
+        smp_rmb();
+        if ((ACCESS_ONCE(slot->seq) != seq) || (buf[nums].seq != seq))
+            continue;
+        nums++;
+    }
+    return nums;
+}
+
+/**
+ * struct pump_evlog_file - Snapshot taken when a debugfs file is opened
+ */
+struct pump_evlog_file {
+    unsigned int             nums;
+    struct pump_evlog_entry  entry[0];
+};
+
+static struct pump_evlog_file* pump_evlog_file_alloc(struct pump_evlog* this)
+{
+    struct pump_evlog_file* file_data;
+
+    file_data = vmalloc(sizeof(*file_data) + this->size * sizeof(struct pump_evlog_entry));
+    if (file_data == NULL)
+        return NULL;
+    file_data->nums = pump_evlog_snapshot(this, file_data->entry);
+    return file_data;
+}
+
+/**
+ * events.bin - struct pump_evlog_entry records, oldest first
+ */
+static int pump_evlog_bin_open(struct inode* inode, struct file* file)
+{
+    struct pump_evlog_file* file_data = pump_evlog_file_alloc(inode->i_private);
+    if (file_data == NULL)
+        return -ENOMEM;
+    file->private_data = file_data;
+    return 0;
+}
+
+static ssize_t pump_evlog_bin_read(struct file* file, char __user* buff, size_t count, loff_t* ppos)
+{
+    struct pump_evlog_file* file_data = file->private_data;
+    return simple_read_from_buffer(buff, count, ppos, file_data->entry,
+                                   file_data->nums * sizeof(struct pump_evlog_entry));
+}
+
+static int pump_evlog_bin_release(struct inode* inode, struct file* file)
+{
+    vfree(file->private_data);
+    return 0;
+}
+
+static const struct file_operations pump_evlog_bin_fops = {
+    .owner   = THIS_MODULE,
+    .open    = pump_evlog_bin_open,
+    .read    = pump_evlog_bin_read,
+    .release = pump_evlog_bin_release,
+};
+
+/**
+ * events - one line per entry, oldest first
+ */
+static int pump_evlog_text_show(struct seq_file* m, void* v)
+{
+    struct pump_evlog_file* file_data = m->private;
+    unsigned int            i;
+
+    seq_puts(m, "# seq timestamp_ns dir bytes sg_nums tables status result cpu"
+                " usec_pin usec_map usec_build usec_run usec_wakeup usec_release"
+                " head_bytes tail_bytes stop_bytes\n");
+    for (i = 0; i < file_data->nums; i++) {
+        struct pump_evlog_entry* entry = &file_data->entry[i];
+        seq_printf(m, "%u %llu %u %u %u %u 0x%02X %d %u %u %u %u %u %u %u %u %u %u\n",
+                   entry->seq, (unsigned long long)entry->timestamp, entry->direction,
+                   entry->bytes, entry->sg_nums, entry->table_nums,
+                   entry->status, entry->result, entry->cpu,
+                   entry->usec_pin, entry->usec_map, entry->usec_build,
+                   entry->usec_run, entry->usec_wakeup, entry->usec_release,
+                   entry->head_bytes, entry->tail_bytes, entry->stop_bytes);
+    }
+    return 0;
+}
+
+static int pump_evlog_text_open(struct inode* inode, struct file* file)
+{
+    struct pump_evlog_file* file_data = pump_evlog_file_alloc(inode->i_private);
+    int                     status;
+
+    if (file_data == NULL)
+        return -ENOMEM;
+    status = single_open(file, pump_evlog_text_show, file_data);
+    if (status != 0)
+        vfree(file_data);
+    return status;
+}
+
+static int pump_evlog_text_release(struct inode* inode, struct file* file)
+{
+    struct seq_file* m = file->private_data;
+    vfree(m->private);
+    return single_release(inode, file);
+}
+
+static const struct file_operations pump_evlog_text_fops = {
+    .owner   = THIS_MODULE,
+    .open    = pump_evlog_text_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = pump_evlog_text_release,
+};
+
+/**
+ * pump_evlog_setup() - Allocate the ring and create <parent>/<name>/events{,.bin}.
+ *
+ * Without debugfs nobody could read the ring, so it is not allocated and
+ * pump_evlog_commit() does nothing.
+ */
+int pump_evlog_setup(struct pump_evlog* this, struct dentry* parent, const char* name, unsigned int size)
+{
+    this->ring = NULL;
+    this->size = roundup_pow_of_two(max(size, 2U));
+    this->dir  = NULL;
+    atomic_set(&this->head, 0);
+
+    if (IS_ERR_OR_NULL(parent))
+        return 0;
+
+    this->dir = debugfs_create_dir(name, parent);
+    if (IS_ERR_OR_NULL(this->dir)) {
+        this->dir = NULL;
+        return 0;
+    }
+    this->ring = vzalloc(this->size * sizeof(struct pump_evlog_entry));
+    if (this->ring == NULL) {
+        debugfs_remove_recursive(this->dir);
+        this->dir = NULL;
+        return -ENOMEM;
+    }
+    debugfs_create_file("events"    , 0444, this->dir, this, &pump_evlog_text_fops);
+    debugfs_create_file("events.bin", 0444, this->dir, this, &pump_evlog_bin_fops );
+    return 0;
+}
+
+/**
+ * pump_evlog_cleanup()
+ */
+void pump_evlog_cleanup(struct pump_evlog* this)
+{
+    if (this->dir != NULL)
+        debugfs_remove_recursive(this->dir);
+    this->dir = NULL;
+    vfree(this->ring);
+    this->ring = NULL;
+}
@@ -0,0 +1,96 @@
+/*
+ * pump_evlog.h
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+#ifndef _PUMP_EVLOG_H_
+#define _PUMP_EVLOG_H_
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+
+struct dentry;
+
+/**
+ * struct pump_evlog_entry - One transfer in the event log
+ *
+ * The layout is also the record format of the binary debugfs file, so the
+ * fields have fixed sizes and only grow at the end.
+ */
+struct pump_evlog_entry {
+    u32  seq;           /* 1,2,3... 0 means the slot is being written */
+    u8   direction;
+    u8   status;        /* final STAT register bits                   */
+    u16  cpu;           /* CPU that ran the completion                */
+    u64  timestamp;     /* ktime_get() at the start of the transfer   */
+    u32  bytes;
+    u32  sg_nums;
+    u32  table_nums;    /* number of operation code tables            */
+    s32  result;
+    u32  usec_pin;      /* get_user_pages() or the bounce copy        */
+    u32  usec_map;      /* sg_table and dma_map_sg()                  */
+    u32  usec_build;    /* operation code tables                      */
+    u32  usec_run;      /* pump start to the status being reaped      */
+    u32  usec_wakeup;   /* status reaped to the waiter running again  */
+    u32  usec_release;  /* unmap and unpin                            */
+    u16  head_bytes;    /* misaligned head sent through a bounce      */
+    u16  tail_bytes;    /* misaligned tail sent through a bounce      */
+    u32  stop_bytes;    /* position a timed out or interrupted pump
+                           was stopped at                             */
+};
+
+/**
+ * struct pump_evlog - Ring of the last transfers of one device
+ */
+struct pump_evlog {
+    struct pump_evlog_entry* ring;
+    unsigned int             size;
+    atomic_t                 head;
+    struct dentry*           dir;
+};
+
+#define PUMP_EVLOG_ENTRIES_DEF  (256)
+
+int         pump_evlog_setup  (struct pump_evlog* this, struct dentry* parent, const char* name, unsigned int size);
+void        pump_evlog_cleanup(struct pump_evlog* this);
+void        pump_evlog_commit (struct pump_evlog* this, const struct pump_evlog_entry* entry);
+
+/**
+ * pump_evlog_lap() - Microseconds since *mark, and move *mark to now.
+ */
+static inline u32 pump_evlog_lap(ktime_t* mark)
+{
+    ktime_t now  = ktime_get();
+    s64     usec = ktime_us_delta(now, *mark);
+    *mark = now;
+    return (usec < 0) ? 0 : (u32)usec;
+}
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * pump_ioctl.h
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+#ifndef _PUMP_IOCTL_H_
+#define _PUMP_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/**
+ * ioctl interface of /dev/pumpN
+ *
+ * This header is shared by the driver and by user space programs.  Every
+ * structure uses fixed size fields so that the same layout is seen by 32bit
+ * and 64bit processes.
+ */
+#define PUMP_IOCTL_MAGIC            'P'
+
+/**
+ * struct pump_ioctl_buf_alloc - PUMP_IOCTL_BUF_ALLOC argument
+ * @size:	(in)  Size of the DMA buffer in bytes.
+ * @fd:		(out) dma-buf file descriptor of the new buffer.
+ *
+ * Allocates a DMA buffer on this device and exports it as a dma-buf.
+ * The buffer can be mmap()ed through the returned file descriptor and
+ * imported by this or any other dma-buf aware device.
+ */
+struct pump_ioctl_buf_alloc {
+    __u64  size;
+    __s32  fd;
+    __u32  reserved;
+};
+
+/**
+ * struct pump_ioctl_buf_import - PUMP_IOCTL_BUF_IMPORT argument
+ * @fd:		(in)  dma-buf file descriptor.
+ * @handle:	(out) Handle of the registered buffer.
+ * @size:	(out) Size of the buffer in bytes.
+ *
+ * Attaches and maps a dma-buf for this device.  The buffer stays
+ * registered until PUMP_IOCTL_BUF_RELEASE or until the file is closed.
+ */
+struct pump_ioctl_buf_import {
+    __s32  fd;
+    __u32  handle;
+    __u64  size;
+};
+
+/**
+ * struct pump_ioctl_buf_xfer - PUMP_IOCTL_BUF_XFER argument
+ * @handle:	(in)  Handle of the registered buffer.
+ * @flags:	(in)  PUMP_XFER_FIRST and/or PUMP_XFER_LAST.
+ * @offset:	(in)  Offset in the buffer.
+ * @length:	(in)  Number of bytes to transfer.
+ *
+ * Transfers a range of a registered buffer without pinning user memory;
+ * only that range is synced for the device and the CPU.  Returns the
+ * number of bytes transferred, so @length must not exceed INT_MAX.  A
+ * transfer interrupted by a signal returns the bytes done before the pump
+ * was stopped, or -EINTR if there were none.
+ */
+struct pump_ioctl_buf_xfer {
+    __u32  handle;
+    __u32  flags;
+    __u64  offset;
+    __u64  length;
+};
+
+/**
+ * struct pump_ioctl_stats - PUMP_IOCTL_GET_STATS argument
+ * @size:		(in)  sizeof(struct pump_ioctl_stats) of the caller.
+ * @timestamp_ns:	(out) CLOCK_MONOTONIC time of the snapshot.
+ * @bytes_per_sec:	(out) Rolling average over 1s, 10s and 60s.
+ * @ops_per_sec_x100:	(out) Rolling average over 1s, 10s and 60s, x100.
+ * @pinned_bytes:	(out) User memory pinned by the device now.
+ * @pinned_peak:	(out) Highest @pinned_bytes since the device was probed.
+ * @desc_bytes:	(out) Page lists and scatterlists allocated for them now.
+ * @desc_peak:		(out) Highest @desc_bytes since the device was probed.
+ *
+ * One consistent snapshot of every statistic of the device.  It never
+ * waits for a running transfer.  Fields are only ever appended; the
+ * driver fills min(@size, its own size) bytes.
+ */
+struct pump_ioctl_stats {
+    __u32  size;
+    __u32  reserved;
+    __u64  timestamp_ns;
+    __u64  usec_buffer_setup;
+    __u64  usec_buffer_release;
+    __u64  usec_pump_run;
+    __u64  xfer_bytes;
+    __u64  xfer_count;
+    __u64  xfer_errors;
+    __u64  irq_count;
+    __u64  irq_per_sec;
+    __u64  irq_none_count;
+    __u64  complete_count;
+    __u64  complete_per_sec;
+    __u64  bytes_per_sec[3];
+    __u64  ops_per_sec_x100[3];
+    __u64  pinned_bytes;
+    __u64  pinned_peak;
+    __u64  desc_bytes;
+    __u64  desc_peak;
+};
+
+/**
+ * struct pump_ioctl_session_side - One direction of PUMP_IOCTL_SESSION_XFER
+ * @addr:	(in)  User address of the buffer.
+ * @length:	(in)  Number of bytes to transfer.
+ * @flags:	(in)  PUMP_XFER_FIRST and/or PUMP_XFER_LAST.
+ * @result:	(out) Number of bytes transferred, error status, or 0 if
+ *		      this side was not run because the other side failed.
+ * @usec_setup:	(out) Pinning, mapping and building the operation codes.
+ * @usec_run:	(out) Pump start to the status being reaped.
+ * @usec_wakeup:(out) Status reaped to the caller running again.
+ * @usec_release:(out) Unmapping and unpinning.
+ */
+struct pump_ioctl_session_side {
+    __u64  addr;
+    __u64  length;
+    __u32  flags;
+    __s32  result;
+    __u32  usec_setup;
+    __u32  usec_run;
+    __u32  usec_wakeup;
+    __u32  usec_release;
+};
+
+/**
+ * struct pump_ioctl_session_xfer - PUMP_IOCTL_SESSION_XFER argument
+ * @intake:	Buffer written to the intake pump.
+ * @outlet:	Buffer read from the outlet pump.
+ *
+ * PUMP_IOCTL_SESSION_BIND(fd) binds the opposite direction pump opened as
+ * @fd to this file (-1 unbinds).  PUMP_IOCTL_SESSION_XFER on either file
+ * then starts the outlet and the intake together and returns when both
+ * are done, so one request/response round trip is a single system call.
+ * Returns 0 or the first error; the per side results are always written.
+ */
+struct pump_ioctl_session_xfer {
+    struct pump_ioctl_session_side intake;
+    struct pump_ioctl_session_side outlet;
+};
+
+/**
+ * struct pump_ioctl_prog_load - PUMP_IOCTL_PROG_LOAD argument
+ * @ops:	(in)  User address of an array of struct pump_ioctl_buf_xfer.
+ * @op_nums:	(in)  Number of ops, at most PUMP_PROG_OPS_MAX.
+ * @handle:	(out) Handle of the program.
+ *
+ * Each op names a range of a registered buffer and its own PUMP_XFER_FIRST
+ * and PUMP_XFER_LAST, so one program can carry a header, a payload and a
+ * trailer, or several messages.  The ops are checked against the
+ * registered buffers and compiled into one chain of operation codes,
+ * which PUMP_IOCTL_PROG_RUN(handle) then runs as one transfer and returns
+ * the number of bytes transferred, so the ops together must not exceed
+ * INT_MAX bytes.  A buffer used by a program can not be released until
+ * the program is released with PUMP_IOCTL_PROG_RELEASE or the file is
+ * closed.
+ */
+struct pump_ioctl_prog_load {
+    __u64  ops;
+    __u32  op_nums;
+    __u32  handle;
+};
+
+#define PUMP_PROG_OPS_MAX           (256)
+
+/**
+ * struct pump_ioctl_bypass - PUMP_IOCTL_BYPASS_ENTER argument
+ * @eventfd:	(in)  eventfd signalled on every completion interrupt.
+ * @desc_size:	(in)  Size of the descriptor region, at most
+ *		      PUMP_BYPASS_DESC_MAX.
+ * @desc_addr:	(out) Bus address of the descriptor region.
+ * @regs_size:	(out) Size of the PUMP_PROC registers.
+ * @regs_offset:(out) Offset of the registers in the mapped page.
+ *
+ * Hands the engine to the caller, who needs CAP_SYS_RAWIO and the
+ * bypass_enable attribute of the device set.  After this the file can
+ * mmap() the register page at PUMP_BYPASS_MMAP_REGS and the descriptor
+ * region at PUMP_BYPASS_MMAP_DESC, write operation codes into the region
+ * and start the engine through ADDR_LO/ADDR_HI/CTRL_STAT itself.  The
+ * driver only reaps the status on the interrupt, stores it in the
+ * struct pump_bypass_status at the start of the region and signals
+ * @eventfd.  Other transfers on the device fail with -EBUSY until the
+ * file is closed.  PUMP_IOCTL_BUF_ADDR gives the bus address of a
+ * registered buffer to put in the operation codes.
+ *
+ * The PUMP_PROC registers must start on a page boundary and fill whole
+ * pages (the reg entry of the device tree), so that the mapped page
+ * holds no other engine's registers; otherwise this ioctl fails with
+ * -EINVAL.  @regs_offset is then always 0.
+ *
+ * The engine is a bus master; nothing but CAP_SYS_RAWIO keeps the
+ * caller's operation codes inside the driver allocated buffers.
+ */
+struct pump_ioctl_bypass {
+    __s32  eventfd;
+    __u32  desc_size;
+    __u64  desc_addr;
+    __u32  regs_size;
+    __u32  regs_offset;
+};
+
+/**
+ * struct pump_bypass_status - Completion record at the start of the region
+ * @complete_count:	Incremented after @status is written.
+ * @status:		STAT register of the last completion.
+ */
+struct pump_bypass_status {
+    __u32  complete_count;
+    __u32  status;
+};
+
+/**
+ * struct pump_ioctl_buf_addr - PUMP_IOCTL_BUF_ADDR argument
+ * @handle:	(in)  Handle of a registered buffer.
+ * @addr:	(out) Bus address, if the buffer is one contiguous segment.
+ */
+struct pump_ioctl_buf_addr {
+    __u32  handle;
+    __u32  reserved;
+    __u64  addr;
+};
+
+#define PUMP_BYPASS_DESC_MAX        (1024*1024)
+#define PUMP_BYPASS_DESC_HEADER     (64)
+#define PUMP_BYPASS_MMAP_REGS       (0)
+#define PUMP_BYPASS_MMAP_DESC       (PUMP_BYPASS_DESC_MAX)
+
+#define PUMP_XFER_FIRST             (1 << 0)
+#define PUMP_XFER_LAST              (1 << 1)
+
+#define PUMP_IOCTL_BUF_ALLOC        _IOWR(PUMP_IOCTL_MAGIC, 0x10, struct pump_ioctl_buf_alloc )
+#define PUMP_IOCTL_BUF_IMPORT       _IOWR(PUMP_IOCTL_MAGIC, 0x11, struct pump_ioctl_buf_import)
+#define PUMP_IOCTL_BUF_RELEASE      _IOW( PUMP_IOCTL_MAGIC, 0x12, __u32                       )
+#define PUMP_IOCTL_BUF_XFER         _IOW( PUMP_IOCTL_MAGIC, 0x13, struct pump_ioctl_buf_xfer  )
+#define PUMP_IOCTL_SESSION_BIND     _IOW( PUMP_IOCTL_MAGIC, 0x14, __s32                       )
+#define PUMP_IOCTL_SESSION_XFER     _IOWR(PUMP_IOCTL_MAGIC, 0x15, struct pump_ioctl_session_xfer)
+#define PUMP_IOCTL_PROG_LOAD        _IOWR(PUMP_IOCTL_MAGIC, 0x16, struct pump_ioctl_prog_load )
+#define PUMP_IOCTL_PROG_RUN         _IOW( PUMP_IOCTL_MAGIC, 0x17, __u32                       )
+#define PUMP_IOCTL_PROG_RELEASE     _IOW( PUMP_IOCTL_MAGIC, 0x18, __u32                       )
+#define PUMP_IOCTL_BYPASS_ENTER     _IOWR(PUMP_IOCTL_MAGIC, 0x19, struct pump_ioctl_bypass    )
+#define PUMP_IOCTL_BUF_ADDR         _IOWR(PUMP_IOCTL_MAGIC, 0x1A, struct pump_ioctl_buf_addr  )
+#define PUMP_IOCTL_GET_STATS        _IOWR(PUMP_IOCTL_MAGIC, 0x20, struct pump_ioctl_stats     )
+
+#endif
@@ -33,6 +33,13 @@
 
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/cpumask.h>
+#include <linux/delay.h>
+#include <linux/cpu.h>
+#include <linux/workqueue.h>
 #include <asm/byteorder.h>
 
 /******************************************************************************
@@ -91,6 +98,7 @@
  * Control[5]  = 1:オペレーションを中止する.     0:意味無し.
  * Control[6]  = 1:オペレーションを一時中断する. 0:オペレーションを再開する.
  * Control[7]  = 1:モジュールをリセットする.     0:リセットを解除する.
+ * 読み出し時は Control[4] が動作中であることを示す.
  ******************************************************************************/
 #define PUMP_PROC_REGS_CTRL_POS    24
 #define PUMP_PROC_REGS_CTRL_MASK   (0xFF000000)
@@ -98,6 +106,8 @@
 #define PUMP_PROC_REGS_CTRL_STOP   (0x20)
 #define PUMP_PROC_REGS_CTRL_PAUSE  (0x40)
 #define PUMP_PROC_REGS_CTRL_RESET  (0x80)
+
+#define PUMP_PROC_STOP_WAIT_USEC   (1000)
 /******************************************************************************
  * Operation Code Foramt(TEMPLATE)
  ******************************************************************************
@@ -307,6 +317,8 @@ static unsigned int fill_xfer_opecodes(
     }
     return op_count;
 }
+struct static_key pump_debug_key = STATIC_KEY_INIT_FALSE;
+
 /******************************************************************************
  * Operation Code Table
  *****************************************************************************/
@@ -316,8 +328,76 @@ struct opecode_table {
     size_t               op_bytes;
     dma_addr_t           dma_addr;
     unsigned int         op_nums;
+    unsigned int         mem;
+    struct gen_pool*     ocm_pool;
+    struct scatterlist*  sg_start;
+    unsigned int         sg_count;
+    bool                 xfer_first;
+    bool                 xfer_last;
 };
+#define OPECODE_MEM_COHERENT      (0)
+#define OPECODE_MEM_CACHED        (1)
+#define OPECODE_MEM_OCM           (2)
 #define OPECODE_TABLE_MAX_ENTRIES (PAGE_SIZE /sizeof(struct opecode))
+/*
+ * cached な表は普通のメモリに作ってストリーミングマップし、書き終えてから
+ * dma_sync_single_for_device() でまとめて PUMP に見せる.
+ * コヒーレントメモリは ARM ではキャッシュされないので、オペレーションコードを
+ * 一つ書くたびに遅い書き込みになる.
+ * ocm_pool があればオンチップメモリから取り、足りなければDDRに作る.
+ * 失敗すると NULL を返す(ERR_PTR は返さない).
+ */
+static struct opecode* alloc_opecode_memory(struct device* dev, struct opecode_table* table, bool cached, struct gen_pool* ocm_pool)
+{
+    if (ocm_pool != NULL) {
+        unsigned long vaddr = gen_pool_alloc(ocm_pool, table->op_bytes);
+        if (vaddr != 0) {
+            table->mem      = OPECODE_MEM_OCM;
+            table->ocm_pool = ocm_pool;
+            table->dma_addr = gen_pool_virt_to_phys(ocm_pool, vaddr);
+            return (struct opecode*)vaddr;
+        }
+    }
+    table->mem = (cached) ? OPECODE_MEM_CACHED : OPECODE_MEM_COHERENT;
+    if (!cached)
+        return dma_alloc_coherent(dev, table->op_bytes, &table->dma_addr, GFP_KERNEL);
+    table->op_ptr = kmalloc(table->op_bytes, GFP_KERNEL);
+    if (table->op_ptr == NULL)
+        return NULL;
+    table->dma_addr = dma_map_single(dev, table->op_ptr, table->op_bytes, DMA_TO_DEVICE);
+    if (dma_mapping_error(dev, table->dma_addr)) {
+        kfree(table->op_ptr);
+        table->op_ptr = NULL;
+    }
+    return table->op_ptr;
+}
+static void free_opecode_memory(struct device* dev, struct opecode_table* table)
+{
+    if (table->mem == OPECODE_MEM_OCM) {
+        gen_pool_free(table->ocm_pool, (unsigned long)table->op_ptr, table->op_bytes);
+    } else if (table->mem == OPECODE_MEM_CACHED) {
+        dma_unmap_single(dev, table->dma_addr, table->op_bytes, DMA_TO_DEVICE);
+        kfree(table->op_ptr);
+    } else {
+        dma_free_coherent(
+            dev            , /* struct deivce* dev  */  
+            table->op_bytes, /* size_t size         */  
+            table->op_ptr  , /* void* vaddr         */  
+            table->dma_addr  /* dma_addr_t dma_addr */  
+        );
+    }
+}
+static inline void sync_opecode_table(struct device* dev, struct opecode_table* table, unsigned int op_first, unsigned int op_nums)
+{
+    if (table->mem == OPECODE_MEM_CACHED)
+        dma_sync_single_range_for_device(
+            dev                                , /* struct device* dev    */
+            table->dma_addr                    , /* dma_addr_t     addr   */
+            op_first * sizeof(struct opecode)  , /* unsigned long  offset */
+            op_nums  * sizeof(struct opecode)  , /* size_t         size   */
+            DMA_TO_DEVICE                        /* direction             */
+        );
+}
 static void free_opecode_table(struct device* dev, struct list_head* table_list)
 {
     if (!list_empty(table_list)) {
@@ -326,19 +406,91 @@ static void free_opecode_table(struct device* dev, struct list_head* table_list)
         struct list_head*     curr_head;
         list_for_each_safe(curr_head, next_head, table_list) {
             curr_table = list_entry(curr_head, struct opecode_table, list);
-            if (curr_table->op_ptr != NULL) {
-                dma_free_coherent(
-                    dev                 , /* struct deivce* dev  */  
-                    curr_table->op_bytes, /* size_t size         */  
-                    curr_table->op_ptr  , /* void* vaddr         */  
-                    curr_table->dma_addr  /* dma_addr_t dma_addr */  
-                );
-            }
+            if (curr_table->op_ptr != NULL)
+                free_opecode_memory(dev, curr_table);
             list_del(curr_head);
             kfree(curr_table);
         }
     }
 }
+
+/*
+ * 表ごとのXFERの書き込みは互いに独立なので、表が多いときは他のCPUにも
+ * 分けて書かせる. LINK/NONE は全部の表を書き終えてから呼び出し側で付ける.
+ */
+#define OPECODE_FILL_WORKS_MAX    (4)
+
+struct opecode_fill_work {
+    struct work_struct    work;
+    struct opecode_table* table;
+    unsigned int          table_nums;
+    unsigned int          xfer_mode;
+};
+
+static void fill_opecode_tables(struct opecode_table* table, unsigned int table_nums, unsigned int xfer_mode)
+{
+    for (; table_nums > 0; table_nums--) {
+        table->op_nums = fill_xfer_opecodes(
+            table->op_ptr        , /* struct opecode*      op_ptr     */
+            table->sg_start      , /* struct scatterlist*  sg_list    */
+            table->sg_count      , /* unsigned int         sg_nums    */
+            table->xfer_first    , /* bool                 xfer_first */
+            table->xfer_last     , /* bool                 xfer_last  */
+            xfer_mode              /* unsigned int         xfer_mode  */
+        );
+        table = list_entry(table->list.next, struct opecode_table, list);
+    }
+}
+
+static void fill_opecode_work(struct work_struct* work)
+{
+    struct opecode_fill_work* this = container_of(work, struct opecode_fill_work, work);
+    fill_opecode_tables(this->table, this->table_nums, this->xfer_mode);
+}
+
+static void fill_opecode_table_list(
+    struct list_head*   table_list,
+    unsigned int        table_nums,
+    unsigned int        xfer_mode ,
+    unsigned int        parallel
+)
+{
+    struct opecode_fill_work works[OPECODE_FILL_WORKS_MAX];
+    struct opecode_table*    table = list_entry(table_list->next, struct opecode_table, list);
+    unsigned int             work_nums = 0;
+    unsigned int             chunk;
+    unsigned int             i;
+    int                      this_cpu;
+    int                      cpu;
+
+    if ((parallel == 0) || (table_nums < parallel) || (num_online_cpus() < 2)) {
+        fill_opecode_tables(table, table_nums, xfer_mode);
+        return;
+    }
+    get_online_cpus();
+    chunk    = DIV_ROUND_UP(table_nums, min_t(unsigned int, num_online_cpus(), OPECODE_FILL_WORKS_MAX+1));
+    this_cpu = raw_smp_processor_id();
+    for_each_online_cpu(cpu) {
+        struct opecode_fill_work* fill = &works[work_nums];
+        if ((cpu == this_cpu) || (work_nums >= OPECODE_FILL_WORKS_MAX) || (table_nums <= chunk))
+            continue;
+        fill->table      = table;
+        fill->table_nums = chunk;
+        fill->xfer_mode  = xfer_mode;
+        INIT_WORK_ONSTACK(&fill->work, fill_opecode_work);
+        queue_work_on(cpu, system_highpri_wq, &fill->work);
+        work_nums++;
+        for (i = 0; i < chunk; i++)
+            table = list_entry(table->list.next, struct opecode_table, list);
+        table_nums -= chunk;
+    }
+    fill_opecode_tables(table, table_nums, xfer_mode);
+    for (i = 0; i < work_nums; i++) {
+        flush_work(&works[i].work);
+        destroy_work_on_stack(&works[i].work);
+    }
+    put_online_cpus();
+}
 static int alloc_opecode_table_from_sg(
     struct device*      dev       ,
     struct list_head*   buf_list  ,
@@ -349,10 +501,14 @@ static int alloc_opecode_table_from_sg(
     unsigned int        xfer_mode ,
     unsigned int        link_mode ,
     bool                irq_enable,
+    bool                cached    ,
+    struct gen_pool*    ocm_pool  ,
+    unsigned int        parallel  ,
     unsigned int        debug
 )
 {
     LIST_HEAD(new_table_list);
+    unsigned int table_nums = 0;
     int result = 0;
 
     if (sg_nums > 0) {
@@ -376,6 +532,7 @@ static int alloc_opecode_table_from_sg(
                 }
                 INIT_LIST_HEAD(&curr_table->list);
                 list_add_tail(&curr_table->list, &new_table_list);
+                table_nums++;
                 sg_start = curr_sg;
                 sg_count = 0;
             }
@@ -387,37 +544,27 @@ static int alloc_opecode_table_from_sg(
                 struct opecode* op_ptr;
                 bool xfer_last_table = (curr_sg_is_last) ? xfer_last : 0;
                 curr_table->op_bytes = (sg_count+1) * sizeof(struct opecode);
-                if (debug & PUMP_PROC_DEBUG_PHASE) 
-                    dev_info(dev, "dma_alloc_coherent(%d)\n", curr_table->op_bytes);
-                op_ptr = dma_alloc_coherent(
-                    dev                  , /* struct device* dev   */ 
-                    curr_table->op_bytes , /* size_t size          */ 
-                    &curr_table->dma_addr, /* dma_addr_t* dma_addr */ 
-                    GFP_KERNEL             /* int flag             */ 
-                );
-                if (debug & PUMP_PROC_DEBUG_PHASE) 
-                    dev_info(dev, "dma_alloc_coherent => %pK\n", op_ptr);
-                if (IS_ERR_OR_NULL(op_ptr)) {
-                    result = PTR_ERR(op_ptr);
+                if (PUMP_PROC_DEBUG_CHECK(debug, PUMP_PROC_DEBUG_PHASE)) 
+                    dev_info(dev, "alloc_opecode_memory(%d,%d)\n", curr_table->op_bytes, cached);
+                op_ptr = alloc_opecode_memory(dev, curr_table, cached, ocm_pool);
+                if (PUMP_PROC_DEBUG_CHECK(debug, PUMP_PROC_DEBUG_PHASE)) 
+                    dev_info(dev, "alloc_opecode_memory => %pK\n", op_ptr);
+                if (op_ptr == NULL) {
+                    result = -ENOMEM;
                     goto failed;
                 }
-                if (debug & PUMP_PROC_DEBUG_PHASE) 
-                    dev_info(dev, "fill_xfer_opecodes(%d)\n", sg_count);
-                curr_table->op_ptr  = op_ptr;
-                curr_table->op_nums = fill_xfer_opecodes(
-                    curr_table->op_ptr   , /* struct opecode*      op_ptr     */
-                    sg_start             , /* struct scatterlist*  sg_list    */
-                    sg_count             , /* unsigned int         sg_nums    */
-                    xfer_first           , /* bool                 xfer_first */
-                    xfer_last_table      , /* bool                 xfer_last  */
-                    xfer_mode              /* unsigned int         xfer_mode  */
-                );
-                if (debug & PUMP_PROC_DEBUG_PHASE) 
-                    dev_info(dev, "fill_xfer_opecodes => %d\n", curr_table->op_nums);
+                curr_table->op_ptr     = op_ptr;
+                curr_table->sg_start   = sg_start;
+                curr_table->sg_count   = sg_count;
+                curr_table->xfer_first = xfer_first;
+                curr_table->xfer_last  = xfer_last_table;
                 xfer_first = 0;
                 curr_table = NULL;
             }
         }
+        if (PUMP_PROC_DEBUG_CHECK(debug, PUMP_PROC_DEBUG_PHASE)) 
+            dev_info(dev, "fill_opecode_table_list(%d,%d)\n", table_nums, parallel);
+        fill_opecode_table_list(&new_table_list, table_nums, xfer_mode, parallel);
     }
 
     if (!list_empty(&new_table_list)) {
@@ -454,6 +601,7 @@ static int alloc_opecode_table_from_sg(
                     );
                     curr_table->op_nums++;
                 }
+                sync_opecode_table(dev, curr_table, 0, curr_table->op_nums);
             }
         }
     }
@@ -499,34 +647,113 @@ void pump_proc_debug_buf_list(struct pump_proc_data* this, struct list_head* buf
 }
 
 /**
- *
+ * add_opecode_table_list() - Append the tables for @sg_list to @buf_list and
+ *                            link the existing chain to them.
  */
-int  pump_proc_add_buf_list_from_sg(
+static int add_opecode_table_list(
     struct pump_proc_data*  this      ,
     struct list_head*       buf_list  ,
     struct scatterlist*     sg_list   , 
     unsigned int            sg_nums   , 
     bool                    xfer_first, 
     bool                    xfer_last ,
-    unsigned int            xfer_mode
+    unsigned int            xfer_mode ,
+    bool                    irq_enable
 )
 {
+    struct opecode_table* prev_table = NULL;
     int status;
+    if (!list_empty(buf_list))
+        prev_table = list_entry(buf_list->prev, struct opecode_table, list);
     status = alloc_opecode_table_from_sg(
-        this->dev       , /* struct device*      dev        */
-        buf_list        , /* struct list_head*   table_list */
-        sg_list         , /* struct scatterlist* sg_list    */
-        sg_nums         , /* unsigned int        sg_nums    */
-        xfer_first      , /* bool                xfer_first */
-        xfer_last       , /* bool                xfer_last  */
-        xfer_mode       , /* unsigned int        xfer_mode  */
-        this->link_mode , /* unsigned int        link_mode  */
-        this->irq_enable, /* bool                irq_enable */
-        this->debug       /* unsigned int        debug      */
+        this->dev             , /* struct device*      dev        */
+        buf_list              , /* struct list_head*   table_list */
+        sg_list               , /* struct scatterlist* sg_list    */
+        sg_nums               , /* unsigned int        sg_nums    */
+        xfer_first            , /* bool                xfer_first */
+        xfer_last             , /* bool                xfer_last  */
+        xfer_mode             , /* unsigned int        xfer_mode  */
+        this->link_mode       , /* unsigned int        link_mode  */
+        irq_enable            , /* bool                irq_enable */
+        this->table_cached    , /* bool                cached     */
+        (this->table_ocm) ? this->ocm_pool : NULL, /* struct gen_pool* ocm_pool */
+        this->table_parallel  , /* unsigned int        parallel   */
+        this->debug             /* unsigned int        debug      */
     );
+    /*
+     * 既にあるチェインの終端(NONE)を、追加した表へのLINKに置き換える.
+     */
+    if ((status == 0) && (prev_table != NULL) && (prev_table->list.next != buf_list)) {
+        struct opecode_table* next_table = list_entry(prev_table->list.next, struct opecode_table, list);
+        set_link_opecode(
+            &prev_table->op_ptr[prev_table->op_nums-1], /* struct opecode* op_ptr */
+            0                     ,                     /* bool            fetch  */
+            0                     ,                     /* bool            done   */
+            next_table->dma_addr  ,                     /* dma_addr_t      addr   */
+            this->link_mode       ,                     /* unsigned int    mode   */
+            irq_enable                                  /* bool            irq_ena*/
+        );
+        sync_opecode_table(this->dev, prev_table, prev_table->op_nums-1, 1);
+    }
+    if ((status == 0) && (this->table_ocm) && (this->ocm_pool != NULL)) {
+        struct opecode_table* table = (prev_table != NULL) ? prev_table
+                                                           : list_entry(buf_list, struct opecode_table, list);
+        list_for_each_entry_continue(table, buf_list, list) {
+            if (table->mem == OPECODE_MEM_OCM)
+                this->ocm_table_count++;
+            else
+                this->ocm_fallback_count++;
+        }
+    }
     return status;
 }
 
+/**
+ *
+ */
+int  pump_proc_add_buf_list_from_sg(
+    struct pump_proc_data*  this      ,
+    struct list_head*       buf_list  ,
+    struct scatterlist*     sg_list   , 
+    unsigned int            sg_nums   , 
+    bool                    xfer_first, 
+    bool                    xfer_last ,
+    unsigned int            xfer_mode
+)
+{
+    if (list_empty(buf_list))
+        this->chain_irq_enable = this->irq_enable;
+    return add_opecode_table_list(this, buf_list, sg_list, sg_nums, xfer_first, xfer_last, xfer_mode, this->chain_irq_enable);
+}
+
+/**
+ * pump_proc_prog_add_sg() - Append one op of a user program to @prog_list.
+ *
+ * A program is kept and started many times, so it is built with the
+ * irq_enable of the time it is loaded, and pump_proc_prog_prepare() must
+ * be called before each start.
+ */
+int  pump_proc_prog_add_sg(
+    struct pump_proc_data*  this      ,
+    struct list_head*       prog_list ,
+    struct scatterlist*     sg_list   , 
+    unsigned int            sg_nums   , 
+    bool                    xfer_first, 
+    bool                    xfer_last ,
+    unsigned int            xfer_mode
+)
+{
+    return add_opecode_table_list(this, prog_list, sg_list, sg_nums, xfer_first, xfer_last, xfer_mode, this->irq_enable);
+}
+
+/**
+ * pump_proc_prog_prepare() - Start the next chain the way programs are built.
+ */
+void pump_proc_prog_prepare(struct pump_proc_data* this)
+{
+    this->chain_irq_enable = this->irq_enable;
+}
+
 /**
  *
  */
@@ -535,6 +762,210 @@ void pump_proc_clear_buf_list(struct pump_proc_data* this, struct list_head* buf
     free_opecode_table(this->dev, buf_list);
 }
 
+/**
+ * pump_proc_table_nums() - Number of operation code tables in the list.
+ */
+unsigned int pump_proc_table_nums(struct list_head* buf_list)
+{
+    struct list_head* curr_head;
+    unsigned int      table_nums = 0;
+    list_for_each(curr_head, buf_list) {
+        table_nums++;
+    }
+    return table_nums;
+}
+
+/******************************************************************************
+ * Bounce Buffer Pool
+ ******************************************************************************
+ * 小さな転送のために、ストリーミングマップ済みのバッファと、
+ * XFER + NONE(done) だけのオペレーションコード表を前もって用意しておく.
+ * 転送毎に書き換えるのは XFER のサイズと First/Last だけ.
+ *****************************************************************************/
+#define PUMP_PROC_BOUNCE_OP_NUMS  (2)
+
+static inline int pump_proc_dma_direction(struct pump_proc_data* this)
+{
+    return (this->direction) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+}
+
+static int pump_proc_bounce_alloc(struct pump_proc_data* this, struct pump_proc_bounce* bounce, size_t size)
+{
+    struct opecode_table* table;
+
+    INIT_LIST_HEAD(&bounce->list);
+    INIT_LIST_HEAD(&bounce->table_list);
+    bounce->buf_size  = 0;
+    bounce->xfer_size = 0;
+
+    bounce->buf_ptr = kmalloc(size, GFP_KERNEL);
+    if (bounce->buf_ptr == NULL)
+        return -ENOMEM;
+    bounce->buf_addr = dma_map_single(this->dev, bounce->buf_ptr, size, pump_proc_dma_direction(this));
+    if (dma_mapping_error(this->dev, bounce->buf_addr)) {
+        kfree(bounce->buf_ptr);
+        bounce->buf_ptr = NULL;
+        return -ENOMEM;
+    }
+    bounce->buf_size = size;
+
+    table = kzalloc(sizeof(struct opecode_table), GFP_KERNEL);
+    if (table == NULL)
+        return -ENOMEM;
+    INIT_LIST_HEAD(&table->list);
+    list_add_tail(&table->list, &bounce->table_list);
+    table->op_bytes = PUMP_PROC_BOUNCE_OP_NUMS * sizeof(struct opecode);
+    table->op_ptr   = dma_alloc_coherent(this->dev, table->op_bytes, &table->dma_addr, GFP_KERNEL);
+    if (table->op_ptr == NULL)
+        return -ENOMEM;
+    set_xfer_opecode(&table->op_ptr[0], 0, 0, 1, 1, bounce->buf_addr, size, 0);
+    set_none_opecode(&table->op_ptr[1], 0, 1);
+    table->op_nums  = PUMP_PROC_BOUNCE_OP_NUMS;
+    return 0;
+}
+
+static void pump_proc_bounce_free(struct pump_proc_data* this, struct pump_proc_bounce* bounce)
+{
+    free_opecode_table(this->dev, &bounce->table_list);
+    if (bounce->buf_ptr != NULL) {
+        if (bounce->buf_size != 0)
+            dma_unmap_single(this->dev, bounce->buf_addr, bounce->buf_size, pump_proc_dma_direction(this));
+        kfree(bounce->buf_ptr);
+        bounce->buf_ptr = NULL;
+    }
+}
+
+/**
+ * pump_proc_bounce_setup() - Allocate @nums bounce buffers of @size bytes.
+ */
+int pump_proc_bounce_setup(struct pump_proc_data* this, unsigned int nums, size_t size)
+{
+    unsigned int i;
+    int          status;
+
+    this->bounce = kcalloc(nums, sizeof(struct pump_proc_bounce), GFP_KERNEL);
+    if (this->bounce == NULL)
+        return -ENOMEM;
+    this->bounce_nums = nums;
+    for (i = 0; i < nums; i++) {
+        status = pump_proc_bounce_alloc(this, &this->bounce[i], size);
+        if (status != 0) {
+            this->bounce_nums = i + 1;
+            pump_proc_bounce_cleanup(this);
+            return status;
+        }
+        list_add_tail(&this->bounce[i].list, &this->bounce_free_list);
+    }
+    return 0;
+}
+
+/**
+ * pump_proc_bounce_cleanup()
+ */
+void pump_proc_bounce_cleanup(struct pump_proc_data* this)
+{
+    unsigned int i;
+
+    if (this->bounce == NULL)
+        return;
+    for (i = 0; i < this->bounce_nums; i++)
+        pump_proc_bounce_free(this, &this->bounce[i]);
+    kfree(this->bounce);
+    this->bounce      = NULL;
+    this->bounce_nums = 0;
+    INIT_LIST_HEAD(&this->bounce_free_list);
+}
+
+/**
+ * pump_proc_bounce_get() - Take a free bounce buffer, or NULL if none is free.
+ */
+struct pump_proc_bounce* pump_proc_bounce_get(struct pump_proc_data* this)
+{
+    struct pump_proc_bounce* bounce = NULL;
+    unsigned long            flags;
+
+    spin_lock_irqsave(&this->bounce_lock, flags);
+    if (!list_empty(&this->bounce_free_list)) {
+        bounce = list_first_entry(&this->bounce_free_list, struct pump_proc_bounce, list);
+        list_del_init(&bounce->list);
+    }
+    spin_unlock_irqrestore(&this->bounce_lock, flags);
+    return bounce;
+}
+
+/**
+ * pump_proc_bounce_put()
+ */
+void pump_proc_bounce_put(struct pump_proc_data* this, struct pump_proc_bounce* bounce)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&this->bounce_lock, flags);
+    list_add(&bounce->list, &this->bounce_free_list);
+    spin_unlock_irqrestore(&this->bounce_lock, flags);
+}
+
+/**
+ * pump_proc_bounce_prepare() - Patch the prebuilt table and hand the buffer
+ *                              to the device.
+ *
+ * The buffer is then started with pump_proc_start(this, &bounce->table_list).
+ */
+int pump_proc_bounce_prepare(
+    struct pump_proc_data*   this      ,
+    struct pump_proc_bounce* bounce    ,
+    size_t                   xfer_size ,
+    bool                     xfer_first,
+    bool                     xfer_last ,
+    unsigned int             xfer_mode
+)
+{
+    struct opecode_table* table;
+
+    if ((xfer_size == 0) || (xfer_size > bounce->buf_size))
+        return -EINVAL;
+
+    table = list_first_entry(&bounce->table_list, struct opecode_table, list);
+    set_xfer_opecode(
+        &table->op_ptr[0],   /* struct opecode* op_ptr     */
+        0                ,   /* bool            fetch      */
+        0                ,   /* bool            done       */
+        xfer_first       ,   /* bool            xfer_first */
+        xfer_last        ,   /* bool            xfer_last  */
+        bounce->buf_addr ,   /* dma_addr_t      addr       */
+        xfer_size        ,   /* unsigned int    size       */
+        xfer_mode            /* unsigned int    mode       */
+    );
+    bounce->xfer_size = xfer_size;
+    dma_sync_single_for_device(this->dev, bounce->buf_addr, xfer_size, pump_proc_dma_direction(this));
+    this->chain_irq_enable = this->irq_enable;
+    return 0;
+}
+
+/**
+ * pump_proc_bounce_sync_for_device() - Hand a part of the buffer to the device.
+ */
+void pump_proc_bounce_sync_for_device(struct pump_proc_data* this, struct pump_proc_bounce* bounce, size_t offset, size_t size)
+{
+    dma_sync_single_for_device(this->dev, bounce->buf_addr + offset, size, pump_proc_dma_direction(this));
+}
+
+/**
+ * pump_proc_bounce_sync_for_cpu() - Give a part of the buffer back to the CPU.
+ */
+void pump_proc_bounce_sync_for_cpu(struct pump_proc_data* this, struct pump_proc_bounce* bounce, size_t offset, size_t size)
+{
+    dma_sync_single_for_cpu(this->dev, bounce->buf_addr + offset, size, pump_proc_dma_direction(this));
+}
+
+/**
+ * pump_proc_bounce_finish() - Give the buffer back to the CPU after the transfer.
+ */
+void pump_proc_bounce_finish(struct pump_proc_data* this, struct pump_proc_bounce* bounce)
+{
+    dma_sync_single_for_cpu(this->dev, bounce->buf_addr, bounce->xfer_size, pump_proc_dma_direction(this));
+}
+
 /**
  *
  */
@@ -557,11 +988,13 @@ int  pump_proc_start(struct pump_proc_data* this, struct list_head* buf_list)
     op_addr_hi    = (sizeof(op_addr) > 4) ? ((op_addr>>32) & 0xFFFFFFFF) : 0;
     op_ctrl       = ((PUMP_PROC_REGS_CTRL_START << PUMP_PROC_REGS_CTRL_POS) & PUMP_PROC_REGS_CTRL_MASK) | 
                     ((this->link_mode           << PUMP_PROC_REGS_MODE_POS) & PUMP_PROC_REGS_MODE_MASK) |
-                    ((this->irq_enable) ? PUMP_PROC_REGS_IE_DONE : 0);
+                    ((this->chain_irq_enable) ? PUMP_PROC_REGS_IE_DONE : 0);
 
     spin_lock_irqsave(&this->irq_lock, irq_flags);
     {
-        this->status = 0;
+        this->status     = 0;
+        this->busy       = 1;
+        this->submit_cpu = raw_smp_processor_id();
         iowrite32(cpu_to_le32(op_addr_lo), this->regs_addr+PUMP_PROC_REGS_ADDR_LO  );
         iowrite32(cpu_to_le32(op_addr_hi), this->regs_addr+PUMP_PROC_REGS_ADDR_HI  );
         iowrite32(0x00000000             , this->regs_addr+PUMP_PROC_REGS_RESERVE  );
@@ -580,6 +1013,8 @@ int pump_proc_stop(struct pump_proc_data* this)
 {
     volatile u32  ctrl_stat;
     unsigned long irq_flags;
+    unsigned int  wait_usec;
+    int           result = 0;
 
     spin_lock_irqsave(&this->irq_lock, irq_flags);
 
@@ -587,52 +1022,410 @@ int pump_proc_stop(struct pump_proc_data* this)
 
     ctrl_stat = le32_to_cpu(ioread32(this->regs_addr+PUMP_PROC_REGS_CTRL_STAT));
 
+    this->busy = 0;
+
     spin_unlock_irqrestore(&this->irq_lock, irq_flags);
 
-    return 0;
+    /*
+     * 転送中のバーストが終わってPUMPが止まるまで待つ.
+     * これより前にバッファを解放すると、止まる前のDMAが解放したページに書き込む.
+     */
+    for (wait_usec = 0; ; wait_usec++) {
+        ctrl_stat = le32_to_cpu(ioread32(this->regs_addr+PUMP_PROC_REGS_CTRL_STAT));
+        if ((ctrl_stat & (PUMP_PROC_REGS_CTRL_START << PUMP_PROC_REGS_CTRL_POS)) == 0)
+            break;
+        if (wait_usec >= PUMP_PROC_STOP_WAIT_USEC) {
+            dev_err(this->dev, "pump did not stop (CTRL_STAT=%08X)\n", ctrl_stat);
+            result = -EBUSY;
+            break;
+        }
+        udelay(1);
+    }
+    return result;
 }
 
 /**
+ * pump_proc_xfer_position() - Bytes of @buf_list known to be transferred.
  *
+ * Reads the operation code address register, so it is meant to be called
+ * after pump_proc_stop().  The register points at the next operation code
+ * to fetch; the one before it may have been cut short, so only the XFER
+ * operation codes before that one are counted.  Returns 0 if the address
+ * is not in @buf_list.
  */
-irqreturn_t pump_proc_irq(struct pump_proc_data* this)
+size_t pump_proc_xfer_position(struct pump_proc_data* this, struct list_head* buf_list)
 {
-    if (this->debug & PUMP_PROC_DEBUG_IRQ)
-        dev_info(this->dev, "pump_proc_irq(this=%pK)\n", this);
+    struct opecode_table* table;
+    u64                   op_addr;
+    size_t                bytes = 0;
+    size_t                last  = 0;
 
-    spin_lock(&this->irq_lock);
-    {
-        volatile u8 stat_regs = ioread8(this->regs_addr+PUMP_PROC_REGS_STAT);
-        if (stat_regs != 0) {
-            this->status   |= stat_regs;
-            iowrite8(0x00, this->regs_addr+PUMP_PROC_REGS_STAT);
-            schedule_work(&this->irq_work);
+    op_addr = ((u64)le32_to_cpu(ioread32(this->regs_addr+PUMP_PROC_REGS_ADDR_HI)) << 32) |
+              ((u64)le32_to_cpu(ioread32(this->regs_addr+PUMP_PROC_REGS_ADDR_LO))      );
+
+    list_for_each_entry(table, buf_list, list) {
+        bool         here = ((op_addr >= table->dma_addr) &&
+                             (op_addr <  table->dma_addr + table->op_bytes));
+        unsigned int nums = (here) ? min_t(unsigned int, table->op_nums,
+                                           (op_addr - table->dma_addr) / sizeof(struct opecode))
+                                   : table->op_nums;
+        unsigned int i;
+        for (i = 0; i < nums; i++) {
+            u32 ctrl = le32_to_cpu(table->op_ptr[i].code[3]);
+            if (((ctrl & PUMP_PROC_OPECODE_TYPE_MASK) >> PUMP_PROC_OPECODE_TYPE_POS) == PUMP_PROC_OPECODE_XFER_TYPE)
+                last = le32_to_cpu(table->op_ptr[i].code[2]);
+            else
+                last = 0;
+            bytes += last;
         }
+        if (here)
+            return bytes - last;
     }
-    spin_unlock(&this->irq_lock);
+    return 0;
+}
+
+/**
+ * pump_proc_update_irq_rate() - Update interrupt statistics once per second.
+ *
+ * Must be called with irq_lock held.
+ */
+static void pump_proc_update_irq_rate(struct pump_proc_data* this)
+{
+    unsigned long elapsed = jiffies - this->window_start;
 
-    if (this->debug & PUMP_PROC_DEBUG_IRQ)
-        dev_info(this->dev, "pump_proc_irq() => success\n");
+    if (elapsed < HZ)
+        return;
 
-    return IRQ_HANDLED;
+    this->irq_per_sec      = (this->window_irq_count      * HZ) / elapsed;
+    this->complete_per_sec = (this->window_complete_count * HZ) / elapsed;
+    this->window_irq_count      = 0;
+    this->window_complete_count = 0;
+    this->window_start          = jiffies;
 }
 
 /**
+ * pump_proc_irq_rate() - Interrupts and completions per second.
  *
+ * The rates are otherwise only updated when the engine reports a status,
+ * so reading them also closes the window of an idle engine and lets them
+ * fall back.
  */
-static void pump_proc_irq_work(struct work_struct* work)
+void pump_proc_irq_rate(struct pump_proc_data* this, unsigned long* irq_per_sec, unsigned long* complete_per_sec)
 {
-    struct pump_proc_data* this = container_of(work, struct pump_proc_data, irq_work);
+    unsigned long irq_flags;
+
+    spin_lock_irqsave(&this->irq_lock, irq_flags);
+    pump_proc_update_irq_rate(this);
+    if (irq_per_sec != NULL)
+        *irq_per_sec      = this->irq_per_sec;
+    if (complete_per_sec != NULL)
+        *complete_per_sec = this->complete_per_sec;
+    spin_unlock_irqrestore(&this->irq_lock, irq_flags);
+}
+
+/**
+ * pump_proc_reap_status() - Read and clear the status register.
+ *
+ * Must be called with irq_lock held.  Returns true when the engine reported
+ * something; the caller is responsible for scheduling the completion.
+ */
+static bool pump_proc_reap_status(struct pump_proc_data* this, bool from_irq)
+{
+    volatile u8 stat_regs = ioread8(this->regs_addr+PUMP_PROC_REGS_STAT);
 
-    if (this->debug & PUMP_PROC_DEBUG_IRQ)
-        dev_info(this->dev, "pump_proc_irq_work(this=%pK)\n", this);
+    if (stat_regs == 0)
+        return 0;
+
+    if (from_irq) {
+        this->irq_count++;
+        this->window_irq_count++;
+    }
+    this->status   |= stat_regs;
+    iowrite8(0x00, this->regs_addr+PUMP_PROC_REGS_STAT);
+    if (stat_regs & PUMP_PROC_REGS_STAT_DONE) {
+        this->complete_count++;
+        this->window_complete_count++;
+    }
+    if (stat_regs & (PUMP_PROC_REGS_STAT_DONE |
+                     PUMP_PROC_REGS_STAT_OERR |
+                     PUMP_PROC_REGS_STAT_FERR |
+                     PUMP_PROC_REGS_STAT_MERR)) {
+        this->busy      = 0;
+        this->done_time = ktime_get();
+    }
+    pump_proc_update_irq_rate(this);
+    return 1;
+}
+
+/**
+ * pump_proc_done_is_affine() - Whether the completion has a placement policy.
+ *
+ * Engines with a dedicated workqueue or a completion CPU are not batched
+ * with the other engines of the line.
+ */
+static inline bool pump_proc_done_is_affine(struct pump_proc_data* this)
+{
+    return ((this->done_wq != NULL) || (this->done_cpu != PUMP_PROC_DONE_CPU_ANY));
+}
+
+/**
+ * pump_proc_queue_done_work() - Queue the own work item of the engine.
+ */
+static void pump_proc_queue_done_work(struct pump_proc_data* this)
+{
+    struct workqueue_struct* wq  = (this->done_wq != NULL) ? this->done_wq : system_wq;
+    int                      cpu = (this->done_cpu == PUMP_PROC_DONE_CPU_SUBMIT) ? this->submit_cpu : this->done_cpu;
+
+    if ((cpu < 0) || !cpu_online(cpu))
+        queue_work(wq, &this->irq_work);
+    else
+        queue_work_on(cpu, wq, &this->irq_work);
+}
+
+/**
+ * pump_proc_complete() - Call the done function of the engine.
+ */
+static void pump_proc_complete(struct pump_proc_data* this)
+{
+    if (PUMP_PROC_DEBUG_CHECK(this->debug, PUMP_PROC_DEBUG_IRQ))
+        dev_info(this->dev, "pump_proc_complete(this=%pK)\n", this);
+
+    if (this->complete_cpu_count != NULL)
+        this_cpu_inc(*this->complete_cpu_count);
+    this->last_complete_cpu = raw_smp_processor_id();
 
     if (this->done_func != NULL) {
         this->done_func(this->done_arg);
     }
 
-    if (this->debug & PUMP_PROC_DEBUG_IRQ)
-        dev_info(this->dev, "pump_proc_irq_work() => success\n");
+    if (PUMP_PROC_DEBUG_CHECK(this->debug, PUMP_PROC_DEBUG_IRQ))
+        dev_info(this->dev, "pump_proc_complete() => success\n");
+}
+
+/**
+ *
+ */
+static void pump_proc_irq_work(struct work_struct* work)
+{
+    struct pump_proc_data* this = container_of(work, struct pump_proc_data, irq_work);
+    pump_proc_complete(this);
+}
+
+/******************************************************************************
+ * Shared Interrupt Line Dispatcher
+ ******************************************************************************
+ * 複数のPUMPが同じ割り込み信号を共有している場合、割り込み線毎に一つだけ
+ * ハンドラを登録して、その割り込み線に繋がっている全てのPUMPを調べる.
+ * 動作中のPUMPのステータスレジスタだけを一度だけ読み、どのPUMPも要因を
+ * 持っていなければ IRQ_NONE を返す. 終了処理は割り込み線毎に一つのワークに
+ * まとめて行う.
+ ******************************************************************************/
+static LIST_HEAD(pump_proc_irq_line_list);
+static DEFINE_MUTEX(pump_proc_irq_line_mutex);
+
+/**
+ * pump_proc_irq_line_scan() - Reap every engine on the line.
+ *
+ * Must be called with line->lock held.  Returns the number of engines that
+ * reported a status, *batched is incremented for each engine left to the
+ * line work.
+ */
+static unsigned int pump_proc_irq_line_scan(struct pump_proc_irq_line* line, bool busy_only, unsigned int* batched)
+{
+    struct pump_proc_data* engine;
+    unsigned int           reaped = 0;
+
+    list_for_each_entry(engine, &line->engine_list, irq_line_entry) {
+        if (busy_only && !engine->busy)
+            continue;
+        spin_lock(&engine->irq_lock);
+        if (pump_proc_reap_status(engine, 1)) {
+            if (pump_proc_done_is_affine(engine)) {
+                pump_proc_queue_done_work(engine);
+            } else {
+                if (list_empty(&engine->done_entry))
+                    list_add_tail(&engine->done_entry, &line->done_list);
+                (*batched)++;
+            }
+            reaped++;
+        }
+        spin_unlock(&engine->irq_lock);
+    }
+    return reaped;
+}
+
+/**
+ * pump_proc_irq_line_handler() - Interrupt handler of a shared line.
+ */
+static irqreturn_t pump_proc_irq_line_handler(int irq, void* data)
+{
+    struct pump_proc_irq_line* line    = data;
+    unsigned int               batched = 0;
+    unsigned int               reaped;
+
+    spin_lock(&line->lock);
+    reaped = pump_proc_irq_line_scan(line, 1, &batched);
+    /*
+     * 動作中のPUMPに要因が無い場合のみ、停止中のPUMPも調べる.
+     * (レベル割り込みが残ったままにならないように)
+     */
+    if (reaped == 0)
+        reaped = pump_proc_irq_line_scan(line, 0, &batched);
+    if (reaped == 0)
+        atomic_long_inc(&line->irq_none_count);
+    if (static_key_false(&pump_debug_key)) {
+        struct pump_proc_data* engine;
+        list_for_each_entry(engine, &line->engine_list, irq_line_entry) {
+            if (PUMP_PROC_DEBUG_CHECK(engine->debug, PUMP_PROC_DEBUG_IRQ))
+                dev_info(engine->dev, "pump_proc_irq_line_handler(irq=%d) => %s\n",
+                         irq, (reaped) ? "handled" : "none");
+        }
+    }
+    spin_unlock(&line->lock);
+
+    if (reaped == 0)
+        return IRQ_NONE;
+
+    if (batched > 0)
+        schedule_work(&line->work);
+    return IRQ_HANDLED;
+}
+
+/**
+ * pump_proc_irq_line_work() - Complete every engine reaped since the last run.
+ */
+static void pump_proc_irq_line_work(struct work_struct* work)
+{
+    struct pump_proc_irq_line* line = container_of(work, struct pump_proc_irq_line, work);
+    struct pump_proc_data*     engine;
+    unsigned long              irq_flags;
+    LIST_HEAD(done_list);
+
+    spin_lock_irqsave(&line->lock, irq_flags);
+    list_splice_init(&line->done_list, &done_list);
+    spin_unlock_irqrestore(&line->lock, irq_flags);
+
+    while (!list_empty(&done_list)) {
+        engine = list_first_entry(&done_list, struct pump_proc_data, done_entry);
+        spin_lock_irqsave(&line->lock, irq_flags);
+        list_del_init(&engine->done_entry);
+        spin_unlock_irqrestore(&line->lock, irq_flags);
+        pump_proc_complete(engine);
+    }
+}
+
+/**
+ * pump_proc_request_irq() - Attach the engine to the dispatcher of its IRQ line.
+ * @this:	Pointer to the pump proc data.
+ * @irq:	The interrupt number.
+ * @name:	Name passed to request_irq() when the line is created.
+ * returns:	Success or error status.
+ */
+int pump_proc_request_irq(struct pump_proc_data* this, unsigned int irq, const char* name)
+{
+    struct pump_proc_irq_line* line;
+    unsigned long              irq_flags;
+    int                        result = 0;
+
+    mutex_lock(&pump_proc_irq_line_mutex);
+
+    list_for_each_entry(line, &pump_proc_irq_line_list, list) {
+        if (line->irq == irq)
+            goto found;
+    }
+
+    line = kzalloc(sizeof(*line), GFP_KERNEL);
+    if (IS_ERR_OR_NULL(line)) {
+        result = -ENOMEM;
+        goto failed;
+    }
+    line->irq = irq;
+    spin_lock_init(&line->lock);
+    INIT_LIST_HEAD(&line->engine_list);
+    INIT_LIST_HEAD(&line->done_list);
+    INIT_WORK(&line->work, pump_proc_irq_line_work);
+
+    if (request_irq(irq, pump_proc_irq_line_handler, IRQF_DISABLED | IRQF_SHARED, name, line) != 0) {
+        kfree(line);
+        result = -EBUSY;
+        goto failed;
+    }
+    list_add_tail(&line->list, &pump_proc_irq_line_list);
+
+  found:
+    spin_lock_irqsave(&line->lock, irq_flags);
+    list_add_tail(&this->irq_line_entry, &line->engine_list);
+    line->engine_nums++;
+    this->irq_line = line;
+    spin_unlock_irqrestore(&line->lock, irq_flags);
+
+  failed:
+    mutex_unlock(&pump_proc_irq_line_mutex);
+    return result;
+}
+
+/**
+ * pump_proc_free_irq() - Detach the engine from the dispatcher of its IRQ line.
+ * @this:	Pointer to the pump proc data.
+ */
+void pump_proc_free_irq(struct pump_proc_data* this)
+{
+    struct pump_proc_irq_line* line = this->irq_line;
+    unsigned long              irq_flags;
+    bool                       last;
+
+    if (line == NULL)
+        return;
+
+    mutex_lock(&pump_proc_irq_line_mutex);
+
+    flush_work(&line->work);
+
+    spin_lock_irqsave(&line->lock, irq_flags);
+    list_del_init(&this->irq_line_entry);
+    list_del_init(&this->done_entry);
+    line->engine_nums--;
+    last = (line->engine_nums == 0);
+    this->irq_line = NULL;
+    spin_unlock_irqrestore(&line->lock, irq_flags);
+
+    /*
+     * アフィニティヒントは割り込み線のものなので、最後のPUMPが外れる時に消す.
+     */
+    if (last) {
+        irq_set_affinity_hint(line->irq, NULL);
+        free_irq(line->irq, line);
+        cancel_work_sync(&line->work);
+        list_del(&line->list);
+        kfree(line);
+    }
+
+    mutex_unlock(&pump_proc_irq_line_mutex);
+}
+
+/**
+ * pump_proc_complete_cpu_count() - Number of completions run on the CPU.
+ */
+unsigned long pump_proc_complete_cpu_count(struct pump_proc_data* this, int cpu)
+{
+    return (this->complete_cpu_count != NULL) ? *per_cpu_ptr(this->complete_cpu_count, cpu) : 0;
+}
+
+/**
+ * pump_proc_irq_none_count() - Number of interrupts on the line nobody claimed.
+ */
+unsigned long pump_proc_irq_none_count(struct pump_proc_data* this)
+{
+    unsigned long count = 0;
+
+    /*
+     * 割り込み線は最後のPUMPが外れると解放されるので、mutex の下で読む.
+     */
+    mutex_lock(&pump_proc_irq_line_mutex);
+    if (this->irq_line != NULL)
+        count = atomic_long_read(&this->irq_line->irq_none_count);
+    mutex_unlock(&pump_proc_irq_line_mutex);
+    return count;
 }
 
 /**
@@ -655,9 +1448,39 @@ int pump_proc_setup(
     this->done_func  = done_func;
     this->done_arg   = done_arg;
     this->debug      = 0;
+    this->table_cached = 1;
+    this->table_ocm    = 0;
+    this->table_parallel = PUMP_PROC_TABLE_PARALLEL_DEF;
+    this->ocm_pool     = NULL;
+    this->ocm_table_count    = 0;
+    this->ocm_fallback_count = 0;
     spin_lock_init(&this->irq_lock);
     this->irq_enable = 1;
+    this->chain_irq_enable      = 1;
+    this->irq_count             = 0;
+    this->complete_count        = 0;
+    this->window_start          = jiffies;
+    this->window_irq_count      = 0;
+    this->window_complete_count = 0;
+    this->irq_per_sec           = 0;
+    this->complete_per_sec      = 0;
     INIT_WORK(&this->irq_work, pump_proc_irq_work);
+    this->busy       = 0;
+    this->irq_line   = NULL;
+    INIT_LIST_HEAD(&this->irq_line_entry);
+    INIT_LIST_HEAD(&this->done_entry);
+    this->done_wq    = NULL;
+    this->done_cpu   = PUMP_PROC_DONE_CPU_ANY;
+    this->submit_cpu = 0;
+    this->done_time  = ktime_set(0, 0);
+    this->last_complete_cpu = 0;
+    this->bounce      = NULL;
+    this->bounce_nums = 0;
+    INIT_LIST_HEAD(&this->bounce_free_list);
+    spin_lock_init(&this->bounce_lock);
+    this->complete_cpu_count = alloc_percpu(unsigned long);
+    if (this->complete_cpu_count == NULL)
+        return -ENOMEM;
     return 0;
 }
 /**
@@ -666,5 +1489,10 @@ int pump_proc_setup(
 int pump_proc_cleanup(struct pump_proc_data* this)
 {
     cancel_work_sync(&this->irq_work);
+    pump_proc_bounce_cleanup(this);
+    if (this->complete_cpu_count != NULL) {
+        free_percpu(this->complete_cpu_count);
+        this->complete_cpu_count = NULL;
+    }
     return 0;
 }
@@ -33,6 +33,7 @@
 #define _PUMP_PROC_H_
 
 #include <linux/types.h>
+#include <linux/atomic.h>
 #include <linux/device.h>
 #include <linux/scatterlist.h>
 #include <linux/list.h>
@@ -40,6 +41,37 @@
 #include <linux/workqueue.h>
 #include <linux/kernel.h>
 #include <linux/interrupt.h>
+#include <linux/percpu.h>
+#include <linux/jump_label.h>
+#include <linux/genalloc.h>
+
+/**
+ * struct pump_proc_irq_line - Shared interrupt line dispatcher
+ *
+ */
+struct pump_proc_irq_line {
+    struct list_head     list;
+    unsigned int         irq;
+    spinlock_t           lock;
+    struct list_head     engine_list;
+    unsigned int         engine_nums;
+    struct list_head     done_list;
+    struct work_struct   work;
+    atomic_long_t        irq_none_count;
+};
+
+/**
+ * struct pump_proc_bounce - Preallocated buffer with a prebuilt XFER table
+ *
+ */
+struct pump_proc_bounce {
+    struct list_head     list;
+    struct list_head     table_list;
+    void*                buf_ptr;
+    dma_addr_t           buf_addr;
+    size_t               buf_size;
+    size_t               xfer_size;
+};
 
 /**
  * struct pump_proc_data - Pump proc driver data structure
@@ -57,11 +89,51 @@ struct pump_proc_data {
     void                 (*done_func)(void* done_arg);
     void*                done_arg;
     unsigned int         debug;
+    bool                 chain_irq_enable;
+    unsigned long        irq_count;
+    unsigned long        complete_count;
+    unsigned long        window_start;
+    unsigned long        window_irq_count;
+    unsigned long        window_complete_count;
+    unsigned long        irq_per_sec;
+    unsigned long        complete_per_sec;
+    bool                 busy;
+    struct pump_proc_irq_line* irq_line;
+    struct list_head     irq_line_entry;
+    struct list_head     done_entry;
+    struct workqueue_struct* done_wq;
+    int                  done_cpu;
+    int                  submit_cpu;
+    unsigned long __percpu* complete_cpu_count;
+    ktime_t              done_time;
+    int                  last_complete_cpu;
+    struct pump_proc_bounce* bounce;
+    unsigned int         bounce_nums;
+    struct list_head     bounce_free_list;
+    spinlock_t           bounce_lock;
+    bool                 table_cached;
+    bool                 table_ocm;
+    unsigned int         table_parallel;
+    struct gen_pool*     ocm_pool;
+    unsigned long        ocm_table_count;
+    unsigned long        ocm_fallback_count;
 };
 
 #define PUMP_PROC_DEBUG_PHASE (0x00000001)
 #define PUMP_PROC_DEBUG_IRQ   (0x00000002)
 
+/*
+ * pump_debug_key is enabled while any debug flag of any engine is set, so
+ * that the debug checks cost nothing on the transfer and interrupt paths.
+ */
+extern struct static_key pump_debug_key;
+#define PUMP_PROC_DEBUG_CHECK(debug,flag) (static_key_false(&pump_debug_key) && ((debug) & (flag)))
+
+#define PUMP_PROC_TABLE_PARALLEL_DEF     (16)
+
+#define PUMP_PROC_DONE_CPU_ANY           (-1)
+#define PUMP_PROC_DONE_CPU_SUBMIT        (-2)
+
 int         pump_proc_setup(
                 struct pump_proc_data* this     ,
                 struct device*         dev      ,
@@ -71,11 +143,17 @@ int         pump_proc_setup(
                 void*                  done_arg
             );
 int         pump_proc_cleanup       (struct pump_proc_data* this);
-irqreturn_t pump_proc_irq           (struct pump_proc_data* this);
+int         pump_proc_request_irq   (struct pump_proc_data* this, unsigned int irq, const char* name);
+void        pump_proc_free_irq      (struct pump_proc_data* this);
+unsigned long pump_proc_irq_none_count(struct pump_proc_data* this);
+void        pump_proc_irq_rate      (struct pump_proc_data* this, unsigned long* irq_per_sec, unsigned long* complete_per_sec);
+unsigned long pump_proc_complete_cpu_count(struct pump_proc_data* this, int cpu);
 int         pump_proc_start         (struct pump_proc_data* this, struct list_head* buf_list);
 int         pump_proc_stop          (struct pump_proc_data* this);
+size_t      pump_proc_xfer_position (struct pump_proc_data* this, struct list_head* buf_list);
 void        pump_proc_debug_buf_list(struct pump_proc_data* this, struct list_head* buf_list);
 void        pump_proc_clear_buf_list(struct pump_proc_data* this, struct list_head* buf_list);
+unsigned int pump_proc_table_nums   (struct list_head* buf_list);
 int         pump_proc_add_buf_list_from_sg(
                 struct pump_proc_data*  this      ,
                 struct list_head*       buf_list  ,
@@ -85,4 +163,29 @@ int         pump_proc_add_buf_list_from_sg(
                 bool                    xfer_last ,
                 unsigned int            xfer_mode
             );
+int         pump_proc_prog_add_sg(
+                struct pump_proc_data*  this      ,
+                struct list_head*       prog_list ,
+                struct scatterlist*     sg_list   , 
+                unsigned int            sg_nums   , 
+                bool                    xfer_first, 
+                bool                    xfer_last ,
+                unsigned int            xfer_mode
+            );
+void        pump_proc_prog_prepare  (struct pump_proc_data* this);
+int         pump_proc_bounce_setup  (struct pump_proc_data* this, unsigned int nums, size_t size);
+void        pump_proc_bounce_cleanup(struct pump_proc_data* this);
+struct pump_proc_bounce* pump_proc_bounce_get(struct pump_proc_data* this);
+void        pump_proc_bounce_put    (struct pump_proc_data* this, struct pump_proc_bounce* bounce);
+int         pump_proc_bounce_prepare(
+                struct pump_proc_data*   this      ,
+                struct pump_proc_bounce* bounce    ,
+                size_t                   xfer_size ,
+                bool                     xfer_first,
+                bool                     xfer_last ,
+                unsigned int             xfer_mode
+            );
+void        pump_proc_bounce_finish (struct pump_proc_data* this, struct pump_proc_bounce* bounce);
+void        pump_proc_bounce_sync_for_device(struct pump_proc_data* this, struct pump_proc_bounce* bounce, size_t offset, size_t size);
+void        pump_proc_bounce_sync_for_cpu   (struct pump_proc_data* this, struct pump_proc_bounce* bounce, size_t offset, size_t size);
 #endif
@@ -0,0 +1,190 @@
+/*
+ * pump_stat.c
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+
+#include "pump_stat.h"
+
+/**
+ * Rolling averages
+ *
+ * Exponentially decaying averages in the style of the load average,
+ * sampled once per second.  The 1s "average" is simply the last complete
+ * second.
+ */
+#define PUMP_STAT_FSHIFT        (11)
+#define PUMP_STAT_FIXED_1       (1 << PUMP_STAT_FSHIFT)
+#define PUMP_STAT_TICK_MAX      (600)
+
+static const u32 pump_stat_exp[PUMP_STAT_RATE_NUMS] = {
+    0,                          /* 1s  */
+    1853,                       /* 10s : FIXED_1 * exp(-1/10) */
+    2014,                       /* 60s : FIXED_1 * exp(-1/60) */
+};
+
+static inline u64 pump_stat_decay(u64 avg, u32 exp, u64 sample)
+{
+    return (avg * exp + (sample << PUMP_STAT_FSHIFT) * (PUMP_STAT_FIXED_1 - exp)) >> PUMP_STAT_FSHIFT;
+}
+
+/**
+ * pump_stat_tick() - Fold every elapsed second into the averages.
+ *
+ * Must be called with rate_lock held.  Only the first elapsed second has
+ * the pending bytes; the others were idle.  After PUMP_STAT_TICK_MAX idle
+ * seconds every average has decayed away.
+ */
+static void pump_stat_tick(struct pump_stat* this)
+{
+    unsigned long ticks = (jiffies - this->rate_tick) / HZ;
+    int           i;
+
+    if (ticks == 0)
+        return;
+    if (ticks > PUMP_STAT_TICK_MAX) {
+        for (i = 0; i < PUMP_STAT_RATE_NUMS; i++) {
+            this->bytes_avg[i] = 0;
+            this->count_avg[i] = 0;
+        }
+    } else {
+        unsigned long t;
+        for (t = 0; t < ticks; t++) {
+            for (i = 0; i < PUMP_STAT_RATE_NUMS; i++) {
+                this->bytes_avg[i] = pump_stat_decay(this->bytes_avg[i], pump_stat_exp[i], this->rate_bytes);
+                this->count_avg[i] = pump_stat_decay(this->count_avg[i], pump_stat_exp[i], this->rate_count);
+            }
+            this->rate_bytes = 0;
+            this->rate_count = 0;
+        }
+    }
+    this->rate_bytes = 0;
+    this->rate_count = 0;
+    this->rate_tick += ticks * HZ;
+}
+
+/**
+ * pump_stat_setup()
+ */
+void pump_stat_setup(struct pump_stat* this)
+{
+    int i;
+    atomic64_set(&this->xfer_bytes , 0);
+    atomic64_set(&this->xfer_count , 0);
+    atomic64_set(&this->xfer_errors, 0);
+    spin_lock_init(&this->rate_lock);
+    this->rate_tick  = jiffies;
+    this->rate_bytes = 0;
+    this->rate_count = 0;
+    for (i = 0; i < PUMP_STAT_RATE_NUMS; i++) {
+        this->bytes_avg[i] = 0;
+        this->count_avg[i] = 0;
+    }
+}
+
+/**
+ * pump_stat_account() - Account one finished transfer.
+ * @bytes:	Number of bytes of the transfer.
+ * @result:	0 or error status.  Failed transfers move no bytes.
+ */
+void pump_stat_account(struct pump_stat* this, size_t bytes, int result)
+{
+    unsigned long flags;
+
+    if (result != 0) {
+        atomic64_inc(&this->xfer_errors);
+        return;
+    }
+    atomic64_add(bytes, &this->xfer_bytes);
+    atomic64_inc(&this->xfer_count);
+
+    spin_lock_irqsave(&this->rate_lock, flags);
+    pump_stat_tick(this);
+    this->rate_bytes += bytes;
+    this->rate_count += 1;
+    spin_unlock_irqrestore(&this->rate_lock, flags);
+}
+
+/**
+ * pump_stat_get_rates() - Rolling averages in bytes/sec and 1/100 ops/sec.
+ */
+void pump_stat_get_rates(struct pump_stat* this, u64* bytes_per_sec, u64* ops_per_sec_x100)
+{
+    unsigned long flags;
+    int           i;
+
+    spin_lock_irqsave(&this->rate_lock, flags);
+    pump_stat_tick(this);
+    for (i = 0; i < PUMP_STAT_RATE_NUMS; i++) {
+        bytes_per_sec[i]    = this->bytes_avg[i] >> PUMP_STAT_FSHIFT;
+        ops_per_sec_x100[i] = (this->count_avg[i] * 100) >> PUMP_STAT_FSHIFT;
+    }
+    spin_unlock_irqrestore(&this->rate_lock, flags);
+}
+
+/**
+ * pump_stat_show_x100() - "1s 10s 60s" with two decimals, like loadavg.
+ */
+static int pump_stat_show_x100(char* buf, u64* value_x100)
+{
+    int len = 0;
+    int i;
+
+    for (i = 0; i < PUMP_STAT_RATE_NUMS; i++) {
+        u64 value    = value_x100[i];
+        u32 fraction = do_div(value, 100);
+        len += sprintf(buf + len, "%llu.%02u%c", (unsigned long long)value, fraction,
+                       (i == PUMP_STAT_RATE_NUMS - 1) ? '\n' : ' ');
+    }
+    return len;
+}
+
+int pump_stat_show_mb_per_sec(struct pump_stat* this, char* buf)
+{
+    u64 bytes_per_sec[PUMP_STAT_RATE_NUMS];
+    u64 ops_per_sec_x100[PUMP_STAT_RATE_NUMS];
+    int i;
+
+    pump_stat_get_rates(this, bytes_per_sec, ops_per_sec_x100);
+    for (i = 0; i < PUMP_STAT_RATE_NUMS; i++)
+        bytes_per_sec[i] = div_u64(bytes_per_sec[i], 10*1000);
+    return pump_stat_show_x100(buf, bytes_per_sec);
+}
+
+int pump_stat_show_ops_per_sec(struct pump_stat* this, char* buf)
+{
+    u64 bytes_per_sec[PUMP_STAT_RATE_NUMS];
+    u64 ops_per_sec_x100[PUMP_STAT_RATE_NUMS];
+
+    pump_stat_get_rates(this, bytes_per_sec, ops_per_sec_x100);
+    return pump_stat_show_x100(buf, ops_per_sec_x100);
+}
@@ -0,0 +1,70 @@
+/*
+ * pump_stat.h
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+#ifndef _PUMP_STAT_H_
+#define _PUMP_STAT_H_
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+
+/**
+ * struct pump_stat - Throughput counters of one device
+ *
+ * The totals are lock-free 64bit counters.  The rolling averages are
+ * updated once per elapsed second, lazily, by whoever accounts or reads
+ * next, so an idle device costs nothing.
+ */
+#define PUMP_STAT_RATE_NUMS     (3)     /* 1s, 10s, 60s */
+
+struct pump_stat {
+    atomic64_t           xfer_bytes;
+    atomic64_t           xfer_count;
+    atomic64_t           xfer_errors;
+    spinlock_t           rate_lock;
+    unsigned long        rate_tick;
+    u64                  rate_bytes;
+    u64                  rate_count;
+    u64                  bytes_avg[PUMP_STAT_RATE_NUMS];
+    u64                  count_avg[PUMP_STAT_RATE_NUMS];
+};
+
+void        pump_stat_setup  (struct pump_stat* this);
+void        pump_stat_account(struct pump_stat* this, size_t bytes, int result);
+int         pump_stat_show_mb_per_sec (struct pump_stat* this, char* buf);
+int         pump_stat_show_ops_per_sec(struct pump_stat* this, char* buf);
+void        pump_stat_get_rates(struct pump_stat* this, u64* bytes_per_sec, u64* ops_per_sec_x100);
+
+static inline u64 pump_stat_xfer_bytes (struct pump_stat* this) { return atomic64_read(&this->xfer_bytes ); }
+static inline u64 pump_stat_xfer_count (struct pump_stat* this) { return atomic64_read(&this->xfer_count ); }
+static inline u64 pump_stat_xfer_errors(struct pump_stat* this) { return atomic64_read(&this->xfer_errors); }
+
+#endif
@@ -0,0 +1,603 @@
+/*
+ * pump.cpp
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+
+#include "pump_ioctl.h"
+#include "pump.h"
+
+namespace pump {
+
+static uint64_t now_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Buffer
+ */
+Buffer::Buffer(Buffer&& other)
+    : device_(other.device_), data_(other.data_), size_(other.size_),
+      fd_(other.fd_), handle_(other.handle_)
+{
+    other.device_ = nullptr;
+    other.data_   = nullptr;
+    other.size_   = 0;
+    other.fd_     = -1;
+    other.handle_ = 0;
+}
+
+Buffer& Buffer::operator=(Buffer&& other)
+{
+    if (this != &other) {
+        reset();
+        std::swap(device_, other.device_);
+        std::swap(data_  , other.data_  );
+        std::swap(size_  , other.size_  );
+        std::swap(fd_    , other.fd_    );
+        std::swap(handle_, other.handle_);
+    }
+    return *this;
+}
+
+void Buffer::reset()
+{
+    if (device_ != nullptr)
+        device_->release(*this);
+    device_ = nullptr;
+    data_   = nullptr;
+    size_   = 0;
+    fd_     = -1;
+    handle_ = 0;
+}
+
+/**
+ * Device
+ */
+Device::Device(const std::string& name, Path path)
+    : name_(name),
+      dev_file_("/dev/" + name),
+      sys_file_("/sys/class/pump/" + name),
+      fd_(-1), direction_(0), path_(path),
+      msg_pos_(0), limit_size_(0),
+      session_peer_(nullptr), session_supported_(true),
+      stats_(), busy_(false), stop_(false)
+{
+    fd_ = open(dev_file_.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd_ < 0)
+        throw std::system_error(errno, std::generic_category(), dev_file_);
+    direction_  = (int)get_attribute("direction");
+    limit_size_ = get_attribute("limit_size");
+    if (path_ == Path::Auto)
+        path_ = (registered_supported(fd_)) ? Path::Registered : Path::ReadWrite;
+}
+
+Device::~Device()
+{
+    {
+        std::unique_lock<std::mutex> lock(queue_lock_);
+        stop_ = true;
+    }
+    queue_cond_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+    close(fd_);
+}
+
+/**
+ * registered_supported() - Probe PUMP_IOCTL_BUF_* without side effects.
+ *
+ * Releasing handle 0 fails with ENOENT on drivers that know the ioctl and
+ * with ENOTTY on drivers that do not.  Any other error still means the
+ * ioctl exists.
+ */
+bool Device::registered_supported(int fd)
+{
+    __u32 handle = 0;
+    if (ioctl(fd, PUMP_IOCTL_BUF_RELEASE, &handle) == 0)
+        return true;
+    return (errno != ENOTTY);
+}
+
+Buffer Device::alloc(size_t size)
+{
+    Buffer buffer;
+    if (size == 0)
+        throw std::invalid_argument("pump::Device::alloc: size is zero");
+    if (path_ == Path::Registered) {
+        struct pump_ioctl_buf_alloc  buf_alloc;
+        struct pump_ioctl_buf_import buf_import;
+        memset(&buf_alloc , 0, sizeof(buf_alloc ));
+        memset(&buf_import, 0, sizeof(buf_import));
+        buf_alloc.size = size;
+        if (ioctl(fd_, PUMP_IOCTL_BUF_ALLOC, &buf_alloc) != 0)
+            throw std::system_error(errno, std::generic_category(), name_ + ": PUMP_IOCTL_BUF_ALLOC");
+        buf_import.fd = buf_alloc.fd;
+        if (ioctl(fd_, PUMP_IOCTL_BUF_IMPORT, &buf_import) != 0) {
+            int error = errno;
+            close(buf_alloc.fd);
+            throw std::system_error(error, std::generic_category(), name_ + ": PUMP_IOCTL_BUF_IMPORT");
+        }
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, buf_alloc.fd, 0);
+        if (data == MAP_FAILED) {
+            int error = errno;
+            ioctl(fd_, PUMP_IOCTL_BUF_RELEASE, &buf_import.handle);
+            close(buf_alloc.fd);
+            throw std::system_error(error, std::generic_category(), name_ + ": mmap");
+        }
+        buffer.data_   = data;
+        buffer.fd_     = buf_alloc.fd;
+        buffer.handle_ = buf_import.handle;
+    } else {
+        void* data = nullptr;
+        int   error = posix_memalign(&data, sysconf(_SC_PAGESIZE), size);
+        if (error != 0)
+            throw std::system_error(error, std::generic_category(), name_ + ": posix_memalign");
+        buffer.data_   = data;
+    }
+    buffer.device_ = this;
+    buffer.size_   = size;
+    return buffer;
+}
+
+void Device::release(Buffer& buffer)
+{
+    if (buffer.handle_ != 0) {
+        drain();
+        munmap(buffer.data_, buffer.size_);
+        ioctl(fd_, PUMP_IOCTL_BUF_RELEASE, &buffer.handle_);
+        close(buffer.fd_);
+    } else {
+        drain();
+        free(buffer.data_);
+    }
+}
+
+/**
+ * transfer_registered() - PUMP_IOCTL_BUF_XFER path.
+ */
+ssize_t Device::transfer_registered(const Request& request)
+{
+    struct pump_ioctl_buf_xfer buf_xfer;
+    memset(&buf_xfer, 0, sizeof(buf_xfer));
+    buf_xfer.handle = request.buffer->handle();
+    buf_xfer.flags  = ((request.flags & XFER_FIRST) ? PUMP_XFER_FIRST : 0) |
+                      ((request.flags & XFER_LAST ) ? PUMP_XFER_LAST  : 0);
+    buf_xfer.offset = request.offset;
+    buf_xfer.length = request.length;
+    int result = ioctl(fd_, PUMP_IOCTL_BUF_XFER, &buf_xfer);
+    return (result < 0) ? -errno : result;
+}
+
+/**
+ * transfer_read_write() - read()/write() path.
+ *
+ * The driver derives the message framing from the file position: position
+ * 0 starts a message and reaching limit_size ends it.  A LAST fragment that
+ * ends before limit_size therefore moves limit_size first.
+ */
+ssize_t Device::transfer_read_write(const Request& request)
+{
+    if (request.flags & XFER_FIRST)
+        msg_pos_ = 0;
+    if ((request.flags & XFER_LAST) && (limit_size_ != msg_pos_ + request.length)) {
+        try {
+            set_attribute("limit_size", msg_pos_ + request.length);
+        } catch (const std::system_error& e) {
+            return -e.code().value();
+        }
+        limit_size_ = msg_pos_ + request.length;
+    }
+    /*
+     * The driver windows requests larger than its pinned memory budget and
+     * returns a short count, so keep going until the request is done.
+     */
+    char*   data = static_cast<char*>(request.buffer->data()) + request.offset;
+    size_t  done = 0;
+    while (done < request.length) {
+        ssize_t result;
+        if (direction_ == 1)
+            result = pwrite(fd_, data + done, request.length - done, msg_pos_);
+        else
+            result = pread (fd_, data + done, request.length - done, msg_pos_);
+        if (result < 0)
+            return (done > 0) ? (ssize_t)done : -errno;
+        if (result == 0)
+            break;
+        msg_pos_ += result;
+        done     += result;
+    }
+    return done;
+}
+
+bool Device::valid_request(const Request& request) const
+{
+    return (request.buffer != nullptr) && (request.buffer->device_ == this) &&
+           (request.offset <= request.buffer->size()) &&
+           (request.length <= request.buffer->size() - request.offset);
+}
+
+void Device::account(ssize_t result, uint64_t nsec)
+{
+    std::unique_lock<std::mutex> lock(stats_lock_);
+    stats_.lib_xfer_nsec += nsec;
+    if (result < 0) {
+        stats_.lib_xfer_errors++;
+    } else {
+        stats_.lib_xfer_count++;
+        stats_.lib_xfer_bytes += result;
+    }
+}
+
+ssize_t Device::transfer_locked(const Request& request)
+{
+    if (!valid_request(request))
+        return -EINVAL;
+    uint64_t start  = now_nsec();
+    ssize_t  result = (request.buffer->registered()) ? transfer_registered(request)
+                                                     : transfer_read_write(request);
+    account(result, now_nsec() - start);
+    return result;
+}
+
+ssize_t Device::transfer(Buffer& buffer, size_t offset, size_t length, uint32_t flags)
+{
+    Request request = {&buffer, offset, length, flags};
+    std::unique_lock<std::mutex> lock(xfer_lock_);
+    return transfer_locked(request);
+}
+
+/**
+ * load_program() - Compile registered buffer ranges into one chain.
+ *
+ * Every Request keeps its own XFER_FIRST/XFER_LAST, so a header, a payload
+ * and a trailer, or several messages, run as a single transfer each time
+ * run_program() is called.  The buffers can not be released while the
+ * program is loaded.
+ */
+uint32_t Device::load_program(const std::vector<Request>& requests)
+{
+    std::vector<struct pump_ioctl_buf_xfer> ops(requests.size());
+    for (size_t i = 0; i < requests.size(); i++) {
+        const Request& request = requests[i];
+        if (!valid_request(request) || !request.buffer->registered())
+            throw std::invalid_argument("pump::Device::load_program: not a registered buffer range");
+        memset(&ops[i], 0, sizeof(ops[i]));
+        ops[i].handle = request.buffer->handle();
+        ops[i].flags  = ((request.flags & XFER_FIRST) ? PUMP_XFER_FIRST : 0) |
+                        ((request.flags & XFER_LAST ) ? PUMP_XFER_LAST  : 0);
+        ops[i].offset = request.offset;
+        ops[i].length = request.length;
+    }
+    struct pump_ioctl_prog_load prog_load;
+    memset(&prog_load, 0, sizeof(prog_load));
+    prog_load.ops     = (uint64_t)(uintptr_t)ops.data();
+    prog_load.op_nums = ops.size();
+    if (ioctl(fd_, PUMP_IOCTL_PROG_LOAD, &prog_load) != 0)
+        throw std::system_error(errno, std::generic_category(), name_ + ": PUMP_IOCTL_PROG_LOAD");
+    return prog_load.handle;
+}
+
+ssize_t Device::run_program(uint32_t program)
+{
+    std::unique_lock<std::mutex> lock(xfer_lock_);
+    uint64_t start  = now_nsec();
+    int      status = ioctl(fd_, PUMP_IOCTL_PROG_RUN, &program);
+    ssize_t  result = (status < 0) ? -errno : status;
+    account(result, now_nsec() - start);
+    return result;
+}
+
+void Device::release_program(uint32_t program)
+{
+    ioctl(fd_, PUMP_IOCTL_PROG_RELEASE, &program);
+}
+
+/**
+ * enqueue() - Queue a job for the completion thread.
+ *
+ * The thread is started on the first submission so that purely
+ * synchronous users never pay for it.
+ */
+void Device::enqueue(Job&& job)
+{
+    {
+        std::unique_lock<std::mutex> lock(queue_lock_);
+        queue_.push_back(std::move(job));
+        if (!thread_.joinable())
+            thread_ = std::thread(&Device::worker, this);
+    }
+    queue_cond_.notify_one();
+}
+
+void Device::worker()
+{
+    std::unique_lock<std::mutex> lock(queue_lock_);
+    for (;;) {
+        queue_cond_.wait(lock, [this]{ return stop_ || !queue_.empty(); });
+        if (queue_.empty())
+            break;
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        busy_ = true;
+        lock.unlock();
+        ssize_t total = 0;
+        {
+            std::unique_lock<std::mutex> xfer_lock(xfer_lock_);
+            for (const Request& request : job.requests) {
+                ssize_t result = transfer_locked(request);
+                if (result < 0) {
+                    total = result;
+                    break;
+                }
+                total += result;
+            }
+        }
+        if (job.callback)
+            job.callback(total);
+        lock.lock();
+        busy_ = false;
+        if (queue_.empty())
+            idle_cond_.notify_all();
+    }
+}
+
+void Device::submit(Buffer& buffer, size_t offset, size_t length, uint32_t flags, Callback callback)
+{
+    Job job;
+    job.requests.push_back(Request{&buffer, offset, length, flags});
+    job.callback = std::move(callback);
+    enqueue(std::move(job));
+}
+
+std::future<ssize_t> Device::submit(Buffer& buffer, size_t offset, size_t length, uint32_t flags)
+{
+    return submit(std::vector<Request>(1, Request{&buffer, offset, length, flags}));
+}
+
+/**
+ * submit() - Submit a batch of requests.
+ *
+ * The requests run back to back with one wake-up of the completion thread;
+ * the future yields the total number of bytes or the first error.
+ */
+std::future<ssize_t> Device::submit(const std::vector<Request>& requests)
+{
+    std::shared_ptr<std::promise<ssize_t>> promise = std::make_shared<std::promise<ssize_t>>();
+    std::future<ssize_t> future = promise->get_future();
+    Job job;
+    job.requests = requests;
+    job.callback = [promise](ssize_t result){ promise->set_value(result); };
+    enqueue(std::move(job));
+    return future;
+}
+
+/**
+ * drain() - Wait until every submitted job has completed.
+ */
+void Device::drain()
+{
+    std::unique_lock<std::mutex> lock(queue_lock_);
+    if (thread_.joinable() && (std::this_thread::get_id() != thread_.get_id()))
+        idle_cond_.wait(lock, [this]{ return queue_.empty() && !busy_; });
+}
+
+/**
+ * exchange() - Write @send to the intake and read @receive from the outlet.
+ *
+ * @peer is the engine of the other direction; which of the two is the
+ * intake does not matter.  With buffers that are not registered and a
+ * driver that has PUMP_IOCTL_SESSION_XFER, both sides run in one system
+ * call.  Otherwise the outlet is submitted to its completion thread while
+ * the intake is transferred on the caller's thread.  The session call
+ * takes its framing from @flags only, not from the file position, and
+ * @peer must outlive the session, just as a Buffer must outlive its Device.
+ */
+Exchange Device::exchange(Device& peer, const Request& send, const Request& receive)
+{
+    Device&  intake = (direction_ == 1) ? *this : peer;
+    Device&  outlet = (direction_ == 1) ? peer  : *this;
+    Exchange result;
+    memset(&result, 0, sizeof(result));
+    if (intake.direction_ == outlet.direction_)
+        throw std::invalid_argument("pump::Device::exchange: peer has the same direction");
+    if (!intake.valid_request(send) || !outlet.valid_request(receive)) {
+        result.intake.result = -EINVAL;
+        result.outlet.result = -EINVAL;
+        return result;
+    }
+    if (!send.buffer->registered() && !receive.buffer->registered()) {
+        std::unique_lock<std::mutex> this_lock(xfer_lock_     , std::defer_lock);
+        std::unique_lock<std::mutex> peer_lock(peer.xfer_lock_, std::defer_lock);
+        std::lock(this_lock, peer_lock);
+        if (session_supported_ && (session_peer_ != &peer)) {
+            __s32 peer_fd = peer.fd_;
+            if (ioctl(fd_, PUMP_IOCTL_SESSION_BIND, &peer_fd) == 0)
+                session_peer_ = &peer;
+            else if ((errno == ENOTTY) || (errno == EINVAL))
+                session_supported_ = false;
+        }
+        if (session_supported_ && (session_peer_ == &peer)) {
+            struct pump_ioctl_session_xfer session_xfer;
+            memset(&session_xfer, 0, sizeof(session_xfer));
+            session_xfer.intake.addr   = (uintptr_t)(static_cast<char*>(send.buffer->data()) + send.offset);
+            session_xfer.intake.length = send.length;
+            session_xfer.intake.flags  = ((send.flags    & XFER_FIRST) ? PUMP_XFER_FIRST : 0) |
+                                         ((send.flags    & XFER_LAST ) ? PUMP_XFER_LAST  : 0);
+            session_xfer.outlet.addr   = (uintptr_t)(static_cast<char*>(receive.buffer->data()) + receive.offset);
+            session_xfer.outlet.length = receive.length;
+            session_xfer.outlet.flags  = ((receive.flags & XFER_FIRST) ? PUMP_XFER_FIRST : 0) |
+                                         ((receive.flags & XFER_LAST ) ? PUMP_XFER_LAST  : 0);
+            uint64_t start = now_nsec();
+            if ((ioctl(fd_, PUMP_IOCTL_SESSION_XFER, &session_xfer) == 0) ||
+                (session_xfer.intake.result != 0) || (session_xfer.outlet.result != 0)) {
+                uint64_t nsec = now_nsec() - start;
+                Exchange::Side*                 side[2]         = {&result.intake     , &result.outlet     };
+                struct pump_ioctl_session_side* session_side[2] = {&session_xfer.intake, &session_xfer.outlet};
+                for (int i = 0; i < 2; i++) {
+                    side[i]->result       = session_side[i]->result;
+                    side[i]->usec_setup   = session_side[i]->usec_setup;
+                    side[i]->usec_run     = session_side[i]->usec_run;
+                    side[i]->usec_wakeup  = session_side[i]->usec_wakeup;
+                    side[i]->usec_release = session_side[i]->usec_release;
+                }
+                result.session = true;
+                intake.account(result.intake.result, nsec);
+                outlet.account(result.outlet.result, nsec);
+                return result;
+            }
+            result.intake.result = -errno;
+            result.outlet.result = -errno;
+            return result;
+        }
+    }
+    std::future<ssize_t> received = outlet.submit(*receive.buffer, receive.offset, receive.length, receive.flags);
+    result.intake.result = intake.transfer(*send.buffer, send.offset, send.length, send.flags);
+    result.outlet.result = received.get();
+    return result;
+}
+
+unsigned long Device::get_attribute(const std::string& attr_name)
+{
+    std::string   attr_file = sys_file_ + "/" + attr_name;
+    std::ifstream ifs(attr_file);
+    unsigned long value;
+    if (!(ifs >> value))
+        throw std::system_error(EIO, std::generic_category(), attr_file);
+    return value;
+}
+
+void Device::set_attribute(const std::string& attr_name, unsigned long value)
+{
+    std::string   attr_file = sys_file_ + "/" + attr_name;
+    std::ofstream ofs(attr_file);
+    if (!(ofs << value << std::endl))
+        throw std::system_error(EIO, std::generic_category(), attr_file);
+}
+
+/**
+ * stats_from_ioctl() - One PUMP_IOCTL_GET_STATS call.
+ * returns:	false if the driver does not have the ioctl.
+ */
+bool Device::stats_from_ioctl(Stats& stats)
+{
+    struct pump_ioctl_stats ioctl_stats;
+    memset(&ioctl_stats, 0, sizeof(ioctl_stats));
+    ioctl_stats.size = sizeof(ioctl_stats);
+    if (ioctl(fd_, PUMP_IOCTL_GET_STATS, &ioctl_stats) != 0)
+        return false;
+    stats.timestamp_ns        = ioctl_stats.timestamp_ns;
+    stats.usec_buffer_setup   = ioctl_stats.usec_buffer_setup;
+    stats.usec_buffer_release = ioctl_stats.usec_buffer_release;
+    stats.usec_pump_run       = ioctl_stats.usec_pump_run;
+    stats.xfer_bytes          = ioctl_stats.xfer_bytes;
+    stats.xfer_count          = ioctl_stats.xfer_count;
+    stats.xfer_errors         = ioctl_stats.xfer_errors;
+    stats.irq_count           = ioctl_stats.irq_count;
+    stats.irq_per_sec         = ioctl_stats.irq_per_sec;
+    stats.irq_none_count      = ioctl_stats.irq_none_count;
+    stats.complete_count      = ioctl_stats.complete_count;
+    stats.complete_per_sec    = ioctl_stats.complete_per_sec;
+    for (int i = 0; i < 3; i++) {
+        stats.mb_per_sec [i]  = ioctl_stats.bytes_per_sec   [i] / (1000.0 * 1000.0);
+        stats.ops_per_sec[i]  = ioctl_stats.ops_per_sec_x100[i] / 100.0;
+    }
+    stats.pinned_bytes        = ioctl_stats.pinned_bytes;
+    stats.pinned_peak         = ioctl_stats.pinned_peak;
+    stats.desc_bytes          = ioctl_stats.desc_bytes;
+    stats.desc_peak           = ioctl_stats.desc_peak;
+    return true;
+}
+
+/**
+ * stats_from_sysfs() - Attribute by attribute, for drivers without the ioctl.
+ */
+void Device::stats_from_sysfs(Stats& stats)
+{
+    static const struct {
+        const char*                name;
+        uint64_t Stats::*          member;
+    } attrs[] = {
+        {"usec_buffer_setup"  , &Stats::usec_buffer_setup  },
+        {"usec_buffer_release", &Stats::usec_buffer_release},
+        {"usec_pump_run"      , &Stats::usec_pump_run      },
+        {"xfer_bytes"         , &Stats::xfer_bytes         },
+        {"xfer_count"         , &Stats::xfer_count         },
+        {"xfer_errors"        , &Stats::xfer_errors        },
+        {"irq_count"          , &Stats::irq_count          },
+        {"irq_per_sec"        , &Stats::irq_per_sec        },
+        {"irq_none_count"     , &Stats::irq_none_count     },
+        {"complete_count"     , &Stats::complete_count     },
+        {"pinned_bytes"       , &Stats::pinned_bytes       },
+        {"pinned_peak"        , &Stats::pinned_peak        },
+        {"desc_bytes"         , &Stats::desc_bytes         },
+        {"desc_peak"          , &Stats::desc_peak          },
+    };
+    stats.timestamp_ns = now_nsec();
+    for (const auto& attr : attrs) {
+        try {
+            stats.*attr.member = get_attribute(attr.name);
+        } catch (const std::system_error&) {
+            stats.*attr.member = 0;
+        }
+    }
+}
+
+/**
+ * stats() - Take a snapshot of the driver and library counters.
+ */
+Stats Device::stats()
+{
+    Stats snapshot;
+    {
+        std::unique_lock<std::mutex> lock(stats_lock_);
+        snapshot = stats_;
+    }
+    if (!stats_from_ioctl(snapshot))
+        stats_from_sysfs(snapshot);
+    return snapshot;
+}
+
+} // namespace pump
@@ -0,0 +1,251 @@
+/*
+ * pump.h
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+#ifndef _LIBPUMP_PUMP_H_
+#define _LIBPUMP_PUMP_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * libpump - user space client library for /dev/pumpN
+ *
+ * pump::Device opens one PUMP engine and picks the fastest transfer path
+ * the driver offers:
+ *
+ *   Path::Registered  buffers are allocated by the driver as dma-bufs and
+ *                     transferred with PUMP_IOCTL_BUF_XFER; nothing is pinned
+ *                     or mapped per transfer.
+ *   Path::ReadWrite   plain read()/write() on the device file, which pins
+ *                     the user pages on every call.
+ *
+ * All transfers of one Device are serialized, in submission order, either
+ * on the caller's thread (transfer()) or on the Device's completion thread
+ * (submit()).  Buffers must not outlive the Device that allocated them.
+ */
+namespace pump {
+
+enum class Path {
+    Auto,
+    Registered,
+    ReadWrite,
+};
+
+enum : uint32_t {
+    XFER_FIRST = (1 << 0),
+    XFER_LAST  = (1 << 1),
+    XFER_WHOLE = XFER_FIRST | XFER_LAST,
+};
+
+class Device;
+
+/**
+ * class Buffer - DMA buffer owned by a Device
+ *
+ * Registered buffers are mmap()ed from the dma-buf the driver exported and
+ * released when the Buffer is destroyed.  On the read/write path a Buffer
+ * is plain page aligned memory.
+ */
+class Buffer {
+  public:
+    Buffer() : device_(nullptr), data_(nullptr), size_(0), fd_(-1), handle_(0) {}
+    Buffer(Buffer&& other);
+    Buffer& operator=(Buffer&& other);
+    Buffer(const Buffer&)            = delete;
+    Buffer& operator=(const Buffer&) = delete;
+    ~Buffer() { reset(); }
+
+    void*    data()       const { return data_;   }
+    size_t   size()       const { return size_;   }
+    int      fd()         const { return fd_;     }
+    uint32_t handle()     const { return handle_; }
+    bool     registered() const { return handle_ != 0; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+    void     reset();
+
+  private:
+    friend class Device;
+    Device*  device_;
+    void*    data_;
+    size_t   size_;
+    int      fd_;
+    uint32_t handle_;
+};
+
+/**
+ * struct Request - One element of a batched submission
+ */
+struct Request {
+    Buffer*  buffer;
+    size_t   offset;
+    size_t   length;
+    uint32_t flags;
+};
+
+/**
+ * struct Stats - Snapshot of the driver and library counters
+ *
+ * With PUMP_IOCTL_GET_STATS the driver counters are one consistent
+ * snapshot taken by a single ioctl.  Older drivers are read attribute by
+ * attribute from /sys/class/pump/pumpN, and counters they do not have
+ * read as 0.
+ */
+struct Stats {
+    uint64_t      timestamp_ns;
+    uint64_t      usec_buffer_setup;
+    uint64_t      usec_buffer_release;
+    uint64_t      usec_pump_run;
+    uint64_t      xfer_bytes;
+    uint64_t      xfer_count;
+    uint64_t      xfer_errors;
+    uint64_t      irq_count;
+    uint64_t      irq_per_sec;
+    uint64_t      irq_none_count;
+    uint64_t      complete_count;
+    uint64_t      complete_per_sec;
+    double        mb_per_sec[3];        /* 1s, 10s, 60s */
+    double        ops_per_sec[3];       /* 1s, 10s, 60s */
+    uint64_t      pinned_bytes;
+    uint64_t      pinned_peak;
+    uint64_t      desc_bytes;
+    uint64_t      desc_peak;
+    uint64_t      lib_xfer_count;
+    uint64_t      lib_xfer_bytes;
+    uint64_t      lib_xfer_nsec;
+    uint64_t      lib_xfer_errors;
+};
+
+/**
+ * struct Exchange - Result of Device::exchange()
+ *
+ * @result is the number of bytes transferred or -errno.  The timing is
+ * only filled in when the driver ran both sides in one session call.
+ */
+struct Exchange {
+    struct Side {
+        ssize_t   result;
+        uint32_t  usec_setup;
+        uint32_t  usec_run;
+        uint32_t  usec_wakeup;
+        uint32_t  usec_release;
+    };
+    Side          intake;
+    Side          outlet;
+    bool          session;
+};
+
+/**
+ * class Device - One PUMP engine
+ */
+class Device {
+  public:
+    typedef std::function<void(ssize_t result)> Callback;
+
+    explicit Device(const std::string& name, Path path = Path::Auto);
+    Device(const Device&)            = delete;
+    Device& operator=(const Device&) = delete;
+    ~Device();
+
+    const std::string& name()      const { return name_;      }
+    int                direction() const { return direction_; }
+    Path               path()      const { return path_;      }
+    static bool        registered_supported(int fd);
+
+    Buffer             alloc(size_t size);
+
+    ssize_t            transfer(Buffer& buffer, size_t offset, size_t length, uint32_t flags = XFER_WHOLE);
+    std::future<ssize_t> submit(Buffer& buffer, size_t offset, size_t length, uint32_t flags = XFER_WHOLE);
+    void               submit(Buffer& buffer, size_t offset, size_t length, uint32_t flags, Callback callback);
+    std::future<ssize_t> submit(const std::vector<Request>& requests);
+    void               drain();
+
+    Exchange           exchange(Device& peer, const Request& send, const Request& receive);
+
+    uint32_t           load_program(const std::vector<Request>& requests);
+    ssize_t            run_program(uint32_t program);
+    void               release_program(uint32_t program);
+
+    Stats              stats();
+    bool               stats_from_ioctl(Stats& stats);
+    void               stats_from_sysfs(Stats& stats);
+    unsigned long      get_attribute(const std::string& attr_name);
+    void               set_attribute(const std::string& attr_name, unsigned long value);
+
+  private:
+    friend class Buffer;
+    struct Job {
+        std::vector<Request>   requests;
+        Callback               callback;
+    };
+
+    ssize_t            transfer_locked(const Request& request);
+    ssize_t            transfer_registered(const Request& request);
+    ssize_t            transfer_read_write(const Request& request);
+    bool               valid_request(const Request& request) const;
+    void               account(ssize_t result, uint64_t nsec);
+    void               release(Buffer& buffer);
+    void               enqueue(Job&& job);
+    void               worker();
+
+    std::string             name_;
+    std::string             dev_file_;
+    std::string             sys_file_;
+    int                     fd_;
+    int                     direction_;
+    Path                    path_;
+    std::mutex              xfer_lock_;
+    size_t                  msg_pos_;
+    unsigned long           limit_size_;
+    Device*                 session_peer_;
+    bool                    session_supported_;
+    std::mutex              stats_lock_;
+    Stats                   stats_;
+    std::mutex              queue_lock_;
+    std::condition_variable queue_cond_;
+    std::condition_variable idle_cond_;
+    std::deque<Job>         queue_;
+    bool                    busy_;
+    bool                    stop_;
+    std::thread             thread_;
+};
+
+} // namespace pump
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * pump_bench.cpp
+ *
+ * Copyright (C) 2015 Ichiro Kawazome
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/**
+ * pump_bench [-s size] [-n count] [-b batch] [-c] [-o] [intake-name] [outlet-name]
+ *
+ * Loops data from the intake engine (default pump1) back through the
+ * outlet engine (default pump0) and reports the throughput of each
+ * transfer path:
+ *
+ *   read_write   plain read()/write(), pins user pages on every call
+ *   registered   PUMP_IOCTL_BUF_XFER on driver allocated dma-bufs
+ *   async_batch  registered buffers, submitted in batches of -b requests
+ *   session      read/write buffers, both directions in one
+ *                PUMP_IOCTL_SESSION_XFER call per round trip
+ *
+ * With -c it instead sweeps the transfer size on the read/write path with
+ * the bounce buffers disabled and enabled, to find the bounce_threshold
+ * crossover.
+ *
+ * With -o it sweeps the transfer size on the read/write path with the
+ * opecode tables built in DDR and in the on-chip memory pool ("ocm-pool"
+ * in the devicetree), and reports how many tables fell back to DDR.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <exception>
+#include <thread>
+
+#include "pump.h"
+
+static void run(pump::Device& intake, pump::Device& outlet, size_t size, int count, int batch, bool async)
+{
+    pump::Buffer ibuf = intake.alloc(size);
+    pump::Buffer obuf = outlet.alloc(size);
+    for (size_t i = 0; i < size; i++)
+        static_cast<unsigned char*>(ibuf.data())[i] = (unsigned char)(i * 7 + 1);
+
+    pump::Stats ibefore = intake.stats();
+    pump::Stats obefore = outlet.stats();
+    int         errors  = 0;
+    auto        start   = std::chrono::steady_clock::now();
+
+    auto loop = [&](pump::Device& device, pump::Buffer& buffer) {
+        if (!async) {
+            for (int i = 0; i < count; i++)
+                if (device.transfer(buffer, 0, size) != (ssize_t)size)
+                    errors++;
+            return;
+        }
+        std::vector<pump::Request> requests;
+        for (int i = 0; i < count; i += batch) {
+            int n = (count - i < batch) ? count - i : batch;
+            requests.assign(n, pump::Request{&buffer, 0, size, pump::XFER_WHOLE});
+            if (device.submit(requests).get() != (ssize_t)(size * n))
+                errors++;
+        }
+    };
+    std::thread writer([&]{ loop(intake, ibuf); });
+    loop(outlet, obuf);
+    writer.join();
+
+    auto   stop   = std::chrono::steady_clock::now();
+    double sec    = std::chrono::duration<double>(stop - start).count();
+    double bytes  = (double)size * count;
+    pump::Stats iafter = intake.stats();
+    pump::Stats oafter = outlet.stats();
+    if (memcmp(ibuf.data(), obuf.data(), size) != 0)
+        errors++;
+
+    printf("%-12s size=%-9zu count=%-5d %9.2f[MB/sec] %9.2f[usec/xfer] setup=%llu[usec] run=%llu[usec] irq=%llu %s\n",
+           (async) ? "async_batch" : (intake.path() == pump::Path::Registered) ? "registered" : "read_write",
+           size, count,
+           bytes / sec / (1000.0 * 1000.0),
+           sec * 1000.0 * 1000.0 / count,
+           (unsigned long long)((iafter.usec_buffer_setup - ibefore.usec_buffer_setup) + (oafter.usec_buffer_setup - obefore.usec_buffer_setup)),
+           (unsigned long long)((iafter.usec_pump_run     - ibefore.usec_pump_run    ) + (oafter.usec_pump_run     - obefore.usec_pump_run    )),
+           (unsigned long long)((iafter.irq_count         - ibefore.irq_count        ) + (oafter.irq_count         - obefore.irq_count        )),
+           (errors == 0) ? "ok" : "NG");
+}
+
+static void run_session(pump::Device& intake, pump::Device& outlet, size_t size, int count)
+{
+    pump::Buffer ibuf = intake.alloc(size);
+    pump::Buffer obuf = outlet.alloc(size);
+    for (size_t i = 0; i < size; i++)
+        static_cast<unsigned char*>(ibuf.data())[i] = (unsigned char)(i * 5 + 3);
+
+    pump::Request send    = {&ibuf, 0, size, pump::XFER_WHOLE};
+    pump::Request receive = {&obuf, 0, size, pump::XFER_WHOLE};
+    unsigned long isetup  = 0, irun = 0, osetup = 0, orun = 0;
+    int           errors  = 0;
+    bool          session = false;
+    auto          start   = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        pump::Exchange exchange = intake.exchange(outlet, send, receive);
+        if ((exchange.intake.result != (ssize_t)size) || (exchange.outlet.result != (ssize_t)size))
+            errors++;
+        isetup += exchange.intake.usec_setup;
+        irun   += exchange.intake.usec_run;
+        osetup += exchange.outlet.usec_setup;
+        orun   += exchange.outlet.usec_run;
+        session = exchange.session;
+    }
+    auto   stop   = std::chrono::steady_clock::now();
+    double sec    = std::chrono::duration<double>(stop - start).count();
+    if (memcmp(ibuf.data(), obuf.data(), size) != 0)
+        errors++;
+
+    printf("%-12s size=%-9zu count=%-5d %9.2f[MB/sec] %9.2f[usec/xfer] intake=%lu/%lu outlet=%lu/%lu[usec setup/run] %s\n",
+           (session) ? "session" : "session(emu)",
+           size, count,
+           (double)size * count / sec / (1000.0 * 1000.0),
+           sec * 1000.0 * 1000.0 / count,
+           isetup, irun, osetup, orun,
+           (errors == 0) ? "ok" : "NG");
+}
+
+/**
+ * latency() - Microseconds per read()/write() loop of @size bytes.
+ */
+static double latency(pump::Device& intake, pump::Device& outlet, size_t size, int count)
+{
+    pump::Buffer ibuf = intake.alloc(size);
+    pump::Buffer obuf = outlet.alloc(size);
+    auto start = std::chrono::steady_clock::now();
+    std::thread writer([&]{ for (int i = 0; i < count; i++) intake.transfer(ibuf, 0, size); });
+    for (int i = 0; i < count; i++)
+        outlet.transfer(obuf, 0, size);
+    writer.join();
+    auto stop  = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count() * 1000.0 * 1000.0 / count;
+}
+
+static void crossover(const char* intake_name, const char* outlet_name, int count)
+{
+    pump::Device  intake(intake_name, pump::Path::ReadWrite);
+    pump::Device  outlet(outlet_name, pump::Path::ReadWrite);
+    unsigned long ithreshold = intake.get_attribute("bounce_threshold");
+    unsigned long othreshold = outlet.get_attribute("bounce_threshold");
+    const size_t  size_max   = 64 * 1024;
+
+    printf("%-9s %12s %12s\n", "size", "pin[usec]", "bounce[usec]");
+    for (size_t size = 256; size <= size_max; size *= 2) {
+        intake.set_attribute("bounce_threshold", 0);
+        outlet.set_attribute("bounce_threshold", 0);
+        double pin_usec    = latency(intake, outlet, size, count);
+        intake.set_attribute("bounce_threshold", size_max);
+        outlet.set_attribute("bounce_threshold", size_max);
+        double bounce_usec = latency(intake, outlet, size, count);
+        printf("%-9zu %12.2f %12.2f%s\n", size, pin_usec, bounce_usec,
+               (bounce_usec < pin_usec) ? "" : "  <- pinning wins");
+    }
+    intake.set_attribute("bounce_threshold", ithreshold);
+    outlet.set_attribute("bounce_threshold", othreshold);
+}
+
+static void descriptors(const char* intake_name, const char* outlet_name, int count)
+{
+    pump::Device  intake(intake_name, pump::Path::ReadWrite);
+    pump::Device  outlet(outlet_name, pump::Path::ReadWrite);
+    unsigned long iocm       = intake.get_attribute("table_ocm");
+    unsigned long oocm       = outlet.get_attribute("table_ocm");
+    unsigned long ithreshold = intake.get_attribute("bounce_threshold");
+    unsigned long othreshold = outlet.get_attribute("bounce_threshold");
+    const size_t  size_max   = 4 * 1024 * 1024;
+
+    intake.set_attribute("bounce_threshold", 0);
+    outlet.set_attribute("bounce_threshold", 0);
+    printf("%-9s %12s %12s %10s %10s\n", "size", "ddr[usec]", "ocm[usec]", "ocm_tables", "fallback");
+    for (size_t size = 4096; size <= size_max; size *= 4) {
+        intake.set_attribute("table_ocm", 0);
+        outlet.set_attribute("table_ocm", 0);
+        double ddr_usec = latency(intake, outlet, size, count);
+        unsigned long tables   = intake.get_attribute("ocm_table_count"   ) + outlet.get_attribute("ocm_table_count"   );
+        unsigned long fallback = intake.get_attribute("ocm_fallback_count") + outlet.get_attribute("ocm_fallback_count");
+        intake.set_attribute("table_ocm", 1);
+        outlet.set_attribute("table_ocm", 1);
+        double ocm_usec = latency(intake, outlet, size, count);
+        tables   = intake.get_attribute("ocm_table_count"   ) + outlet.get_attribute("ocm_table_count"   ) - tables;
+        fallback = intake.get_attribute("ocm_fallback_count") + outlet.get_attribute("ocm_fallback_count") - fallback;
+        printf("%-9zu %12.2f %12.2f %10lu %10lu%s\n", size, ddr_usec, ocm_usec, tables, fallback,
+               (tables + fallback == 0) ? "  (no ocm-pool)" : "");
+    }
+    intake.set_attribute("table_ocm", iocm);
+    outlet.set_attribute("table_ocm", oocm);
+    intake.set_attribute("bounce_threshold", ithreshold);
+    outlet.set_attribute("bounce_threshold", othreshold);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t      size   = 64 * 1024;
+    int         count  = 1000;
+    int         batch  = 16;
+    const char* intake_name = "pump1";
+    const char* outlet_name = "pump0";
+    bool        sweep  = false;
+    bool        ocm    = false;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "s:n:b:co")) != -1) {
+        switch (opt) {
+            case 's': size  = strtoul(optarg, NULL, 0); break;
+            case 'n': count = atoi(optarg);             break;
+            case 'b': batch = atoi(optarg);             break;
+            case 'c': sweep = true;                     break;
+            case 'o': ocm   = true;                     break;
+            default :
+                fprintf(stderr, "usage: %s [-s size] [-n count] [-b batch] [-c] [-o] [intake] [outlet]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc) intake_name = argv[optind++];
+    if (optind < argc) outlet_name = argv[optind++];
+    if ((size == 0) || (count <= 0) || (batch <= 0)) {
+        fprintf(stderr, "%s: size, count and batch must be positive\n", argv[0]);
+        return 1;
+    }
+    try {
+        if (sweep) {
+            crossover(intake_name, outlet_name, count);
+            return 0;
+        }
+        if (ocm) {
+            descriptors(intake_name, outlet_name, count);
+            return 0;
+        }
+        {
+            pump::Device intake(intake_name, pump::Path::ReadWrite);
+            pump::Device outlet(outlet_name, pump::Path::ReadWrite);
+            run(intake, outlet, size, count, batch, false);
+            run_session(intake, outlet, size, count);
+        }
+        {
+            pump::Device intake(intake_name);
+            pump::Device outlet(outlet_name);
+            if (intake.path() != pump::Path::Registered || outlet.path() != pump::Path::Registered) {
+                printf("registered buffers are not supported by the driver\n");
+                return 0;
+            }
+            run(intake, outlet, size, count, batch, false);
+            run(intake, outlet, size, count, batch, true );
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+    return 0;
+}